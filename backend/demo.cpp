@@ -194,31 +194,6 @@ void writeToFile(vector<vector<double>> &matrix)
     outFile.close();
 }
 
-void writeToFile(string s1)
-{
-    ifstream csvFile(s1);
-    ofstream txtFile("weights.txt");
-
-    if (!csvFile.is_open()) {
-        cerr << "Failed to open data.csv\n";
-    }
-
-    if (!txtFile.is_open()) {
-        cerr << "Failed to open output.txt\n";
-    }
-
-    string line;
-    while (getline(csvFile, line)) {
-        txtFile << line << '\n';
-    }
-
-    csvFile.close();
-    txtFile.close();
-
-    cout << "CSV contents copied to output.txt\n";
-
-}
-
 int main(int argc, char **argv)
 {
     try
@@ -248,8 +223,8 @@ int main(int argc, char **argv)
         Data all = readCSV(datasetFile);
         Data d = all;
         displayDataFrame(all);
-        if (modelName != "k_means_clustering")
-            standardize(all);
+        if (modelName != "k_means_clustering" && modelName != "knn")
+            standardize(all); // KNN standardises through its own scaler so it can be saved with the model
         // 3) Split 80/20, seed=42
         auto [trainD, testD] = train_test_split(all, 0.2, 42);
 
@@ -265,7 +240,11 @@ int main(int argc, char **argv)
         }
         else if (modelName == "knn")
         {
-            model = new KNN(k, lr, epochs);
+            KNN *knn = new KNN(k, lr, epochs);
+            compute_mu_sigma(d.features, knn->featureMean, knn->featureScale);
+            for (auto &sigma : knn->featureScale)
+                sigma += 1e-8;
+            model = knn;
         }
         else if (modelName == "svm")
         {
@@ -385,7 +364,8 @@ int main(int argc, char **argv)
         }
         else if (modelName == "knn")
         {
-            writeToFile(datasetFile);
+            static_cast<KNN *>(model)->save("knn_model.bin");
+            cout << "Model written to knn_model.bin\n";
             // KNN: accuracy is already computed above
             vector<double> yTrue;
             for (auto &s : testD.target)
@@ -430,20 +410,8 @@ int main(int argc, char **argv)
 
             writeToFile(static_cast<KMeans *>(model)->centroids);
 
-            vector<int> assignments = static_cast<KMeans *>(model)->getAssignments();
-            const auto &centroids = static_cast<KMeans *>(model)->getCentroids();
-
-            for (size_t i = 0; i < testD.features.size(); ++i)
-            {
-                int cluster = assignments[i];
-                double dist = 0.0;
-                for (size_t j = 0; j < testD.features[i].size(); ++j)
-                {
-                    double diff = toDouble(testD.features[i][j]) - centroids[cluster][j];
-                    dist += diff * diff;
-                }
-                inertia += dist;
-            }
+            // Inertia of the clustering of the full dataset, as measured by train().
+            inertia = static_cast<KMeans *>(model)->inertia;
         }
         else if (modelName == "decision_tree")
         {
@@ -151,7 +151,7 @@ app.post('/predict', async (req, res) => {
 		command += `--kvalue 3 `;
 	}
 	command += `--features "features.txt" `;
-	command += `--weights "weights.txt" `;
+	command += algorithm === 'knn' ? `--weights "knn_model.bin" ` : `--weights "weights.txt" `;
 	exec(command, (error, stdout, stderr) => {
 		if (error) {
 			console.error(`Error executing command: ${error.message}`);
@@ -135,7 +135,7 @@ int main(int argc, char** argv) {
         }
         else if(modelName == "knn")
         {
-            data = readCSV(weightsf);
+            // The KNN model is a prebuilt binary file loaded in predict below.
         }
         else
         parseParams(weightsf, weight);
@@ -208,7 +208,8 @@ int main(int argc, char** argv) {
         else if(modelName == "knn")
         {
             KNN model(k);
-            model.train(data);
+            model.load(weightsf);
+            model.k = k;
             vector<double> query;
             for (auto val : feature) {
                 query.push_back(handle::toDouble(val));
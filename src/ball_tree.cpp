@@ -0,0 +1,320 @@
+#pragma once
+#ifndef BALL_TREE_H
+#define BALL_TREE_H
+
+#include <vector>
+#include <utility>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cstdint>
+#include <thread>
+#include <cfloat>
+#include <cmath>
+#include "distance.h"
+#include "serialize.h"
+#include "parallel.h"
+
+using namespace std;
+
+// A ball tree over a contiguous, row-major point buffer. Every node stores a
+// centroid and a covering radius, so a whole subtree can be skipped when the
+// query is further from the ball than the current k-th best neighbour. Unlike
+// the KD-tree this bound does not weaken with the number of dimensions as fast,
+// which makes it the better index for 10+ feature columns.
+class BallTree {
+public:
+    // Structure for a node in the tree. Node i has children 2i+1 and 2i+2.
+    struct Node {
+        size_t start, end;   // Range of rows (in tree order) covered by this node.
+        double radius;       // Largest distance from the centroid to a covered row.
+        bool isLeaf;         // Leaves are scanned directly.
+    };
+
+    size_t dim;                    // Number of features per row.
+    size_t leafSize;               // Maximum number of rows in a leaf.
+    metric::Metric metricType;     // Metric the radii were computed with (see metric::searchMetric()).
+    int minkowskiP;                // Exponent when metricType is Minkowski.
+    handle::MappedArray<double> points;    // Rows reordered so that every node is contiguous.
+    handle::MappedArray<size_t> indices;   // Original row index of every reordered row.
+    handle::MappedArray<Node> nodes;       // Implicit binary tree; nodes[0] is the root.
+    handle::MappedArray<double> centroids; // Node centroids, row-major (nodes.size() * dim).
+
+    /**
+     * @brief Constructor for BallTree.
+     *
+     * @param leaf Maximum number of rows stored in a leaf (default: 40).
+     */
+    explicit BallTree(size_t leaf = 40)
+        : dim(0), leafSize(leaf < 1 ? 1 : leaf), metricType(metric::Metric::Euclidean), minkowskiP(2) {}
+
+    /**
+     * @brief Builds the tree by recursive median splits along the widest dimension.
+     *
+     * Rows always split at the middle of their range, so the tree shape only
+     * depends on m and every node can be written into its slot independently.
+     * The top levels are built on separate threads.
+     *
+     * @param data Row-major buffer of m * n values.
+     * @param m Number of rows.
+     * @param n Number of columns.
+     * @param met Any metric::Metric (Cosine expects L2-normalised rows and is
+     *            searched with Euclidean distance).
+     * @param p Exponent for metric::Metric::Minkowski.
+     * @throws runtime_error if the buffer size does not match m * n.
+     * @throws invalid_argument for an unsupported Minkowski exponent.
+     */
+    void build(const vector<double> &data, size_t m, size_t n, metric::Metric met = metric::Metric::Euclidean,
+               int p = 2) {
+        if (data.size() != m * n) {
+            throw runtime_error("BallTree: point buffer size does not match dimensions.");
+        }
+        dim = n;
+        metric::checkMetric(met, p);
+        metricType = metric::searchMetric(met, p);
+        minkowskiP = p;
+        vector<size_t> &order = indices.own();
+        order.resize(m);
+        iota(order.begin(), order.end(), 0);
+        nodes.clear();
+        centroids.clear();
+        points.clear();
+        if (m == 0) {
+            return;
+        }
+
+        // Depth needed for the largest leaf to hold at most leafSize rows.
+        size_t levels = 1;
+        for (size_t rows = m; rows > leafSize; rows = (rows + 1) / 2) {
+            levels++;
+        }
+        nodes.own().resize((size_t(1) << levels) - 1);
+        centroids.own().assign(nodes.size() * dim, 0.0);
+
+        int parallelDepth = 0;
+        while ((1u << parallelDepth) < handle::numThreads()) {
+            parallelDepth++;
+        }
+        buildNode(data, 0, 0, m, 0, parallelDepth);
+
+        vector<double> &rows = points.own();
+        rows.resize(m * n);
+        for (size_t i = 0; i < m; i++) {
+            copy(data.begin() + order[i] * n, data.begin() + (order[i] + 1) * n, rows.begin() + i * n);
+        }
+    }
+
+    /**
+     * @brief Exact k-nearest search.
+     *
+     * @param query Pointer to dim feature values.
+     * @param k Number of neighbours to return.
+     * @param out Filled with (reduced distance, original row index), nearest first.
+     *            Distances are reduced: squared for Euclidean/Cosine, |d|^p summed
+     *            for Minkowski, plain for Manhattan and Chebyshev.
+     * @param skip Optional flag per original row; rows with a nonzero flag are never returned.
+     */
+    void query(const double *query, size_t k, vector<pair<double, size_t>> &out, const char *skip = nullptr) const {
+        out.clear();
+        if (nodes.empty() || k == 0) {
+            return;
+        }
+        out.reserve(k);
+        metric::withKernel(metricType, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            search<Dist>(0, query, k, trueDistance<Dist>(0, query), out, skip);
+        });
+        sort_heap(out.begin(), out.end());
+    }
+
+    /**
+     * @brief Appends every row within a reduced distance of the query.
+     *
+     * @param query Pointer to dim feature values.
+     * @param radius Inclusive bound on the reduced distance (r^2 for Euclidean).
+     * @param out Appended with (reduced distance, original row index), in tree order.
+     */
+    void radiusQuery(const double *query, double radius, vector<pair<double, size_t>> &out) const {
+        if (nodes.empty()) {
+            return;
+        }
+        metric::withKernel(metricType, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            radiusSearch<Dist>(0, query, radius, trueDistance<Dist>(0, query), out);
+        });
+    }
+
+    bool empty() const { return nodes.empty(); }
+    size_t size() const { return indices.size(); }
+
+    /**
+     * @brief Writes the built tree (nodes, row order and reordered points) to a binary stream.
+     *
+     * The arrays are aligned (see handle::writeArray()) so that load() can map them.
+     */
+    void save(ostream &out) const {
+        uint64_t header[4] = {dim, leafSize, static_cast<uint64_t>(metricType), static_cast<uint64_t>(minkowskiP)};
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        handle::writeArray(out, points);
+        handle::writeArray(out, indices);
+        handle::writeArray(out, nodes);
+        handle::writeArray(out, centroids);
+    }
+
+    /**
+     * @brief Loads a tree written by save(), replacing the current one.
+     *
+     * Read from a handle::MemoryBuffer, the arrays stay in the mapped file.
+     * @throws runtime_error if the stream does not hold a valid tree.
+     */
+    void load(istream &in) {
+        uint64_t header[4];
+        in.read(reinterpret_cast<char *>(header), sizeof(header));
+        dim = header[0];
+        leafSize = header[1];
+        metricType = static_cast<metric::Metric>(header[2]);
+        minkowskiP = static_cast<int>(header[3]);
+        handle::readArray(in, points);
+        handle::readArray(in, indices);
+        handle::readArray(in, nodes);
+        handle::readArray(in, centroids);
+        if (!in || points.size() != indices.size() * dim || centroids.size() != nodes.size() * dim) {
+            throw runtime_error("Corrupt ball tree data.");
+        }
+    }
+
+private:
+    // Fills node `id` covering indices[start, end) and recurses into its children.
+    void buildNode(const vector<double> &data, size_t id, size_t start, size_t end, int depth, int parallelDepth) {
+        // The arrays are owned while building, so own() copies nothing and is safe on every thread.
+        vector<size_t> &order = indices.own();
+        Node &node = nodes.own()[id];
+        node.start = start;
+        node.end = end;
+        node.isLeaf = 2 * id + 1 >= nodes.size();
+        node.radius = 0.0;
+        if (start == end) {
+            return;
+        }
+
+        // Centroid and covering radius.
+        double *c = &centroids.own()[id * dim];
+        for (size_t i = start; i < end; i++) {
+            const double *row = &data[order[i] * dim];
+            for (size_t j = 0; j < dim; j++) {
+                c[j] += row[j];
+            }
+        }
+        for (size_t j = 0; j < dim; j++) {
+            c[j] /= static_cast<double>(end - start);
+        }
+        metric::withMetric(metricType, minkowskiP, [&](auto dist) {
+            typedef decltype(dist) Dist;
+            double radius = 0.0;
+            for (size_t i = start; i < end; i++) {
+                radius = max(radius, Dist::reduced(&data[order[i] * dim], c, dim));
+            }
+            node.radius = Dist::fromReduced(radius);
+        });
+        if (node.isLeaf) {
+            return;
+        }
+
+        // Median split along the dimension with the largest spread.
+        size_t bestDim = 0;
+        double bestSpread = -1.0;
+        for (size_t j = 0; j < dim; j++) {
+            double lo = DBL_MAX, hi = -DBL_MAX;
+            for (size_t i = start; i < end; i++) {
+                double v = data[order[i] * dim + j];
+                lo = min(lo, v);
+                hi = max(hi, v);
+            }
+            if (hi - lo > bestSpread) {
+                bestSpread = hi - lo;
+                bestDim = j;
+            }
+        }
+        size_t mid = start + (end - start) / 2;
+        nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                    [&](size_t a, size_t b) { return data[a * dim + bestDim] < data[b * dim + bestDim]; });
+
+        if (depth < parallelDepth && end - start > 4 * leafSize) {
+            thread left([&]() { buildNode(data, 2 * id + 1, start, mid, depth + 1, parallelDepth); });
+            buildNode(data, 2 * id + 2, mid, end, depth + 1, parallelDepth);
+            left.join();
+        } else {
+            buildNode(data, 2 * id + 1, start, mid, depth + 1, parallelDepth);
+            buildNode(data, 2 * id + 2, mid, end, depth + 1, parallelDepth);
+        }
+    }
+
+    // Distance (in the metric's true units) from the query to a node's centroid.
+    template <class Dist>
+    double trueDistance(size_t id, const double *q) const {
+        return Dist::fromReduced(Dist::reduced(q, &centroids[id * dim], dim));
+    }
+
+    // Visits node `id` whose centroid lies at true distance centroidDist from the query.
+    template <class Dist>
+    void search(size_t id, const double *q, size_t k, double centroidDist,
+                vector<pair<double, size_t>> &heap, const char *skip) const {
+        const Node &node = nodes[id];
+        if (node.end == node.start) {
+            return;
+        }
+        double bound = max(0.0, centroidDist - node.radius);
+        if (heap.size() == k && Dist::toReduced(bound) > heap.front().first) {
+            return;
+        }
+
+        if (node.isLeaf) {
+            for (size_t i = node.start; i < node.end; i++) {
+                if (skip != nullptr && skip[indices[i]]) {
+                    continue;
+                }
+                const double *row = &points[i * dim];
+                double dist = heap.size() < k ? Dist::reduced(row, q, dim)
+                                              : Dist::reducedBounded(row, q, dim, heap.front().first);
+                metric::offerCandidate(heap, k, dist, indices[i]);
+            }
+            return;
+        }
+
+        // Visit the child whose centroid is closer first.
+        size_t left = 2 * id + 1, right = 2 * id + 2;
+        double dLeft = trueDistance<Dist>(left, q);
+        double dRight = trueDistance<Dist>(right, q);
+        if (dLeft <= dRight) {
+            search<Dist>(left, q, k, dLeft, heap, skip);
+            search<Dist>(right, q, k, dRight, heap, skip);
+        } else {
+            search<Dist>(right, q, k, dRight, heap, skip);
+            search<Dist>(left, q, k, dLeft, heap, skip);
+        }
+    }
+
+    // Like search(), collecting every row within `radius` instead of the k best.
+    template <class Dist>
+    void radiusSearch(size_t id, const double *q, double radius, double centroidDist,
+                      vector<pair<double, size_t>> &out) const {
+        const Node &node = nodes[id];
+        if (node.end == node.start || Dist::toReduced(max(0.0, centroidDist - node.radius)) > radius) {
+            return;
+        }
+        if (node.isLeaf) {
+            for (size_t i = node.start; i < node.end; i++) {
+                double dist = Dist::reducedBounded(&points[i * dim], q, dim, radius);
+                if (dist <= radius) {
+                    out.emplace_back(dist, indices[i]);
+                }
+            }
+            return;
+        }
+        radiusSearch<Dist>(2 * id + 1, q, radius, trueDistance<Dist>(2 * id + 1, q), out);
+        radiusSearch<Dist>(2 * id + 2, q, radius, trueDistance<Dist>(2 * id + 2, q), out);
+    }
+};
+
+#endif // BALL_TREE_H
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef BALL_TREE_H
+#define BALL_TREE_H
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include "distance.h"
+#include "serialize.h"
+
+class BallTree {
+public:
+    struct Node {
+        size_t start, end;   // Range of rows (in tree order) covered by this node.
+        double radius;       // Largest distance from the centroid to a covered row.
+        bool isLeaf;         // Leaves are scanned directly.
+    };
+
+    /**
+     * @brief Constructor for BallTree.
+     *
+     * @param leaf Maximum number of rows stored in a leaf (default: 40).
+     */
+    explicit BallTree(size_t leaf = 40);
+
+    /**
+     * @brief Builds the tree (in parallel) over a row-major point buffer of m rows and n columns.
+     */
+    void build(const std::vector<double> &data, size_t m, size_t n,
+               metric::Metric met = metric::Metric::Euclidean, int p = 2);
+
+    /**
+     * @brief Exact k-nearest search under the metric given to build().
+     *
+     * @param query Pointer to n feature values.
+     * @param k Number of neighbours to return.
+     * @param out Filled with (reduced distance, original row index), nearest first.
+     * @param skip Optional flag per original row; flagged rows are never returned.
+     */
+    void query(const double *query, size_t k, std::vector<std::pair<double, size_t>> &out,
+               const char *skip = nullptr) const;
+
+    /**
+     * @brief Appends every row whose reduced distance to the query is at most radius.
+     */
+    void radiusQuery(const double *query, double radius, std::vector<std::pair<double, size_t>> &out) const;
+
+    bool empty() const;
+    size_t size() const;
+
+    /**
+     * @brief Writes / loads the built tree as a binary stream.
+     */
+    void save(std::ostream &out) const;
+    void load(std::istream &in);
+
+    size_t dim;                         // Number of features per row.
+    size_t leafSize;                    // Maximum number of rows in a leaf.
+    metric::Metric metricType;          // Metric the radii were computed with.
+    int minkowskiP;                     // Exponent when metricType is Minkowski.
+    handle::MappedArray<double> points;    // Rows reordered so that every node is contiguous.
+    handle::MappedArray<size_t> indices;   // Original row index of every reordered row.
+    handle::MappedArray<Node> nodes;       // Implicit binary tree; nodes[0] is the root.
+    handle::MappedArray<double> centroids; // Node centroids, row-major.
+};
+
+#endif // BALL_TREE_H
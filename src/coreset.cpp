@@ -0,0 +1,248 @@
+#pragma once
+#ifndef CORESET_H
+#define CORESET_H
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <cmath>
+#include <cfloat>
+#include "distance.h"
+#include "parallel.h"
+#include "k_means_clustering.cpp"
+
+using namespace std;
+
+// Weighted coresets for the k-means (squared Euclidean) cost. A coreset is a
+// small weighted sample whose cost for any k centres approximates the cost of
+// the full data, so KMeans::fit() on the coreset with its weights gives a
+// near-optimal clustering of the full data at a fraction of the work.
+//
+// Lightweight coresets (Bachem, Lucic and Krause, 2018) sample row x with
+// probability q(x) = 1/2 w(x) / W + 1/2 w(x) d(x, mean)^2 / sum(w d^2) and
+// weigh it by w(x) / (size * q(x)); the error is at most eps times the cost
+// plus eps times the cost of a single centre. Sensitivity sampling (Feldman
+// and Langberg, 2011) replaces the mean by a k-means++ solution B, with
+// q(x) proportional to w(x) d(x, B)^2 / cost(B) + w(x) / W(cluster of x),
+// which bounds the error by eps times the cost alone.
+//
+// Streams are summarised in one pass by merge and reduce: every chunk of
+// chunkRows rows is reduced to a coreset at level 0, and two coresets of the
+// same level are merged and reduced to one at the next level, so memory stays
+// at O(size * log(rows / chunkRows)) rows however long the stream is.
+class CoresetBuilder {
+public:
+    enum class Method {
+        Lightweight,  // Mean-based importance sampling (one pass over the rows).
+        Sensitivity   // k-means++-based sensitivity sampling (stronger bound, costs k distances per row).
+    };
+
+    size_t size;                  // Rows sampled per coreset (repeated draws are merged, so outputs may be smaller).
+    Method method;                // Sampling distribution.
+    int k;                        // Clusters of the bicriteria solution (Sensitivity).
+    unsigned long long seed;      // Seed of the sampling; the same seed gives the same coreset.
+    size_t chunkRows;             // Streaming: rows buffered before they are reduced.
+
+    /**
+     * @brief Constructor for CoresetBuilder.
+     *
+     * @param coresetSize Sampled rows per coreset (default: 1000).
+     * @param sampling Sampling distribution (default: Lightweight).
+     * @param clusters k for Sensitivity sampling (default: 8).
+     * @param seedValue Seed of the sampling (default: 42).
+     */
+    CoresetBuilder(size_t coresetSize = 1000, Method sampling = Method::Lightweight, int clusters = 8,
+                   unsigned long long seedValue = 42)
+        : size(max<size_t>(coresetSize, 1)), method(sampling), k(max(clusters, 1)), seed(seedValue),
+          chunkRows(4 * max<size_t>(coresetSize, 1)) {}
+
+    /**
+     * @brief Reduces m row-major rows of dim values to a weighted coreset.
+     *
+     * Inputs with at most `size` rows are returned as they are.
+     *
+     * @param weights Weight per row, or nullptr for weight 1.
+     * @param outPoints Coreset rows, row-major.
+     * @param outWeights Weight of every coreset row; they sum to the input weight in expectation.
+     */
+    void build(const double *points, const double *weights, size_t m, size_t dim, vector<double> &outPoints,
+               vector<double> &outWeights) {
+        reduce(points, weights, m, dim, seed, outPoints, outWeights);
+    }
+
+    /**
+     * @brief Streams count rows of dim values into the merge-and-reduce tree.
+     *
+     * @throws runtime_error if dim differs from earlier rows.
+     */
+    void add(const double *rows, size_t count, size_t dim) {
+        if (dim == 0 || (streamDim != 0 && streamDim != dim)) {
+            throw runtime_error("Coreset row dimension does not match earlier rows.");
+        }
+        streamDim = dim;
+        while (count > 0) {
+            size_t take = min(count, chunkRows - buffer.size() / dim);
+            buffer.insert(buffer.end(), rows, rows + take * dim);
+            rows += take * dim;
+            count -= take;
+            if (buffer.size() / dim == chunkRows) {
+                Summary chunk;
+                reduce(buffer.data(), nullptr, chunkRows, dim, nextSeed(), chunk.points, chunk.weights);
+                buffer.clear();
+                carry(move(chunk));
+            }
+        }
+    }
+
+    /**
+     * @brief Merges the streamed rows into one coreset of at most `size` rows and resets the stream.
+     */
+    void finish(vector<double> &outPoints, vector<double> &outWeights) {
+        size_t dim = max<size_t>(streamDim, 1);
+        Summary all;
+        all.points = buffer;
+        all.weights.assign(buffer.size() / dim, 1.0);
+        for (auto &level : levels) {
+            all.points.insert(all.points.end(), level.points.begin(), level.points.end());
+            all.weights.insert(all.weights.end(), level.weights.begin(), level.weights.end());
+        }
+        reduce(all.points.data(), all.weights.data(), all.weights.size(), dim, nextSeed(), outPoints, outWeights);
+        reset();
+    }
+
+    /**
+     * @brief Drops any streamed rows.
+     */
+    void reset() {
+        buffer.clear();
+        levels.clear();
+        streamDim = 0;
+        reductions = 0;
+    }
+
+private:
+    struct Summary {
+        vector<double> points;
+        vector<double> weights;
+    };
+
+    vector<double> buffer;         // Rows of the chunk being filled.
+    vector<Summary> levels;        // levels[l]: empty, or one coreset of 2^l chunks.
+    size_t streamDim = 0;
+    size_t reductions = 0;         // Reductions so far; each draws with its own seed.
+
+    unsigned long long nextSeed() {
+        return seed + (reductions++) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    // Adds a coreset at level 0, merging and reducing while the level is taken.
+    void carry(Summary chunk) {
+        for (size_t level = 0;; level++) {
+            if (level == levels.size()) {
+                levels.push_back(Summary());
+            }
+            if (levels[level].weights.empty()) {
+                levels[level] = move(chunk);
+                return;
+            }
+            Summary merged = move(levels[level]);
+            levels[level] = Summary();
+            merged.points.insert(merged.points.end(), chunk.points.begin(), chunk.points.end());
+            merged.weights.insert(merged.weights.end(), chunk.weights.begin(), chunk.weights.end());
+            reduce(merged.points.data(), merged.weights.data(), merged.weights.size(), streamDim, nextSeed(),
+                   chunk.points, chunk.weights);
+        }
+    }
+
+    // Importance sampling of `size` rows with replacement; repeated rows are merged.
+    void reduce(const double *points, const double *weights, size_t m, size_t dim, unsigned long long seedValue,
+                vector<double> &outPoints, vector<double> &outWeights) const {
+        auto weightOf = [&](size_t i) { return weights ? weights[i] : 1.0; };
+        if (m <= size) {
+            outPoints.assign(points, points + m * dim);
+            outWeights.resize(m);
+            for (size_t i = 0; i < m; i++) {
+                outWeights[i] = weightOf(i);
+            }
+            return;
+        }
+
+        // Squared distance of every row to the mean (Lightweight) or to its
+        // k-means++ centre (Sensitivity), and the weight of every group.
+        vector<double> cost(m);
+        vector<int> group(m, 0);
+        vector<double> centers;
+        size_t groups = 1;
+        if (method == Method::Sensitivity) {
+            groups = min<size_t>(static_cast<size_t>(k), m);
+            KMeans seeder(static_cast<int>(groups));
+            centers = seeder.seedCentroids<metric::Euclidean>(points, weights, m, dim, groups, seedValue,
+                                                              handle::numThreads());
+        } else {
+            centers.assign(dim, 0.0);
+            double total = 0.0;
+            for (size_t i = 0; i < m; i++) {
+                total += weightOf(i);
+                for (size_t j = 0; j < dim; j++) {
+                    centers[j] += weightOf(i) * points[i * dim + j];
+                }
+            }
+            for (size_t j = 0; j < dim; j++) {
+                centers[j] /= max(total, DBL_MIN);
+            }
+        }
+        handle::parallelFor(m, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                if (groups > 1) {
+                    group[i] = KMeans::nearestCentroid<metric::Euclidean>(&points[i * dim], centers.data(), groups,
+                                                                          dim);
+                }
+                cost[i] = metric::Euclidean::reduced(&points[i * dim], &centers[group[i] * dim], dim);
+            }
+        }, 1024);
+        vector<double> groupWeight(groups, 0.0);
+        double totalCost = 0.0;
+        for (size_t i = 0; i < m; i++) {
+            groupWeight[group[i]] += weightOf(i);
+            totalCost += weightOf(i) * cost[i];
+        }
+
+        // Sampling probabilities (unnormalised), kept as a running sum for the draws.
+        vector<double> q(m);
+        double running = 0.0;
+        for (size_t i = 0; i < m; i++) {
+            double w = weightOf(i);
+            double share = groupWeight[group[i]] > 0.0 ? w / groupWeight[group[i]] : 0.0;
+            double spread = totalCost > 0.0 ? w * cost[i] / totalCost : share;
+            running += method == Method::Sensitivity ? spread + share : 0.5 * (share + spread);
+            q[i] = running;
+        }
+        if (!(running > 0.0)) {
+            throw runtime_error("Coreset input has no positive weight.");
+        }
+
+        mt19937_64 rng(seedValue);
+        uniform_real_distribution<double> unit(0.0, running);
+        vector<size_t> picks(size);
+        for (auto &pick : picks) {
+            pick = min<size_t>(upper_bound(q.begin(), q.end(), unit(rng)) - q.begin(), m - 1);
+        }
+        sort(picks.begin(), picks.end());
+        outPoints.clear();
+        outWeights.clear();
+        for (size_t a = 0; a < picks.size();) {
+            size_t b = a;
+            while (b < picks.size() && picks[b] == picks[a]) {
+                b++;
+            }
+            size_t i = picks[a];
+            double prob = (q[i] - (i > 0 ? q[i - 1] : 0.0)) / running;
+            outPoints.insert(outPoints.end(), &points[i * dim], &points[(i + 1) * dim]);
+            outWeights.push_back((b - a) * weightOf(i) / (size * prob));
+            a = b;
+        }
+    }
+};
+
+#endif // CORESET_H
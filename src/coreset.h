@@ -0,0 +1,45 @@
+#pragma once
+#ifndef CORESET_H
+#define CORESET_H
+
+#include <vector>
+
+class CoresetBuilder {
+public:
+    enum class Method { Lightweight, Sensitivity };
+
+    size_t size;                  // Rows sampled per coreset.
+    Method method;                // Sampling distribution.
+    int k;                        // Clusters of the bicriteria solution (Sensitivity).
+    unsigned long long seed;      // Seed of the sampling.
+    size_t chunkRows;             // Streaming: rows buffered before they are reduced.
+
+    /**
+     * @brief Constructor for CoresetBuilder.
+     */
+    CoresetBuilder(size_t coresetSize = 1000, Method sampling = Method::Lightweight, int clusters = 8,
+                   unsigned long long seedValue = 42);
+
+    /**
+     * @brief Reduces m row-major rows (optionally weighted) to a weighted coreset for KMeans::fit().
+     */
+    void build(const double *points, const double *weights, size_t m, size_t dim, std::vector<double> &outPoints,
+               std::vector<double> &outWeights);
+
+    /**
+     * @brief Streams rows into the merge-and-reduce tree.
+     */
+    void add(const double *rows, size_t count, size_t dim);
+
+    /**
+     * @brief Returns the coreset of everything streamed so far and resets the stream.
+     */
+    void finish(std::vector<double> &outPoints, std::vector<double> &outWeights);
+
+    /**
+     * @brief Drops any streamed rows.
+     */
+    void reset();
+};
+
+#endif // CORESET_H
@@ -11,169 +11,551 @@
 #include <unordered_map>
 #include <tuple>
 #include <string>
+#include <cstdint>
+#include <sstream>
 #include "base.h"            // Assumes Model is defined here.
 #include "data_handling.h"
+#include "parallel.h"
 #include <gnuplot-iostream.h>
 
 using namespace std;
 
-// A Decision Tree classifier using the Gini impurity measure.
+// A Decision Tree classifier (Gini impurity or entropy) or regressor (variance reduction).
 class DecisionTree : public Model {
 public:
     // Structure for a node in the decision tree.
     struct Node {
         int featureIndex;      // Index of the feature used for splitting.
         double threshold;      // Threshold value for splitting.
-        int prediction;        // Class label prediction (if leaf).
+        double prediction;     // Class label, or mean target for regression (if leaf).
         bool isLeaf;           // Indicates if this node is a leaf.
         Node* left;            // Left child (feature value < threshold).
         Node* right;           // Right child (feature value >= threshold).
 
-        Node() : featureIndex(-1), threshold(0.0), prediction(-1), isLeaf(false), left(nullptr), right(nullptr) {}
+        Node() : featureIndex(-1), threshold(0.0), prediction(-1.0), isLeaf(false), left(nullptr), right(nullptr) {}
+    };
+
+    // How train() searches for the split of every node.
+    enum class Splitter {
+        Exact,     // Every midpoint between consecutive distinct values.
+        Histogram  // Bin boundaries only: each feature is quantised once into at most maxBins bins.
+    };
+
+    // Split criterion; Gini and Entropy grow a classifier, MSE a regression tree.
+    enum class Criterion {
+        Gini,     // Gini impurity of the class counts.
+        Entropy,  // Shannon entropy of the class counts (information gain).
+        MSE       // Variance of the targets (variance reduction); leaves predict the mean.
     };
 
     Node* root;                // Root of the decision tree.
     int maxDepth;              // Maximum depth of the tree.
     int minSamplesSplit;       // Minimum number of samples required to split a node.
+    Splitter splitter = Splitter::Exact; // Split search.
+    Criterion criterion = Criterion::Gini; // Impurity minimised by every split.
+    int maxBins = 256;         // Histogram: bins per feature (2 to 256, so a bin code fits in a byte).
+
+    // Nodes with fewer rows scan and partition their features on the calling
+    // thread: starting the workers would cost more than the scan itself.
+    static constexpr size_t PARALLEL_MIN_ROWS = 4096;
+
+    // Targets of the rows being fitted, in the form the split engine sums.
+    // A classifier counts class codes (width = classes); a regression tree
+    // sums (1, y, y^2) per row (width = 3), with y centred on its mean so the
+    // running sums lose little precision.
+    struct Targets {
+        size_t width = 0;
+        vector<int> label;         // Classifier: class code of every row.
+        vector<int> classValues;   // Classifier: label of every class code, ascending.
+        vector<double> value;      // Regression: centred target of every row.
+        double offset = 0.0;       // Regression: mean added back to every leaf.
+    };
+
+    // Sums of one side of a candidate split: its rows, plus sum(term(count))
+    // over classes (classifier) or the sum and sum of squares of y (regression).
+    struct Side {
+        double rows = 0.0;
+        double terms = 0.0;
+        double sum = 0.0;
+        double squares = 0.0;
+    };
+
+    bool regression() const {
+        return criterion == Criterion::MSE;
+    }
 
-    // Helper function to compute the Gini impurity for a set of labels.
-    double computeGini(const vector<int>& labels) {
-        if (labels.empty()) return 0.0;
-        unordered_map<int, int> counts;
-        for (int label : labels) {
-            counts[label]++;
+    // Per-class term of the classifier criteria: count^2 (Gini) or count * log(count) (entropy).
+    double term(double count) const {
+        if (criterion == Criterion::Entropy) {
+            return count > 0.0 ? count * log(count) : 0.0;
         }
-        double impurity = 1.0;
-        double total = static_cast<double>(labels.size());
-        for (auto &p : counts) {
-            double prob = p.second / total;
-            impurity -= prob * prob;
+        return count * count;
+    }
+
+    /**
+     * @brief Impurity of a side times its rows, so children add up.
+     *
+     * Gini: n - sum(count^2) / n. Entropy: n log n - sum(count log count).
+     * MSE: sum(y^2) - sum(y)^2 / n.
+     */
+    double cost(const Side &s) const {
+        switch (criterion) {
+        case Criterion::Entropy:
+            return s.rows * log(s.rows) - s.terms;
+        case Criterion::MSE:
+            return s.squares - s.sum * s.sum / s.rows;
+        default:
+            return s.rows - s.terms / s.rows;
         }
-        return impurity;
     }
 
-    // Utility: Extracts labels corresponding to given indices.
-    vector<int> extractLabels(const vector<int>& y, const vector<int>& indices) {
-        vector<int> subset;
-        for (int idx : indices) {
-            subset.push_back(y[idx]);
+    // Weighted impurity of a split (lower is better).
+    double splitScore(const Side &left, const Side &right) const {
+        return (cost(left) + cost(right)) / (left.rows + right.rows);
+    }
+
+    // Side of a summed target vector of t.width values.
+    Side sideOf(const Targets &t, const double *stats) const {
+        Side s;
+        if (regression()) {
+            s.rows = stats[0];
+            s.sum = stats[1];
+            s.squares = stats[2];
+            return s;
         }
-        return subset;
+        for (size_t c = 0; c < t.width; c++) {
+            s.rows += stats[c];
+            s.terms += term(stats[c]);
+        }
+        return s;
     }
 
-    // Helper function to perform the best split on the dataset.
-    // Returns a tuple: {bestFeatureIndex, bestThreshold, bestGini, validSplitFound}.
-    tuple<int, double, double, bool> findBestSplit(const vector<vector<double>>& X, const vector<int>& y, const vector<int>& indices) {
-        int bestFeature = -1;
-        double bestThreshold = 0.0;
-        double bestImpurity = numeric_limits<double>::max();
-        bool validSplitFound = false;
+    // Adds the target of one row to a summed target vector.
+    void addRow(const Targets &t, size_t row, double *stats) const {
+        if (regression()) {
+            double y = t.value[row];
+            stats[0] += 1.0;
+            stats[1] += y;
+            stats[2] += y * y;
+        } else {
+            stats[t.label[row]] += 1.0;
+        }
+    }
+
+    // Moves one row from the right side of a sweep to the left, in O(1).
+    // counts hold the per-class counts of both sides (classifier only).
+    void moveRow(const Targets &t, size_t row, Side &left, Side &right, double *leftCounts,
+                 double *rightCounts) const {
+        left.rows += 1.0;
+        right.rows -= 1.0;
+        if (regression()) {
+            double y = t.value[row];
+            left.sum += y;
+            left.squares += y * y;
+            right.sum -= y;
+            right.squares -= y * y;
+            return;
+        }
+        int c = t.label[row];
+        left.terms += term(leftCounts[c] + 1.0) - term(leftCounts[c]);
+        right.terms += term(rightCounts[c] - 1.0) - term(rightCounts[c]);
+        leftCounts[c] += 1.0;
+        rightCounts[c] -= 1.0;
+    }
+
+    // Grain of a parallelFor over the features of a node with `rows` rows:
+    // one chunk (inline) below PARALLEL_MIN_ROWS, one feature per chunk above.
+    static size_t featureGrain(size_t rows, size_t features) {
+        return rows < PARALLEL_MIN_ROWS ? max<size_t>(features, 1) : 1;
+    }
+
+    // Encodes the labels for the criterion: class codes in ascending label
+    // order (labels truncated to integers), or centred regression targets.
+    void encodeTargets(const vector<double> &labels, Targets &t) const {
+        size_t m = labels.size();
+        if (regression()) {
+            t.offset = computeMean(labels);
+            t.value.resize(m);
+            for (size_t i = 0; i < m; i++) {
+                t.value[i] = labels[i] - t.offset;
+            }
+            t.width = 3;
+            return;
+        }
+        t.label.resize(m);
+        for (size_t i = 0; i < m; i++) {
+            t.label[i] = static_cast<int>(labels[i]);
+        }
+        t.classValues = t.label;
+        sort(t.classValues.begin(), t.classValues.end());
+        t.classValues.erase(unique(t.classValues.begin(), t.classValues.end()), t.classValues.end());
+        for (size_t i = 0; i < m; i++) {
+            t.label[i] = static_cast<int>(lower_bound(t.classValues.begin(), t.classValues.end(), t.label[i]) -
+                                          t.classValues.begin());
+        }
+        t.width = t.classValues.size();
+    }
 
-        double currentGini = computeGini(extractLabels(y, indices));
-        // If the current node is pure, no split will improve it.
-        if (currentGini == 0.0) {
-            return make_tuple(bestFeature, bestThreshold, bestImpurity, validSplitFound);
+    /**
+     * @brief Starts a node from its summed targets: predicts the majority
+     *        class (ties go to the smaller label) or the mean, and tells
+     *        whether it stays a leaf.
+     */
+    Node* startNode(const Targets &t, const vector<double> &stats, int depth) const {
+        Node* node = new Node();
+        Side all = sideOf(t, stats.data());
+        bool pure;
+        if (regression()) {
+            node->prediction = t.offset + all.sum / all.rows;
+            pure = cost(all) <= 1e-12 * all.squares;
+        } else {
+            size_t majority = max_element(stats.begin(), stats.end()) - stats.begin();
+            node->prediction = t.classValues[majority];
+            pure = stats[majority] == all.rows;
         }
+        node->isLeaf = depth >= maxDepth || all.rows < minSamplesSplit || pure;
+        return node;
+    }
+
+    // Exact training state: every feature's rows in sorted order.
+    struct Sorted {
+        size_t rows = 0;
+        size_t features = 0;
+        Targets targets;
+        vector<double> columns;   // features * rows values, column-major.
+        vector<size_t> order;     // features * rows: each feature's rows by ascending value. Every node
+                                  // owns the same range [begin, end) of every feature's list.
+        vector<char> goesLeft;    // Per row: side of the split being applied.
+    };
 
-        int numFeatures = X[0].size();
-        // Iterate over all features.
-        for (int feature = 0; feature < numFeatures; feature++) {
-            // Get unique candidate thresholds from the values in this feature.
-            vector<double> featureValues;
-            for (int idx : indices) {
-                featureValues.push_back(X[idx][feature]);
+    // Sorts every feature once (ties by row, so the order is reproducible).
+    void sortRows(const vector<double> &points, size_t m, size_t n, const vector<double> &labels, Sorted &s) const {
+        s.rows = m;
+        s.features = n;
+        encodeTargets(labels, s.targets);
+        s.columns.resize(n * m);
+        s.order.resize(n * m);
+        s.goesLeft.assign(m, 0);
+        handle::parallelFor(n, [&](size_t begin, size_t end) {
+            for (size_t f = begin; f < end; f++) {
+                double *column = &s.columns[f * m];
+                size_t *order = &s.order[f * m];
+                for (size_t i = 0; i < m; i++) {
+                    column[i] = points[i * n + f];
+                    order[i] = i;
+                }
+                sort(order, order + m, [&](size_t a, size_t b) {
+                    return column[a] < column[b] || (column[a] == column[b] && a < b);
+                });
             }
-            sort(featureValues.begin(), featureValues.end());
-            featureValues.erase(unique(featureValues.begin(), featureValues.end()), featureValues.end());
-
-            // Try potential thresholds (midpoint between consecutive unique values).
-            for (size_t i = 1; i < featureValues.size(); i++) {
-                double threshold = (featureValues[i - 1] + featureValues[i]) / 2.0;
-                vector<int> leftLabels, rightLabels;
-                for (int idx : indices) {
-                    if (X[idx][feature] < threshold) {
-                        leftLabels.push_back(y[idx]);
+        });
+    }
+
+    /**
+     * @brief Grows a subtree with exact splits by a sweep over presorted rows.
+     *
+     * Every feature's rows are already in value order, so a node walks each
+     * list once, moving one row at a time from the right side to the left
+     * and updating both sides' sums in O(1) (see moveRow()); the impurity of
+     * every midpoint between distinct values follows directly. The chosen
+     * split then stably partitions each feature's range, which keeps the
+     * children's lists sorted. Features are scanned and partitioned in
+     * parallel once a node has PARALLEL_MIN_ROWS rows; each level costs
+     * O(rows * features).
+     */
+    Node* buildExactTree(Sorted &s, size_t begin, size_t end, int depth) {
+        const Targets &t = s.targets;
+        size_t n = end - begin;
+        vector<double> stats(t.width, 0.0);
+        for (size_t i = begin; i < end; i++) {
+            addRow(t, s.order[i], stats.data());
+        }
+        Node* node = startNode(t, stats, depth);
+        if (node->isLeaf) {
+            return node;
+        }
+
+        // Best midpoint of every feature, then the first best over features.
+        Side parent = sideOf(t, stats.data());
+        vector<double> featureImpurity(s.features, numeric_limits<double>::max());
+        vector<double> featureThreshold(s.features, 0.0);
+        size_t grain = featureGrain(n, s.features);
+        handle::parallelFor(s.features, [&](size_t f0, size_t f1) {
+            vector<double> leftCounts(t.width), rightCounts(t.width);
+            for (size_t f = f0; f < f1; f++) {
+                const double *column = &s.columns[f * s.rows];
+                const size_t *order = &s.order[f * s.rows + begin];
+                fill(leftCounts.begin(), leftCounts.end(), 0.0);
+                rightCounts = stats;
+                Side left, right = parent;
+                for (size_t i = 0; i + 1 < n; i++) {
+                    moveRow(t, order[i], left, right, leftCounts.data(), rightCounts.data());
+                    double value = column[order[i]], next = column[order[i + 1]];
+                    if (value == next) {
+                        continue;
+                    }
+                    double score = splitScore(left, right);
+                    if (score < featureImpurity[f]) {
+                        featureImpurity[f] = score;
+                        featureThreshold[f] = (value + next) / 2.0;
+                    }
+                }
+            }
+        }, grain);
+        size_t bestFeature = min_element(featureImpurity.begin(), featureImpurity.end()) - featureImpurity.begin();
+        if (featureImpurity[bestFeature] == numeric_limits<double>::max()) {
+            node->isLeaf = true;
+            return node;
+        }
+        double threshold = featureThreshold[bestFeature];
+
+        // Rows go left exactly as traverseTree() will send them.
+        const double *column = &s.columns[bestFeature * s.rows];
+        size_t leftRows = 0;
+        for (size_t i = begin; i < end; i++) {
+            size_t row = s.order[i];
+            s.goesLeft[row] = column[row] < threshold;
+            leftRows += s.goesLeft[row];
+        }
+        if (leftRows == 0 || leftRows == n) {
+            node->isLeaf = true;
+            return node;
+        }
+        node->featureIndex = static_cast<int>(bestFeature);
+        node->threshold = threshold;
+        node->isLeaf = false;
+        handle::parallelFor(s.features, [&](size_t f0, size_t f1) {
+            vector<size_t> rightPart;
+            for (size_t f = f0; f < f1; f++) {
+                size_t *order = &s.order[f * s.rows + begin];
+                size_t out = 0;
+                rightPart.clear();
+                for (size_t i = 0; i < n; i++) {
+                    if (s.goesLeft[order[i]]) {
+                        order[out++] = order[i];
                     } else {
-                        rightLabels.push_back(y[idx]);
+                        rightPart.push_back(order[i]);
                     }
                 }
-                // Ensure both splits have at least one sample.
-                if (leftLabels.empty() || rightLabels.empty()) {
-                    continue;
+                copy(rightPart.begin(), rightPart.end(), order + out);
+            }
+        }, grain);
+        node->left = buildExactTree(s, begin, begin + leftRows, depth + 1);
+        node->right = buildExactTree(s, begin + leftRows, end, depth + 1);
+        return node;
+    }
+
+    // Histogram training state: bin codes of every row.
+    struct Binned {
+        size_t rows = 0;
+        size_t features = 0;
+        Targets targets;
+        vector<uint8_t> codes;              // features * rows bin codes, column-major.
+        vector<vector<double>> thresholds;  // Per feature: value < thresholds[b] exactly when code <= b.
+        vector<size_t> offset;              // Per feature: first histogram cell (bins before it * width).
+        size_t cells = 0;                   // Histogram size: all bins of all features * width.
+        vector<size_t> order;               // Rows, partitioned in place so that every node owns a range.
+    };
+
+    /**
+     * @brief Bin boundaries of one feature column.
+     *
+     * With at most maxBins distinct values every value gets its own bin and
+     * the boundaries are the midpoints Exact would try, so both splitters
+     * grow the same tree. Otherwise the boundaries sit at maxBins - 1 row
+     * quantiles, each moved down to the midpoint below the quantile's value,
+     * so that a heavily repeated value never straddles two bins.
+     */
+    vector<double> binThresholds(vector<double> values) const {
+        sort(values.begin(), values.end());
+        vector<double> thresholds;
+        size_t distinct = values.empty() ? 0 : 1;
+        for (size_t i = 1; i < values.size(); i++) {
+            distinct += values[i] != values[i - 1];
+        }
+        if (distinct <= static_cast<size_t>(maxBins)) {
+            for (size_t i = 1; i < values.size(); i++) {
+                if (values[i] != values[i - 1]) {
+                    thresholds.push_back((values[i - 1] + values[i]) / 2.0);
                 }
-                double leftGini = computeGini(leftLabels);
-                double rightGini = computeGini(rightLabels);
-                double weightLeft = static_cast<double>(leftLabels.size()) / indices.size();
-                double weightRight = static_cast<double>(rightLabels.size()) / indices.size();
-                double weightedGini = weightLeft * leftGini + weightRight * rightGini;
-                if (weightedGini < bestImpurity) {
-                    bestImpurity = weightedGini;
-                    bestFeature = feature;
-                    bestThreshold = threshold;
-                    validSplitFound = true;
+            }
+            return thresholds;
+        }
+        for (int b = 1; b < maxBins; b++) {
+            size_t rank = b * values.size() / maxBins;
+            size_t first = lower_bound(values.begin(), values.end(), values[rank]) - values.begin();
+            if (first == 0) {
+                continue;
+            }
+            double threshold = (values[first - 1] + values[first]) / 2.0;
+            if (thresholds.empty() || threshold > thresholds.back()) {
+                thresholds.push_back(threshold);
+            }
+        }
+        return thresholds;
+    }
+
+    // Quantises every feature once and encodes the labels.
+    void binRows(const vector<double> &points, size_t m, size_t n, const vector<double> &labels, Binned &b) const {
+        b.rows = m;
+        b.features = n;
+        encodeTargets(labels, b.targets);
+        b.thresholds.assign(n, vector<double>());
+        b.codes.resize(n * m);
+        handle::parallelFor(n, [&](size_t begin, size_t end) {
+            vector<double> column(m);
+            for (size_t f = begin; f < end; f++) {
+                for (size_t i = 0; i < m; i++) {
+                    column[i] = points[i * n + f];
+                }
+                b.thresholds[f] = binThresholds(column);
+                const vector<double> &t = b.thresholds[f];
+                for (size_t i = 0; i < m; i++) {
+                    b.codes[f * m + i] = static_cast<uint8_t>(upper_bound(t.begin(), t.end(), column[i]) - t.begin());
                 }
             }
+        });
+        b.offset.resize(n);
+        b.cells = 0;
+        for (size_t f = 0; f < n; f++) {
+            b.offset[f] = b.cells;
+            b.cells += (b.thresholds[f].size() + 1) * b.targets.width;
+        }
+        b.order.resize(m);
+        for (size_t i = 0; i < m; i++) {
+            b.order[i] = i;
         }
-        return make_tuple(bestFeature, bestThreshold, bestImpurity, validSplitFound);
     }
 
-    // Recursively builds the decision tree.
-    Node* buildTree(vector<vector<double>>& X, vector<int>& y, vector<int>& indices, int depth) {
-        Node* node = new Node();
+    // Per-feature, per-bin summed targets of the rows order[begin, end),
+    // one feature per thread once the range has PARALLEL_MIN_ROWS rows.
+    void fillHistogram(const Binned &b, size_t begin, size_t end, vector<double> &hist) const {
+        hist.assign(b.cells, 0.0);
+        size_t width = b.targets.width;
+        handle::parallelFor(b.features, [&](size_t f0, size_t f1) {
+            for (size_t f = f0; f < f1; f++) {
+                const uint8_t *codes = &b.codes[f * b.rows];
+                double *cells = &hist[b.offset[f]];
+                for (size_t i = begin; i < end; i++) {
+                    size_t row = b.order[i];
+                    addRow(b.targets, row, cells + codes[row] * width);
+                }
+            }
+        }, featureGrain(end - begin, b.features));
+    }
 
-        // Determine the majority class for this node.
-        vector<int> currentLabels = extractLabels(y, indices);
-        int countZero = 0, countOne = 0;
-        // This example assumes binary classification with labels 0 and 1.
-        for (int label : currentLabels) {
-            if (label == 0)
-                countZero++;
-            else
-                countOne++;
+    /**
+     * @brief Grows a subtree with histogram splits.
+     *
+     * A node scans the bin boundaries of its histogram (O(bins * width)
+     * per feature, whatever its size) with running left sums. Only the
+     * smaller child's histogram is filled from its rows; the larger child's
+     * is the parent's minus the smaller, computed in place. So each level
+     * reads at most half of the rows, plus the histograms of its nodes.
+     *
+     * @param hist Summed-target histogram of order[begin, end); reused for a child.
+     */
+    Node* buildHistogramTree(Binned &b, size_t begin, size_t end, int depth, vector<double> &hist) {
+        const Targets &t = b.targets;
+        size_t W = t.width;
+
+        // Summed targets of the node, from the bins of feature 0.
+        vector<double> stats(W, 0.0);
+        size_t bins0 = b.thresholds[0].size() + 1;
+        for (size_t bin = 0; bin < bins0; bin++) {
+            for (size_t w = 0; w < W; w++) {
+                stats[w] += hist[b.offset[0] + bin * W + w];
+            }
         }
-        node->prediction = (countZero >= countOne) ? 0 : 1;
-
-        // Check stopping criteria.
-        if (depth >= maxDepth || indices.size() < static_cast<size_t>(minSamplesSplit) || computeGini(currentLabels) == 0.0) {
-            node->isLeaf = true;
+        Node* node = startNode(t, stats, depth);
+        if (node->isLeaf) {
             return node;
         }
 
-        // Find the best split.
-        int bestFeature;
-        double bestThreshold, bestImpurity;
-        bool validSplit;
-        tie(bestFeature, bestThreshold, bestImpurity, validSplit) = findBestSplit(X, y, indices);
-
-        if (!validSplit) {
+        // Best bin boundary over all features.
+        int bestFeature = -1;
+        size_t bestBin = 0;
+        double bestImpurity = numeric_limits<double>::max();
+        double n = sideOf(t, stats.data()).rows;
+        vector<double> left(W), right(W);
+        for (size_t f = 0; f < b.features; f++) {
+            const double *cells = &hist[b.offset[f]];
+            size_t bins = b.thresholds[f].size() + 1;
+            fill(left.begin(), left.end(), 0.0);
+            for (size_t bin = 0; bin + 1 < bins; bin++) {
+                for (size_t w = 0; w < W; w++) {
+                    left[w] += cells[bin * W + w];
+                    right[w] = stats[w] - left[w];
+                }
+                Side leftSide = sideOf(t, left.data());
+                if (leftSide.rows == 0.0) {
+                    continue;
+                }
+                if (leftSide.rows == n) {
+                    break;
+                }
+                double score = splitScore(leftSide, sideOf(t, right.data()));
+                if (score < bestImpurity) {
+                    bestImpurity = score;
+                    bestFeature = static_cast<int>(f);
+                    bestBin = bin;
+                }
+            }
+        }
+        if (bestFeature < 0) {
             node->isLeaf = true;
             return node;
         }
-
         node->featureIndex = bestFeature;
-        node->threshold = bestThreshold;
+        node->threshold = b.thresholds[bestFeature][bestBin];
         node->isLeaf = false;
 
-        // Split indices into left and right nodes.
-        vector<int> leftIndices, rightIndices;
-        for (int idx : indices) {
-            if (X[idx][bestFeature] < bestThreshold)
-                leftIndices.push_back(idx);
-            else
-                rightIndices.push_back(idx);
+        const uint8_t *codes = &b.codes[bestFeature * b.rows];
+        size_t mid = partition(b.order.begin() + begin, b.order.begin() + end,
+                               [&](size_t row) { return codes[row] <= bestBin; }) - b.order.begin();
+
+        // Histogram subtraction: fill the smaller child, derive the larger.
+        vector<double> smaller;
+        bool leftSmaller = mid - begin <= end - mid;
+        if (leftSmaller) {
+            fillHistogram(b, begin, mid, smaller);
+        } else {
+            fillHistogram(b, mid, end, smaller);
         }
-        if (leftIndices.empty() || rightIndices.empty()) {
-            node->isLeaf = true;
-            return node;
+        for (size_t cell = 0; cell < b.cells; cell++) {
+            hist[cell] -= smaller[cell];
         }
-        // Recursively build left and right subtrees.
-        node->left = buildTree(X, y, leftIndices, depth + 1);
-        node->right = buildTree(X, y, rightIndices, depth + 1);
+        node->left = buildHistogramTree(b, begin, mid, depth + 1, leftSmaller ? smaller : hist);
+        node->right = buildHistogramTree(b, mid, end, depth + 1, leftSmaller ? hist : smaller);
         return node;
     }
 
+    /**
+     * @brief Mean of the targets (0 for none).
+     */
+    double computeMean(const vector<double> &y) const {
+        if (y.empty()) return 0.0;
+        double sum = 0.0;
+        for (double v : y) {
+            sum += v;
+        }
+        return sum / y.size();
+    }
+
+    /**
+     * @brief Mean squared deviation of the targets from their mean (0 for none).
+     */
+    double computeMSE(const vector<double> &y) const {
+        if (y.empty()) return 0.0;
+        double mean = computeMean(y), sum = 0.0;
+        for (double v : y) {
+            sum += (v - mean) * (v - mean);
+        }
+        return sum / y.size();
+    }
+
     // Helper for prediction: Traverse the tree for a single data point.
-    int traverseTree(Node* node, vector<double>& x) {
+    double traverseTree(Node* node, vector<double>& x) {
         if (node->isLeaf) {
             return node->prediction;
         }
@@ -218,7 +600,9 @@ public:
         // Create a label: for leaves, show "Leaf: prediction"; for internal nodes, show "X[feature] < threshold".
         string label;
         if (node->isLeaf) {
-            label = "Leaf: " + to_string(node->prediction);
+            ostringstream value;
+            value << node->prediction;
+            label = "Leaf: " + value.str();
         } else {
             label = "X" + to_string(node->featureIndex) + " < " + to_string(node->threshold);
         }
@@ -251,8 +635,8 @@ public:
     /**
      * @brief Trains the decision tree on the given data.
      * 
-     * Converts feature values and target from strings to doubles/ints,
-     * then recursively builds the tree using Gini impurity for split evaluation.
+     * Converts feature values and target from strings to doubles, then
+     * builds the tree with fit().
      * 
      * @param data The dataset to train on.
      * @throws runtime_error if data is empty or inconsistent.
@@ -265,45 +649,69 @@ public:
         }
 
         size_t numFeatures = data.features[0].size();
-        // Convert feature values to double and target to int.
-        vector<vector<double>> X(m, vector<double>(numFeatures, 0.0));
-        vector<int> y(m, 0);
+        // Convert feature values to double, row-major, and the target to doubles.
+        vector<double> points(m * numFeatures, 0.0);
+        vector<double> labels(m, 0.0);
         for (size_t i = 0; i < m; i++) {
             if (data.features[i].size() != numFeatures) {
                 throw runtime_error("Inconsistent feature dimensions in data.");
             }
             for (size_t j = 0; j < numFeatures; j++) {
-                X[i][j] = handle::toDouble(data.features[i][j]);
+                points[i * numFeatures + j] = handle::toDouble(data.features[i][j]);
             }
-            y[i] = static_cast<int>(handle::toDouble(data.target[i]));
+            labels[i] = handle::toDouble(data.target[i]);
         }
+        fit(points, m, numFeatures, labels);
 
-        // Create a list of indices for all samples.
-        vector<int> indices(m);
+        // Optionally, compute predictions on the training data.
+        vector<double> predictions;
+        vector<double> x(numFeatures);
         for (size_t i = 0; i < m; i++) {
-            indices[i] = static_cast<int>(i);
+            copy(&points[i * numFeatures], &points[(i + 1) * numFeatures], x.begin());
+            predictions.push_back(traverseTree(root, x));
         }
+        return static_cast<void*>(new vector<double>(predictions));
+    }
 
-        // Build the decision tree recursively.
+    /**
+     * @brief Trains the tree on m row-major rows of n numeric features.
+     *
+     * With Gini or Entropy, labels are truncated to integer classes (any
+     * number of them); with MSE they are regression targets.
+     *
+     * @throws runtime_error if the buffer sizes do not match m and n.
+     * @throws invalid_argument if maxBins is outside [2, 256] with the histogram splitter.
+     */
+    void fit(const vector<double> &points, size_t m, size_t n, const vector<double> &labels) {
+        if (m == 0 || n == 0 || points.size() != m * n || labels.size() != m) {
+            throw runtime_error("Training buffer sizes do not match the dimensions.");
+        }
+        if (splitter == Splitter::Histogram && (maxBins < 2 || maxBins > 256)) {
+            throw invalid_argument("maxBins must be between 2 and 256.");
+        }
         if (root != nullptr) {  // Clean up previous tree if it exists.
             freeTree(root);
+            root = nullptr;
         }
-        root = buildTree(X, y, indices, 0);
-
-        // Optionally, compute predictions on the training data.
-        vector<int> predictions;
-        for (size_t i = 0; i < m; i++) {
-            int pred = traverseTree(root, X[i]);
-            predictions.push_back(pred);
+        if (splitter == Splitter::Histogram) {
+            Binned binned;
+            binRows(points, m, n, labels, binned);
+            vector<double> hist;
+            fillHistogram(binned, 0, m, hist);
+            root = buildHistogramTree(binned, 0, m, 0, hist);
+            return;
         }
-        return static_cast<void*>(new vector<int>(predictions));
+
+        Sorted sorted;
+        sortRows(points, m, n, labels, sorted);
+        root = buildExactTree(sorted, 0, m, 0);
     }
 
     /**
-     * @brief Predicts class labels for a given dataset.
+     * @brief Predicts class labels (or regression targets) for a given dataset.
      * 
      * @param data The dataset for which predictions are required.
-     * @return A vector of doubles, where each value is the predicted class label.
+     * @return A vector of doubles, where each value is the predicted class label or target.
      */
     vector<double> predict(handle::Data &data) override {
         size_t m = data.features.size();
@@ -322,8 +730,7 @@ public:
         }
         vector<double> predictions;
         for (size_t i = 0; i < m; i++) {
-            int pred = traverseTree(root, X[i]);
-            predictions.push_back(static_cast<double>(pred));
+            predictions.push_back(traverseTree(root, X[i]));
         }
         return predictions;
     }
@@ -340,8 +747,7 @@ public:
             x[j] = handle::toDouble(features[j]);
         }
     
-        int prediction = traverseTree(root, x);
-        return static_cast<double>(prediction);
+        return traverseTree(root, x);
     }
     
 
@@ -380,7 +786,7 @@ public:
             for (int j = 0; j < nX; ++j) {
                 double xv = xmin + j * step;
                 vector<double> point = {xv, yv};
-                grid[i][j] = traverseTree(root, point);
+                grid[i][j] = static_cast<int>(traverseTree(root, point));
             }
         }
     
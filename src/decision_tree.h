@@ -4,8 +4,6 @@
 
 #include <vector>
 #include <string>
-#include <map>
-#include <tuple>
 #include "base.h"
 #include "data_handling.h"
 
@@ -13,51 +11,53 @@
 class DecisionTree : public Model {
 public:
     struct Node {
+        int featureIndex;      // Index of the feature used for splitting.
+        double threshold;      // Rows with value < threshold go left.
+        double prediction;     // Class label, or mean target for regression (if leaf).
         bool isLeaf;
-        double prediction;
-        int featureIndex;
-        double threshold;
         Node* left;
         Node* right;
-        Node(double pred)
-            : isLeaf(true), prediction(pred), featureIndex(-1), threshold(0.0), left(nullptr), right(nullptr) {}
-        Node(int featIdx, double thresh)
-            : isLeaf(false), prediction(0.0), featureIndex(featIdx), threshold(thresh), left(nullptr), right(nullptr) {}
+        Node();
     };
 
-    DecisionTree(int maxDepth = 5, int minSamplesSplit = 2, double lr = 0.01, int ep = 100)
-        : Model(lr, ep), root(nullptr), maxDepth(maxDepth), minSamplesSplit(minSamplesSplit) {}
+    enum class Splitter { Exact, Histogram };
+    enum class Criterion { Gini, Entropy, MSE };
+
+    Node* root;
+    int maxDepth;
+    int minSamplesSplit;
+    Splitter splitter = Splitter::Exact;     // Split search.
+    Criterion criterion = Criterion::Gini;   // Gini/Entropy: classifier; MSE: regression tree.
+    int maxBins = 256;                       // Histogram: bins per feature (2 to 256).
+
+    DecisionTree(int max_d = 5, int min_samples = 2, double lr = 0.0, int ep = 0);
 
     void* train(handle::Data &data) override;
+
+    /**
+     * @brief Trains on m row-major rows of n numeric features.
+     */
+    void fit(const std::vector<double> &points, size_t m, size_t n, const std::vector<double> &labels);
+
     std::vector<double> predict(handle::Data &data) override;
+    double predictSingle(std::vector<std::string> &features);
     ~DecisionTree();
 
     /**
-     * @brief Plot the trained tree structure using gnuplot.
-     * @param interactive If true, opens a Qt window; otherwise outputs a PNG to outputFilename.
-     * @param outputFilename Path to save PNG (ignored if interactive).
+     * @brief Mean of the targets, and their mean squared deviation from it.
      */
-    void plotTree(bool interactive = true, const std::string &outputFilename = "decision_tree.png");
+    double computeMean(const std::vector<double> &y) const;
+    double computeMSE(const std::vector<double> &y) const;
 
-private:
-    Node* root;
-    int maxDepth;
-    int minSamplesSplit;
+    double traverseTree(Node* node, std::vector<double> &x);
 
-    Node* buildTree(const std::vector<std::vector<double>> &X,
-                    const std::vector<double> &y,
-                    int depth);
-    double computeMean(const std::vector<double> &y);
-    double computeMSE(const std::vector<double> &y);
-    double traverse(Node* node, const std::vector<double> &x);
-    void freeTree(Node* node);
+    /**
+     * @brief Plots the decision regions of the first two features with gnuplot.
+     */
+    void plot(handle::Data &data);
 
-    // Helpers for plotting
-    void assignPositions(Node* node, int depth, std::map<Node*, double> &xpos, int &counter);
-    void collectPlotData(Node* node, int depth,
-                         const std::map<Node*, double> &xpos,
-                         std::vector<std::tuple<double,double,std::string>> &nodes,
-                         std::vector<std::tuple<double,double,double,double>> &edges);
+private:
+    void freeTree(Node* node);
 };
 
-#endif // DECISION_TREE_H
\ No newline at end of file
+#endif // DECISION_TREE_H
@@ -0,0 +1,428 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+
+namespace metric
+{
+
+// Distance metrics supported by the neighbour search indexes.
+enum class Metric
+{
+    Euclidean,
+    Manhattan,
+    Cosine,            // Rows are L2-normalised and searched with Euclidean distance.
+    SquaredEuclidean,  // Same neighbours as Euclidean; distances are reported squared.
+    Chebyshev,         // L-infinity: the largest per-axis difference.
+    Minkowski          // L-p for an integer p in [1, MAX_MINKOWSKI_P].
+};
+
+// Largest Minkowski exponent with a compiled kernel.
+constexpr int MAX_MINKOWSKI_P = 4;
+
+// Each policy works on a "reduced" distance that is cheaper to compute but
+// orders points the same way as the true distance (squared L2 for Euclidean).
+// The reduced distance folds non-negative per-axis terms with combine() (a
+// sum, or a max for Chebyshev), which is what lets the KD-tree bound its cells
+// one axis at a time and lets reducedBounded() stop as soon as a partial
+// result already exceeds the current k-th best.
+//
+// Policies are plain structs with static members, so a search templated on
+// one compiles to a loop without any indirect call per distance.
+
+// Number of axes accumulated between two early-exit checks.
+constexpr size_t PARTIAL_BLOCK = 8;
+
+// Four doubles processed as one SIMD value (GCC/Clang vector extension,
+// lowered to SSE2 or AVX depending on the target).
+typedef double vec4d __attribute__((vector_size(32)));
+
+/**
+ * @brief Runtime-dimension loops shared by every policy.
+ *
+ * Four axes are folded at a time into a vec4d accumulator through
+ * Policy::accumulate(); the lanes are combined at the end and the last n % 4
+ * axes are handled one by one.
+ */
+template <class Policy>
+struct Reduction
+{
+    static double reduced(const double *a, const double *b, size_t n)
+    {
+        vec4d acc = {0.0, 0.0, 0.0, 0.0};
+        size_t j = 0;
+        for (; j + 4 <= n; j += 4)
+            step(acc, a + j, b + j);
+        double r = lanes(acc);
+        for (; j < n; j++)
+            r = Policy::combine(r, Policy::axis(a[j] - b[j]));
+        return r;
+    }
+    // Like reduced(), but may return any value > bound once the result exceeds bound.
+    static double reducedBounded(const double *a, const double *b, size_t n, double bound)
+    {
+        vec4d acc = {0.0, 0.0, 0.0, 0.0};
+        size_t j = 0;
+        for (; j + PARTIAL_BLOCK <= n; j += PARTIAL_BLOCK)
+        {
+            for (size_t t = j; t < j + PARTIAL_BLOCK; t += 4)
+                step(acc, a + t, b + t);
+            double partial = lanes(acc);
+            if (partial > bound)
+                return partial;
+        }
+        for (; j + 4 <= n; j += 4)
+            step(acc, a + j, b + j);
+        double r = lanes(acc);
+        for (; j < n; j++)
+            r = Policy::combine(r, Policy::axis(a[j] - b[j]));
+        return r;
+    }
+
+private:
+    static void step(vec4d &acc, const double *a, const double *b)
+    {
+        vec4d va, vb;
+        std::memcpy(&va, a, sizeof(va));
+        std::memcpy(&vb, b, sizeof(vb));
+        vec4d diff = va - vb;
+        Policy::accumulate(acc, diff);
+    }
+    static double lanes(const vec4d &acc)
+    {
+        return Policy::combine(Policy::combine(acc[0], acc[1]), Policy::combine(acc[2], acc[3]));
+    }
+};
+
+struct Euclidean : Reduction<Euclidean>
+{
+    static double axis(double diff) { return diff * diff; }
+    static double combine(double acc, double term) { return acc + term; }
+    static void accumulate(vec4d &acc, const vec4d &diff) { acc += diff * diff; }
+    // Reduced cell distance after the offset along one axis moves from oldDiff to newDiff.
+    static double moveAxis(double rd, double oldDiff, double newDiff) { return rd - axis(oldDiff) + axis(newDiff); }
+    static double toReduced(double d) { return d * d; }
+    static double fromReduced(double r) { return std::sqrt(r); }
+};
+
+// Squared L2 is not a metric (no triangle inequality), so the trees search
+// with Euclidean and only the reported distance differs.
+struct SquaredEuclidean : Euclidean
+{
+    static double toReduced(double d) { return d; }
+    static double fromReduced(double r) { return r; }
+};
+
+struct Manhattan : Reduction<Manhattan>
+{
+    static double axis(double diff) { return std::fabs(diff); }
+    static double combine(double acc, double term) { return acc + term; }
+    static void accumulate(vec4d &acc, const vec4d &diff) { acc += diff < 0 ? -diff : diff; }
+    static double moveAxis(double rd, double oldDiff, double newDiff) { return rd - axis(oldDiff) + axis(newDiff); }
+    static double toReduced(double d) { return d; }
+    static double fromReduced(double r) { return r; }
+};
+
+struct Chebyshev : Reduction<Chebyshev>
+{
+    static double axis(double diff) { return std::fabs(diff); }
+    static double combine(double acc, double term) { return acc > term ? acc : term; }
+    static void accumulate(vec4d &acc, const vec4d &diff)
+    {
+        vec4d m = diff < 0 ? -diff : diff;
+        acc = acc > m ? acc : m;
+    }
+    // Along a KD-tree path the offset on an axis only grows, so the max never has to shrink.
+    static double moveAxis(double rd, double, double newDiff) { return combine(rd, axis(newDiff)); }
+    static double toReduced(double d) { return d; }
+    static double fromReduced(double r) { return r; }
+};
+
+template <int P>
+struct Minkowski : Reduction<Minkowski<P>>
+{
+    static_assert(P >= 1, "Minkowski exponent must be positive");
+    static double axis(double diff)
+    {
+        double m = std::fabs(diff), r = m;
+        for (int i = 1; i < P; i++)
+            r *= m;
+        return r;
+    }
+    static double combine(double acc, double term) { return acc + term; }
+    static void accumulate(vec4d &acc, const vec4d &diff)
+    {
+        vec4d m = diff < 0 ? -diff : diff, r = m;
+        for (int i = 1; i < P; i++)
+            r *= m;
+        acc += r;
+    }
+    static double moveAxis(double rd, double oldDiff, double newDiff) { return rd - axis(oldDiff) + axis(newDiff); }
+    static double toReduced(double d) { return axis(d); }
+    static double fromReduced(double r) { return std::pow(r, 1.0 / P); }
+};
+
+/**
+ * @brief A policy specialised for exactly N columns.
+ *
+ * reduced() is fully unrolled (no loop counter, no tail) and ignores its n
+ * argument; reducedBounded() skips the early-exit checks, which cost more than
+ * they save on so few columns. Everything else is inherited from Dist.
+ */
+template <class Dist, size_t N>
+struct FixedDim : Dist
+{
+    static double reduced(const double *a, const double *b, size_t = N)
+    {
+        return unrolled(a, b, std::make_index_sequence<N>());
+    }
+    static double reducedBounded(const double *a, const double *b, size_t n, double)
+    {
+        return reduced(a, b, n);
+    }
+
+private:
+    template <size_t... I>
+    static double unrolled(const double *a, const double *b, std::index_sequence<I...>)
+    {
+        double r = 0.0;
+        ((r = Dist::combine(r, Dist::axis(a[I] - b[I]))), ...);
+        return r;
+    }
+};
+
+/**
+ * @brief Validates the Minkowski exponent of a metric.
+ * @throws invalid_argument if m is Minkowski and p is outside [1, MAX_MINKOWSKI_P].
+ */
+inline void checkMetric(Metric m, int p)
+{
+    if (m == Metric::Minkowski && (p < 1 || p > MAX_MINKOWSKI_P))
+        throw std::invalid_argument("Unsupported Minkowski exponent: " + std::to_string(p));
+}
+
+/**
+ * @brief Calls f(Dist()) with the policy that searches metric m.
+ *
+ * Cosine and SquaredEuclidean search with Euclidean (rows are normalised /
+ * only the reported distance differs), and Minkowski with p = 1 or 2 with the
+ * Manhattan and Euclidean kernels. Call this once per query batch or build,
+ * never per distance.
+ *
+ * @throws invalid_argument for a Minkowski p outside [1, MAX_MINKOWSKI_P].
+ */
+template <class F>
+void withMetric(Metric m, int p, F &&f)
+{
+    switch (m)
+    {
+    case Metric::Manhattan:
+        f(Manhattan());
+        return;
+    case Metric::Chebyshev:
+        f(Chebyshev());
+        return;
+    case Metric::Minkowski:
+        switch (p)
+        {
+        case 1:
+            f(Manhattan());
+            return;
+        case 2:
+            f(Euclidean());
+            return;
+        case 3:
+            f(Minkowski<3>());
+            return;
+        case 4:
+            f(Minkowski<4>());
+            return;
+        }
+        checkMetric(m, p);
+        return;
+    default:
+        f(Euclidean());
+        return;
+    }
+}
+
+/**
+ * @brief Calls f with FixedDim<Dist, n> for n in {2, 3, 4, 8, 16}, else with Dist itself.
+ */
+template <class Dist, class F>
+void withDimension(size_t n, F &&f)
+{
+    switch (n)
+    {
+    case 2:
+        f(FixedDim<Dist, 2>());
+        return;
+    case 3:
+        f(FixedDim<Dist, 3>());
+        return;
+    case 4:
+        f(FixedDim<Dist, 4>());
+        return;
+    case 8:
+        f(FixedDim<Dist, 8>());
+        return;
+    case 16:
+        f(FixedDim<Dist, 16>());
+        return;
+    }
+    f(Dist());
+}
+
+/**
+ * @brief withMetric() followed by withDimension(): f receives the kernel for metric m on n columns.
+ */
+template <class F>
+void withKernel(Metric m, int p, size_t n, F &&f)
+{
+    withMetric(m, p, [&](auto dist) { withDimension<decltype(dist)>(n, f); });
+}
+
+/**
+ * @brief True when metric m ranks neighbours by L2 distance (the dot-product expansion applies).
+ */
+inline bool isEuclidean(Metric m, int p)
+{
+    return m == Metric::Euclidean || m == Metric::Cosine || m == Metric::SquaredEuclidean ||
+           (m == Metric::Minkowski && p == 2);
+}
+
+/**
+ * @brief The metric an index searches for m: Cosine and SquaredEuclidean become
+ *        Euclidean, and Minkowski with p = 1 or 2 becomes Manhattan or Euclidean.
+ */
+inline Metric searchMetric(Metric m, int p)
+{
+    if (m == Metric::Minkowski && p == 1)
+        return Metric::Manhattan;
+    if (isEuclidean(m, p))
+        return Metric::Euclidean;
+    return m;
+}
+
+/**
+ * @brief Offers a candidate to a bounded max-heap holding the best k (distance, row) pairs.
+ *
+ * The heap top is the current k-th best; ties are broken by row index.
+ */
+inline void offerCandidate(std::vector<std::pair<double, size_t>> &heap, size_t k, double dist, size_t row)
+{
+    if (heap.size() < k)
+    {
+        heap.emplace_back(dist, row);
+        std::push_heap(heap.begin(), heap.end());
+    }
+    else if (std::make_pair(dist, row) < heap.front())
+    {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = std::make_pair(dist, row);
+        std::push_heap(heap.begin(), heap.end());
+    }
+}
+
+/**
+ * @brief Scales every row of a row-major buffer to unit L2 norm (zero rows are left as is).
+ */
+inline void normalizeRows(double *data, size_t m, size_t n)
+{
+    for (size_t i = 0; i < m; i++)
+    {
+        double *row = data + i * n;
+        double norm = 0.0;
+        for (size_t j = 0; j < n; j++)
+            norm += row[j] * row[j];
+        if (norm > 0.0)
+        {
+            norm = 1.0 / std::sqrt(norm);
+            for (size_t j = 0; j < n; j++)
+                row[j] *= norm;
+        }
+    }
+}
+
+/**
+ * @brief Converts a reduced distance back to the metric's true distance.
+ *
+ * For Cosine the reduced distance is the squared L2 distance between unit
+ * vectors, which equals 2 * (1 - cos).
+ *
+ * @param p Exponent of Metric::Minkowski.
+ */
+inline double fromReduced(Metric m, double r, int p = 2)
+{
+    switch (m)
+    {
+    case Metric::Euclidean:
+        return Euclidean::fromReduced(r);
+    case Metric::Manhattan:
+        return Manhattan::fromReduced(r);
+    case Metric::Cosine:
+        return r / 2.0;
+    case Metric::SquaredEuclidean:
+        return SquaredEuclidean::fromReduced(r);
+    case Metric::Chebyshev:
+        return Chebyshev::fromReduced(r);
+    case Metric::Minkowski:
+        return p == 1 ? r : std::pow(r, 1.0 / p);
+    }
+    return r;
+}
+
+/**
+ * @brief Converts a true distance to the reduced distance of metric m (inverse of fromReduced()).
+ */
+inline double toReduced(Metric m, double d, int p = 2)
+{
+    switch (m)
+    {
+    case Metric::Euclidean:
+        return Euclidean::toReduced(d);
+    case Metric::Manhattan:
+        return Manhattan::toReduced(d);
+    case Metric::Cosine:
+        return d * 2.0;
+    case Metric::SquaredEuclidean:
+        return SquaredEuclidean::toReduced(d);
+    case Metric::Chebyshev:
+        return Chebyshev::toReduced(d);
+    case Metric::Minkowski:
+        return p == 1 ? d : std::pow(d, static_cast<double>(p));
+    }
+    return d;
+}
+
+/**
+ * @brief Parses a metric name ("euclidean", "sqeuclidean", "manhattan",
+ *        "chebyshev", "minkowski" or "cosine").
+ * @throws invalid_argument for unknown names.
+ */
+inline Metric parseMetric(const std::string &name)
+{
+    if (name == "euclidean")
+        return Metric::Euclidean;
+    if (name == "sqeuclidean")
+        return Metric::SquaredEuclidean;
+    if (name == "manhattan")
+        return Metric::Manhattan;
+    if (name == "chebyshev")
+        return Metric::Chebyshev;
+    if (name == "minkowski")
+        return Metric::Minkowski;
+    if (name == "cosine")
+        return Metric::Cosine;
+    throw std::invalid_argument("Unknown distance metric: " + name);
+}
+
+} // namespace metric
+
+#endif // DISTANCE_H
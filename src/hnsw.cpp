@@ -0,0 +1,470 @@
+#pragma once
+#ifndef HNSW_H
+#define HNSW_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <queue>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include "distance.h"
+#include "parallel.h"
+#include "serialize.h"
+
+using namespace std;
+
+// Hierarchical Navigable Small World graph (Malkov & Yashunin) for approximate
+// nearest-neighbour search. Every row is a graph node; upper layers hold an
+// exponentially thinning subset of nodes and act as an express lane towards
+// the query, layer 0 holds every node. Recall is traded against latency with
+// efSearch (and, at build time, M and efConstruction). The graph stores links
+// only: the rows stay with the caller, who passes them to every query.
+class HNSW {
+public:
+    size_t M;                      // Links per node on upper layers (2 * M on layer 0).
+    size_t efConstruction;         // Candidate list size while inserting.
+    size_t efSearch;               // Candidate list size while querying (>= k).
+    unsigned seed;                 // Seed for the layer assignment.
+
+    size_t dim = 0;                // Number of features per row.
+    size_t count = 0;              // Number of nodes (rows).
+    metric::Metric metricType = metric::Metric::Euclidean;
+    int maxLevel = -1;             // Highest layer in the graph, -1 when empty.
+    uint32_t entryPoint = 0;       // Node at maxLevel where every search starts.
+    vector<int> levels;            // Top layer of every node.
+    vector<uint32_t> level0;       // Layer-0 links: count * (2M + 1), first slot is the link count.
+    vector<vector<uint32_t>> upperLinks; // Layers 1..levels[i], each (M + 1) slots.
+
+    /**
+     * @brief Constructor for HNSW.
+     *
+     * @param m Links per node (default: 16).
+     * @param efC Candidate list size during construction (default: 200).
+     * @param efS Candidate list size during search (default: 50).
+     * @param seed_val Seed for the random layer assignment (default: 100).
+     */
+    HNSW(size_t m = 16, size_t efC = 200, size_t efS = 50, unsigned seed_val = 100)
+        : M(max<size_t>(m, 2)), efConstruction(efC), efSearch(efS), seed(seed_val) {}
+
+    /**
+     * @brief Builds the graph over a row-major point buffer, inserting rows on all worker threads.
+     *
+     * @param data Row-major buffer of m * n values; query() needs the same rows.
+     * @param m Number of rows.
+     * @param n Number of columns.
+     * @param met Euclidean, Manhattan or Cosine (Cosine expects L2-normalised rows
+     *            and is searched with Euclidean distance).
+     * @throws runtime_error if the buffer size does not match m * n or m >= 2^32.
+     */
+    void build(const vector<double> &data, size_t m, size_t n, metric::Metric met = metric::Metric::Euclidean) {
+        if (data.size() != m * n) {
+            throw runtime_error("HNSW: point buffer size does not match dimensions.");
+        }
+        if (m >= UINT32_MAX) {
+            throw runtime_error("HNSW: too many rows.");
+        }
+        dim = n;
+        count = m;
+        metricType = met == metric::Metric::Manhattan ? metric::Metric::Manhattan : metric::Metric::Euclidean;
+        maxLevel = -1;
+        entryPoint = 0;
+        level0.assign(m * (2 * M + 1), 0);
+        levels.resize(m);
+        upperLinks.assign(m, vector<uint32_t>());
+        double levelMult = 1.0 / log(static_cast<double>(M));
+        for (size_t i = 0; i < m; i++) {
+            levels[i] = randomLevel(i, levelMult);
+            upperLinks[i].assign(static_cast<size_t>(levels[i]) * (M + 1), 0);
+        }
+        sync = make_shared<SyncState>(m);
+        if (m == 0) {
+            return;
+        }
+
+        sync->building = true;
+        entryPoint = 0;
+        maxLevel = levels[0];
+        if (metricType == metric::Metric::Manhattan) {
+            handle::parallelFor(m - 1, [&](size_t b, size_t e) {
+                for (size_t i = b; i < e; i++) insert<metric::Manhattan>(data.data(), static_cast<uint32_t>(i + 1));
+            }, 64);
+        } else {
+            handle::parallelFor(m - 1, [&](size_t b, size_t e) {
+                for (size_t i = b; i < e; i++) insert<metric::Euclidean>(data.data(), static_cast<uint32_t>(i + 1));
+            }, 64);
+        }
+        sync->building = false;
+    }
+
+    /**
+     * @brief Approximate k-nearest search.
+     *
+     * @param query Pointer to dim feature values.
+     * @param k Number of neighbours to return.
+     * @param out Filled with (reduced distance, row index), nearest first.
+     *            Distances are squared for Euclidean/Cosine and plain for Manhattan.
+     * @param data The row-major rows the graph was built over.
+     * @param skip Optional flag per row; flagged rows are never returned but
+     *             still route the search, so the graph stays connected.
+     */
+    void query(const double *query, size_t k, vector<pair<double, size_t>> &out, const double *data,
+               const char *skip = nullptr) const {
+        out.clear();
+        if (count == 0 || k == 0) {
+            return;
+        }
+        if (metricType == metric::Metric::Manhattan) {
+            search<metric::Manhattan>(data, query, k, out, skip);
+        } else {
+            search<metric::Euclidean>(data, query, k, out, skip);
+        }
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    /**
+     * @brief Releases the graph, keeping the construction and search parameters.
+     */
+    void clear() {
+        dim = count = 0;
+        maxLevel = -1;
+        entryPoint = 0;
+        levels.clear();
+        level0.clear();
+        upperLinks.clear();
+        sync.reset();
+    }
+
+    /**
+     * @brief Writes the graph (parameters and links) to a binary file.
+     * @throws runtime_error if the file cannot be written.
+     */
+    void save(const string &path) const {
+        ofstream out(path, ios::binary);
+        if (!out) {
+            throw runtime_error("Cannot open file " + path);
+        }
+        save(out);
+        if (!out) {
+            throw runtime_error("Failed to write HNSW index to " + path);
+        }
+    }
+
+    void save(ostream &out) const {
+        out.write(MAGIC, 4);
+        uint64_t header[9] = {VERSION, dim, count, M, efConstruction, efSearch,
+                              static_cast<uint64_t>(metricType), static_cast<uint64_t>(maxLevel + 1), entryPoint};
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        handle::writeVector(out, levels);
+        handle::writeVector(out, level0);
+        for (const auto &links : upperLinks) {
+            handle::writeVector(out, links);
+        }
+    }
+
+    /**
+     * @brief Loads a graph written by save(), replacing the current one.
+     * @throws runtime_error if the file cannot be read or is not an HNSW index.
+     */
+    void load(const string &path) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            throw runtime_error("Cannot open file " + path);
+        }
+        load(in);
+    }
+
+    void load(istream &in) {
+        char magic[4];
+        uint64_t header[9];
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (!in || memcmp(magic, MAGIC, 4) != 0 || header[0] != VERSION) {
+            throw runtime_error("Not a valid HNSW index file.");
+        }
+        dim = header[1];
+        count = header[2];
+        M = header[3];
+        efConstruction = header[4];
+        efSearch = header[5];
+        metricType = static_cast<metric::Metric>(header[6]);
+        maxLevel = static_cast<int>(header[7]) - 1;
+        entryPoint = static_cast<uint32_t>(header[8]);
+        handle::readVector(in, levels);
+        handle::readVector(in, level0);
+        upperLinks.assign(count, vector<uint32_t>());
+        for (auto &links : upperLinks) {
+            handle::readVector(in, links);
+        }
+        if (!in || levels.size() != count || level0.size() != count * (2 * M + 1)) {
+            throw runtime_error("Corrupt HNSW index file.");
+        }
+        sync = make_shared<SyncState>(count);
+    }
+
+private:
+    static constexpr const char *MAGIC = "HNSW";
+    static constexpr uint64_t VERSION = 2;
+
+    // Per-thread scratch marking visited nodes; a tag avoids clearing between searches.
+    struct VisitedList {
+        vector<uint16_t> marks;
+        uint16_t tag = 0;
+        void reset(size_t n) {
+            if (marks.size() < n) {
+                marks.assign(n, 0);
+                tag = 0;
+            }
+            if (++tag == 0) {
+                fill(marks.begin(), marks.end(), 0);
+                tag = 1;
+            }
+        }
+    };
+
+    // Locks and scratch shared by copies of one built graph.
+    struct SyncState {
+        vector<mutex> nodeLocks;
+        mutex entryLock;
+        mutex poolLock;
+        vector<unique_ptr<VisitedList>> pool;
+        bool building = false;
+        explicit SyncState(size_t n) : nodeLocks(n) {}
+    };
+    shared_ptr<SyncState> sync;
+
+    typedef pair<double, uint32_t> Candidate;
+
+    int randomLevel(size_t i, double levelMult) const {
+        // splitmix64 of (seed, row) so the layer does not depend on insertion order.
+        uint64_t z = (static_cast<uint64_t>(seed) << 32) + i + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        double u = ((z >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+        return static_cast<int>(-log(u) * levelMult);
+    }
+
+    const double *row(const double *data, uint32_t id) const { return data + static_cast<size_t>(id) * dim; }
+
+    uint32_t *links(uint32_t id, int layer) {
+        return layer == 0 ? &level0[static_cast<size_t>(id) * (2 * M + 1)]
+                          : &upperLinks[id][static_cast<size_t>(layer - 1) * (M + 1)];
+    }
+    const uint32_t *links(uint32_t id, int layer) const {
+        return const_cast<HNSW *>(this)->links(id, layer);
+    }
+
+    // Copies the links of a node; takes the node lock while the graph is being built.
+    void readLinks(uint32_t id, int layer, vector<uint32_t> &out) const {
+        const uint32_t *l = links(id, layer);
+        if (sync->building) {
+            lock_guard<mutex> guard(sync->nodeLocks[id]);
+            out.assign(l + 1, l + 1 + l[0]);
+        } else {
+            out.assign(l + 1, l + 1 + l[0]);
+        }
+    }
+
+    unique_ptr<VisitedList> acquireVisited() const {
+        unique_ptr<VisitedList> v;
+        {
+            lock_guard<mutex> guard(sync->poolLock);
+            if (!sync->pool.empty()) {
+                v = move(sync->pool.back());
+                sync->pool.pop_back();
+            }
+        }
+        if (!v) {
+            v.reset(new VisitedList());
+        }
+        v->reset(count);
+        return v;
+    }
+
+    void releaseVisited(unique_ptr<VisitedList> v) const {
+        lock_guard<mutex> guard(sync->poolLock);
+        sync->pool.push_back(move(v));
+    }
+
+    // Walks greedily towards the query on one layer.
+    template <class Dist>
+    void greedy(const double *data, const double *q, uint32_t &cur, double &curDist, int layer, vector<uint32_t> &scratch) const {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            readLinks(cur, layer, scratch);
+            for (uint32_t e : scratch) {
+                double d = Dist::reduced(q, row(data, e), dim);
+                if (d < curDist) {
+                    curDist = d;
+                    cur = e;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Beam search on one layer; returns up to ef candidates as a max-heap.
+    // Nodes flagged in skip are expanded but never enter the result.
+    template <class Dist>
+    void searchLayer(const double *data, const double *q, uint32_t ep, double epDist, size_t ef, int layer,
+                     vector<Candidate> &top, const char *skip = nullptr) const {
+        unique_ptr<VisitedList> visited = acquireVisited();
+        priority_queue<Candidate, vector<Candidate>, greater<Candidate>> frontier;
+        vector<uint32_t> scratch;
+        top.clear();
+        if (skip == nullptr || !skip[ep]) {
+            top.emplace_back(epDist, ep);
+        }
+        frontier.emplace(epDist, ep);
+        visited->marks[ep] = visited->tag;
+
+        while (!frontier.empty()) {
+            Candidate c = frontier.top();
+            if (top.size() >= ef && c.first > top.front().first) {
+                break;
+            }
+            frontier.pop();
+            readLinks(c.second, layer, scratch);
+            for (uint32_t e : scratch) {
+                if (visited->marks[e] == visited->tag) {
+                    continue;
+                }
+                visited->marks[e] = visited->tag;
+                double d = top.size() < ef ? Dist::reduced(q, row(data, e), dim)
+                                           : Dist::reducedBounded(q, row(data, e), dim, top.front().first);
+                if (top.size() < ef || d < top.front().first) {
+                    frontier.emplace(d, e);
+                    if (skip != nullptr && skip[e]) {
+                        continue;
+                    }
+                    top.emplace_back(d, e);
+                    push_heap(top.begin(), top.end());
+                    if (top.size() > ef) {
+                        pop_heap(top.begin(), top.end());
+                        top.pop_back();
+                    }
+                }
+            }
+        }
+        releaseVisited(move(visited));
+    }
+
+    // Neighbour selection heuristic: keep a candidate only if it is closer to the
+    // base node than to every neighbour already kept. cands must be sorted ascending.
+    template <class Dist>
+    void selectNeighbours(const double *data, const vector<Candidate> &cands, size_t maxConn, vector<uint32_t> &out) const {
+        out.clear();
+        for (const Candidate &c : cands) {
+            if (out.size() >= maxConn) {
+                break;
+            }
+            bool keep = true;
+            for (uint32_t r : out) {
+                if (Dist::reduced(row(data, c.second), row(data, r), dim) < c.first) {
+                    keep = false;
+                    break;
+                }
+            }
+            if (keep) {
+                out.push_back(c.second);
+            }
+        }
+    }
+
+    // Adds a back link from node e to node id, pruning e's list if it is full.
+    template <class Dist>
+    void connect(const double *data, uint32_t e, uint32_t id, int layer) {
+        size_t cap = layer == 0 ? 2 * M : M;
+        lock_guard<mutex> guard(sync->nodeLocks[e]);
+        uint32_t *l = links(e, layer);
+        if (l[0] < cap) {
+            l[1 + l[0]] = id;
+            l[0]++;
+            return;
+        }
+        vector<Candidate> cands;
+        cands.reserve(cap + 1);
+        cands.emplace_back(Dist::reduced(row(data, e), row(data, id), dim), id);
+        for (uint32_t j = 0; j < l[0]; j++) {
+            cands.emplace_back(Dist::reduced(row(data, e), row(data, l[1 + j]), dim), l[1 + j]);
+        }
+        sort(cands.begin(), cands.end());
+        vector<uint32_t> kept;
+        selectNeighbours<Dist>(data, cands, cap, kept);
+        l[0] = static_cast<uint32_t>(kept.size());
+        copy(kept.begin(), kept.end(), l + 1);
+    }
+
+    template <class Dist>
+    void insert(const double *data, uint32_t id) {
+        const double *q = row(data, id);
+        int level = levels[id];
+        unique_lock<mutex> topLock(sync->entryLock);
+        int topLevel = maxLevel;
+        uint32_t cur = entryPoint;
+        if (level <= topLevel) {
+            topLock.unlock();
+        }
+
+        double curDist = Dist::reduced(q, row(data, cur), dim);
+        vector<uint32_t> scratch;
+        for (int layer = topLevel; layer > level; layer--) {
+            greedy<Dist>(data, q, cur, curDist, layer, scratch);
+        }
+
+        vector<Candidate> top;
+        vector<uint32_t> selected;
+        for (int layer = min(level, topLevel); layer >= 0; layer--) {
+            searchLayer<Dist>(data, q, cur, curDist, efConstruction, layer, top);
+            sort_heap(top.begin(), top.end());
+            selectNeighbours<Dist>(data, top, M, selected);
+            {
+                lock_guard<mutex> guard(sync->nodeLocks[id]);
+                uint32_t *l = links(id, layer);
+                l[0] = static_cast<uint32_t>(selected.size());
+                copy(selected.begin(), selected.end(), l + 1);
+            }
+            for (uint32_t e : selected) {
+                connect<Dist>(data, e, id, layer);
+            }
+            cur = top.front().second;
+            curDist = top.front().first;
+        }
+
+        if (level > topLevel) {
+            entryPoint = id;
+            maxLevel = level;
+        }
+    }
+
+    template <class Dist>
+    void search(const double *data, const double *q, size_t k, vector<pair<double, size_t>> &out,
+                const char *skip) const {
+        uint32_t cur = entryPoint;
+        double curDist = Dist::reduced(q, row(data, cur), dim);
+        vector<uint32_t> scratch;
+        for (int layer = maxLevel; layer > 0; layer--) {
+            greedy<Dist>(data, q, cur, curDist, layer, scratch);
+        }
+        vector<Candidate> top;
+        searchLayer<Dist>(data, q, cur, curDist, max(efSearch, k), 0, top, skip);
+        sort_heap(top.begin(), top.end());
+        size_t found = min(k, top.size());
+        out.reserve(found);
+        for (size_t i = 0; i < found; i++) {
+            out.emplace_back(top[i].first, top[i].second);
+        }
+    }
+};
+
+#endif // HNSW_H
@@ -0,0 +1,68 @@
+#pragma once
+#ifndef HNSW_H
+#define HNSW_H
+
+#include <vector>
+#include <utility>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include "distance.h"
+
+class HNSW {
+public:
+    size_t M;                      // Links per node on upper layers (2 * M on layer 0).
+    size_t efConstruction;         // Candidate list size while inserting.
+    size_t efSearch;               // Candidate list size while querying (>= k).
+    unsigned seed;                 // Seed for the layer assignment.
+
+    /**
+     * @brief Constructor for HNSW.
+     *
+     * @param m Links per node (default: 16).
+     * @param efC Candidate list size during construction (default: 200).
+     * @param efS Candidate list size during search (default: 50).
+     * @param seed_val Seed for the random layer assignment (default: 100).
+     */
+    HNSW(size_t m = 16, size_t efC = 200, size_t efS = 50, unsigned seed_val = 100);
+
+    /**
+     * @brief Builds the graph over a row-major point buffer, inserting rows on all worker threads.
+     *
+     * Only the links are stored; the caller keeps the rows for query().
+     */
+    void build(const std::vector<double> &data, size_t m, size_t n,
+               metric::Metric met = metric::Metric::Euclidean);
+
+    /**
+     * @brief Approximate k-nearest search.
+     *
+     * @param out Filled with (reduced distance, row index), nearest first.
+     * @param data The row-major rows the graph was built over.
+     * @param skip Optional flag per row; flagged rows are never returned.
+     */
+    void query(const double *query, size_t k, std::vector<std::pair<double, size_t>> &out,
+               const double *data, const char *skip = nullptr) const;
+
+    bool empty() const;
+    size_t size() const;
+
+    /**
+     * @brief Releases the graph, keeping the construction and search parameters.
+     */
+    void clear();
+
+    /**
+     * @brief Writes the graph (parameters and links) to a binary file or stream.
+     */
+    void save(const std::string &path) const;
+    void save(std::ostream &out) const;
+
+    /**
+     * @brief Loads a graph written by save(), replacing the current one.
+     */
+    void load(const std::string &path);
+    void load(std::istream &in);
+};
+
+#endif // HNSW_H
@@ -0,0 +1,440 @@
+#pragma once
+#ifndef IVF_PQ_H
+#define IVF_PQ_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <string>
+#include "distance.h"
+#include "parallel.h"
+#include "serialize.h"
+
+using namespace std;
+
+// Inverted-file index with product-quantised residuals (IVF-PQ, Jegou et al.).
+// A coarse quantizer splits the space into nlist cells; every row is stored in
+// the list of its nearest cell as `subspaces` one-byte codes of its residual,
+// so a row costs subspaces + 4 bytes instead of 8 * dim. A query scans the
+// nprobe closest lists with asymmetric distance tables (query residual vs every
+// codeword) and can optionally re-rank the best candidates on the raw vectors.
+class IVFPQ {
+public:
+    static constexpr size_t CODEBOOK_SIZE = 256;   // Codewords per subspace (one byte per code).
+    static constexpr size_t CODEBOOK_TRAIN_ROWS = 32;  // Training rows per codeword.
+
+    size_t nlist;                  // Requested number of coarse cells.
+    size_t nprobe;                 // Cells scanned per query.
+    size_t subspaces;              // PQ subspaces = bytes per encoded row.
+    size_t rerank;                 // Candidates re-scored exactly (0 disables re-ranking).
+    size_t trainSample;            // Rows sampled to train the quantizers.
+    int iterations;                // Lloyd iterations for every quantizer.
+    unsigned seed;                 // Seed for sampling and initialisation.
+
+    size_t dim = 0;                // Number of features per row.
+    size_t subDim = 0;             // Columns per subspace (last one zero-padded).
+    size_t count = 0;              // Number of encoded rows.
+    size_t cellCount = 0;          // Trained coarse cells: nlist, or fewer when the sample is smaller.
+    metric::Metric metricType = metric::Metric::Euclidean;
+    vector<double> coarse;         // Coarse centroids, row-major (cellCount * dim).
+    vector<double> codebooks;      // Codewords stored [subspace][column][codeword] for vectorised tables.
+    vector<vector<uint32_t>> listIds;   // Row index of every entry, per cell.
+    vector<vector<uint8_t>> listCodes;  // subspaces codes of every entry, per cell.
+
+    /**
+     * @brief Constructor for IVFPQ.
+     *
+     * @param lists Number of coarse cells (default: 256).
+     * @param probes Cells scanned per query (default: 8).
+     * @param subs PQ subspaces, i.e. bytes per row (default: 16).
+     * @param rerankCount Candidates re-scored on raw vectors, 0 to disable (default: 0).
+     * @param seed_val Random seed (default: 42).
+     */
+    IVFPQ(size_t lists = 256, size_t probes = 8, size_t subs = 16, size_t rerankCount = 0, unsigned seed_val = 42)
+        : nlist(max<size_t>(lists, 1)), nprobe(max<size_t>(probes, 1)), subspaces(max<size_t>(subs, 1)),
+          rerank(rerankCount), trainSample(65536), iterations(20), seed(seed_val) {}
+
+    /**
+     * @brief Trains the coarse quantizer and the residual codebooks, then encodes every row.
+     *
+     * @param data Row-major buffer of m * n values.
+     * @param m Number of rows.
+     * @param n Number of columns.
+     * @param met Euclidean, Manhattan or Cosine (Cosine expects L2-normalised rows
+     *            and is searched with Euclidean distance).
+     * @throws runtime_error if the buffer size does not match m * n.
+     */
+    void build(const vector<double> &data, size_t m, size_t n, metric::Metric met = metric::Metric::Euclidean) {
+        train(data, m, n, met);
+        add(data, m);
+    }
+
+    /**
+     * @brief Trains the quantizers on a random sample of at most trainSample rows.
+     * @throws runtime_error if the buffer size does not match m * n.
+     */
+    void train(const vector<double> &data, size_t m, size_t n, metric::Metric met = metric::Metric::Euclidean) {
+        if (data.size() != m * n) {
+            throw runtime_error("IVFPQ: point buffer size does not match dimensions.");
+        }
+        clear();
+        dim = n;
+        metricType = met == metric::Metric::Manhattan ? metric::Metric::Manhattan : metric::Metric::Euclidean;
+        subDim = (dim + subspaces - 1) / subspaces;
+        if (m == 0 || dim == 0) {
+            return;
+        }
+
+        mt19937 rng(seed);
+        vector<size_t> order(m);
+        iota(order.begin(), order.end(), 0);
+        shuffle(order.begin(), order.end(), rng);
+        size_t s = min(m, trainSample);
+        vector<double> sample(s * dim);
+        for (size_t i = 0; i < s; i++) {
+            copy(&data[order[i] * dim], &data[order[i] * dim] + dim, &sample[i * dim]);
+        }
+
+        cellCount = min(nlist, s);
+        coarse = kmeans(sample, s, dim, cellCount, iterations, rng);
+        listIds.assign(cellCount, vector<uint32_t>());
+        listCodes.assign(cellCount, vector<uint8_t>());
+
+        // Residuals of the sample, padded to subspaces * subDim columns.
+        size_t padded = subspaces * subDim;
+        vector<double> residuals(s * padded, 0.0);
+        for (size_t i = 0; i < s; i++) {
+            size_t cell = nearestCell(&sample[i * dim]);
+            for (size_t j = 0; j < dim; j++) {
+                residuals[i * padded + j] = sample[i * dim + j] - coarse[cell * dim + j];
+            }
+        }
+
+        // A few dozen rows per codeword are enough for the residual codebooks.
+        codebooks.assign(subspaces * subDim * CODEBOOK_SIZE, 0.0);
+        size_t words = min(CODEBOOK_SIZE, s);
+        size_t subRows = min(s, CODEBOOK_SIZE * CODEBOOK_TRAIN_ROWS);
+        vector<double> sub(subRows * subDim);
+        for (size_t sp = 0; sp < subspaces; sp++) {
+            for (size_t i = 0; i < subRows; i++) {
+                copy(&residuals[i * padded + sp * subDim], &residuals[i * padded + (sp + 1) * subDim], &sub[i * subDim]);
+            }
+            vector<double> words_ = kmeans(sub, subRows, subDim, words, iterations, rng);
+            for (size_t c = 0; c < CODEBOOK_SIZE; c++) {
+                for (size_t d = 0; d < subDim; d++) {
+                    // Unused codewords are pushed far away so they are never chosen.
+                    codebooks[(sp * subDim + d) * CODEBOOK_SIZE + c] = c < words ? words_[c * subDim + d] : 1e150;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Encodes m rows and appends them; row i gets index firstId + i (default: count).
+     * @throws runtime_error if the index is not trained or the buffer size is wrong.
+     */
+    void add(const vector<double> &data, size_t m, size_t firstId = SIZE_MAX) {
+        if (m == 0) {
+            return;
+        }
+        if (coarse.empty() || data.size() != m * dim) {
+            throw runtime_error("IVFPQ: index not trained or point buffer size does not match dimensions.");
+        }
+        if (firstId == SIZE_MAX) {
+            firstId = count;
+        }
+        vector<uint32_t> cells(m);
+        vector<uint8_t> codes(m * subspaces);
+        handle::parallelFor(m, [&](size_t begin, size_t end) {
+            vector<double> residual(subspaces * subDim, 0.0);
+            vector<double> table(subspaces * CODEBOOK_SIZE);
+            for (size_t i = begin; i < end; i++) {
+                const double *row = &data[i * dim];
+                cells[i] = static_cast<uint32_t>(nearestCell(row));
+                for (size_t j = 0; j < dim; j++) {
+                    residual[j] = row[j] - coarse[cells[i] * dim + j];
+                }
+                // The nearest codeword per subspace is the argmin of its table row.
+                if (metricType == metric::Metric::Manhattan) {
+                    computeTable<metric::Manhattan>(residual.data(), table.data());
+                } else {
+                    computeTable<metric::Euclidean>(residual.data(), table.data());
+                }
+                for (size_t sp = 0; sp < subspaces; sp++) {
+                    const double *t = &table[sp * CODEBOOK_SIZE];
+                    codes[i * subspaces + sp] = static_cast<uint8_t>(min_element(t, t + CODEBOOK_SIZE) - t);
+                }
+            }
+        }, 256);
+        for (size_t i = 0; i < m; i++) {
+            listIds[cells[i]].push_back(static_cast<uint32_t>(firstId + i));
+            listCodes[cells[i]].insert(listCodes[cells[i]].end(), &codes[i * subspaces], &codes[(i + 1) * subspaces]);
+        }
+        count += m;
+    }
+
+    /**
+     * @brief Approximate k-nearest search.
+     *
+     * @param query Pointer to dim feature values.
+     * @param k Number of neighbours to return.
+     * @param out Filled with (reduced distance, row index), nearest first. Distances
+     *            are PQ estimates unless re-ranking is enabled.
+     * @param raw Row-major raw vectors used for re-ranking (nullptr disables it).
+     * @param skip Optional flag per row index; rows with a nonzero flag are never returned.
+     */
+    void query(const double *query, size_t k, vector<pair<double, size_t>> &out, const double *raw = nullptr,
+               const char *skip = nullptr) const {
+        out.clear();
+        if (count == 0 || k == 0) {
+            return;
+        }
+        if (metricType == metric::Metric::Manhattan) {
+            search<metric::Manhattan>(query, k, out, raw, skip);
+        } else {
+            search<metric::Euclidean>(query, k, out, raw, skip);
+        }
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    /**
+     * @brief Bytes held by the encoded rows (codes plus row indices).
+     */
+    size_t codeMemoryBytes() const {
+        return count * (subspaces + sizeof(uint32_t));
+    }
+
+    /**
+     * @brief Releases the index, keeping its parameters.
+     */
+    void clear() {
+        dim = subDim = count = cellCount = 0;
+        coarse.clear();
+        codebooks.clear();
+        listIds.clear();
+        listCodes.clear();
+    }
+
+    /**
+     * @brief Writes the trained quantizers and encoded lists to a binary stream.
+     */
+    void save(ostream &out) const {
+        out.write(MAGIC, 4);
+        uint64_t header[11] = {VERSION, dim, subDim, count, nlist, cellCount, nprobe, subspaces, rerank,
+                               static_cast<uint64_t>(metricType), seed};
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        handle::writeVector(out, coarse);
+        handle::writeVector(out, codebooks);
+        for (size_t l = 0; l < listIds.size(); l++) {
+            handle::writeVector(out, listIds[l]);
+            handle::writeVector(out, listCodes[l]);
+        }
+    }
+
+    /**
+     * @brief Loads an index written by save(), replacing the current one.
+     * @throws runtime_error if the stream does not hold a valid index.
+     */
+    void load(istream &in) {
+        char magic[4];
+        uint64_t header[11];
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (!in || memcmp(magic, MAGIC, 4) != 0 || header[0] != VERSION) {
+            throw runtime_error("Not a valid IVF-PQ index.");
+        }
+        dim = header[1];
+        subDim = header[2];
+        count = header[3];
+        nlist = header[4];
+        cellCount = header[5];
+        nprobe = header[6];
+        subspaces = header[7];
+        rerank = header[8];
+        metricType = static_cast<metric::Metric>(header[9]);
+        seed = static_cast<unsigned>(header[10]);
+        handle::readVector(in, coarse);
+        handle::readVector(in, codebooks);
+        listIds.assign(cellCount, vector<uint32_t>());
+        listCodes.assign(cellCount, vector<uint8_t>());
+        for (size_t l = 0; l < cellCount; l++) {
+            handle::readVector(in, listIds[l]);
+            handle::readVector(in, listCodes[l]);
+        }
+        if (!in || coarse.size() != cellCount * dim || codebooks.size() != subspaces * subDim * CODEBOOK_SIZE) {
+            throw runtime_error("Corrupt IVF-PQ index.");
+        }
+    }
+
+private:
+    static constexpr const char *MAGIC = "IVPQ";
+    static constexpr uint64_t VERSION = 2;
+
+    size_t nearestCell(const double *row) const {
+        size_t best = 0;
+        double bestDist = DBL_MAX;
+        for (size_t c = 0; c < cellCount; c++) {
+            double d = metricType == metric::Metric::Manhattan
+                           ? metric::Manhattan::reducedBounded(row, &coarse[c * dim], dim, bestDist)
+                           : metric::Euclidean::reducedBounded(row, &coarse[c * dim], dim, bestDist);
+            if (d < bestDist) {
+                bestDist = d;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    // Adds Dist::axis(r - codeword[c]) for all 256 codewords of one column.
+    template <class Dist>
+    static void addColumn(double r, const double *column, double *t) {
+        for (size_t c = 0; c < CODEBOOK_SIZE; c++) {
+            t[c] += Dist::axis(r - column[c]);
+        }
+    }
+
+    // Fills table[subspace * 256 + c] with the distance from the residual's
+    // subvector to codeword c. Codebooks are stored column-major per subspace,
+    // so every column update is a contiguous pass over 256 codewords.
+    template <class Dist>
+    void computeTable(const double *residual, double *table) const {
+        for (size_t sp = 0; sp < subspaces; sp++) {
+            double *t = &table[sp * CODEBOOK_SIZE];
+            fill(t, t + CODEBOOK_SIZE, 0.0);
+            for (size_t d = 0; d < subDim; d++) {
+                addColumn<Dist>(residual[sp * subDim + d], &codebooks[(sp * subDim + d) * CODEBOOK_SIZE], t);
+            }
+        }
+    }
+
+    template <class Dist>
+    void search(const double *q, size_t k, vector<pair<double, size_t>> &out, const double *raw,
+                const char *skip) const {
+        // Closest nprobe cells.
+        vector<pair<double, size_t>> cells(cellCount);
+        for (size_t c = 0; c < cellCount; c++) {
+            cells[c] = make_pair(Dist::reduced(q, &coarse[c * dim], dim), c);
+        }
+        size_t probes = min(nprobe, cellCount);
+        partial_sort(cells.begin(), cells.begin() + probes, cells.end());
+
+        bool rescore = raw != nullptr && rerank > 0;
+        size_t keep = rescore ? max(k, rerank) : k;
+        vector<double> residual(subspaces * subDim, 0.0);
+        vector<double> table(subspaces * CODEBOOK_SIZE);
+        out.reserve(keep);
+        for (size_t p = 0; p < probes; p++) {
+            size_t cell = cells[p].second;
+            const vector<uint32_t> &ids = listIds[cell];
+            if (ids.empty()) {
+                continue;
+            }
+            for (size_t j = 0; j < dim; j++) {
+                residual[j] = q[j] - coarse[cell * dim + j];
+            }
+            computeTable<Dist>(residual.data(), table.data());
+
+            const uint8_t *codes = listCodes[cell].data();
+            for (size_t i = 0; i < ids.size(); i++) {
+                if (skip != nullptr && skip[ids[i]]) {
+                    continue;
+                }
+                const uint8_t *code = codes + i * subspaces;
+                double d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0;
+                size_t sp = 0;
+                for (; sp + 4 <= subspaces; sp += 4) {
+                    d0 += table[sp * CODEBOOK_SIZE + code[sp]];
+                    d1 += table[(sp + 1) * CODEBOOK_SIZE + code[sp + 1]];
+                    d2 += table[(sp + 2) * CODEBOOK_SIZE + code[sp + 2]];
+                    d3 += table[(sp + 3) * CODEBOOK_SIZE + code[sp + 3]];
+                }
+                for (; sp < subspaces; sp++) {
+                    d0 += table[sp * CODEBOOK_SIZE + code[sp]];
+                }
+                metric::offerCandidate(out, keep, (d0 + d1) + (d2 + d3), ids[i]);
+            }
+        }
+
+        if (rescore) {
+            for (auto &cand : out) {
+                cand.first = Dist::reduced(q, raw + cand.second * dim, dim);
+            }
+            sort(out.begin(), out.end());
+            if (out.size() > k) {
+                out.resize(k);
+            }
+        } else {
+            sort_heap(out.begin(), out.end());
+        }
+    }
+
+    // Plain Lloyd's k-means used to train the quantizers (random distinct rows as seeds).
+    static vector<double> kmeans(const vector<double> &data, size_t m, size_t n, size_t k, int iters, mt19937 &rng) {
+        vector<double> centroids(k * n);
+        vector<size_t> seeds(m);
+        iota(seeds.begin(), seeds.end(), 0);
+        shuffle(seeds.begin(), seeds.end(), rng);
+        for (size_t c = 0; c < k; c++) {
+            copy(&data[seeds[c] * n], &data[seeds[c] * n] + n, &centroids[c * n]);
+        }
+        vector<uint32_t> assign(m);
+        for (int it = 0; it < iters; it++) {
+            handle::parallelFor(m, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    double bestDist = DBL_MAX;
+                    for (size_t c = 0; c < k; c++) {
+                        double d = metric::Euclidean::reducedBounded(&data[i * n], &centroids[c * n], n, bestDist);
+                        if (d < bestDist) {
+                            bestDist = d;
+                            assign[i] = static_cast<uint32_t>(c);
+                        }
+                    }
+                }
+            }, 256);
+            vector<double> sums(k * n, 0.0);
+            vector<size_t> counts(k, 0);
+            for (size_t i = 0; i < m; i++) {
+                counts[assign[i]]++;
+                for (size_t j = 0; j < n; j++) {
+                    sums[assign[i] * n + j] += data[i * n + j];
+                }
+            }
+            for (size_t c = 0; c < k; c++) {
+                if (counts[c] == 0) {
+                    // Re-seed an empty cluster from a random row.
+                    size_t r = rng() % m;
+                    copy(&data[r * n], &data[r * n] + n, &centroids[c * n]);
+                    continue;
+                }
+                for (size_t j = 0; j < n; j++) {
+                    centroids[c * n + j] = sums[c * n + j] / counts[c];
+                }
+            }
+        }
+        return centroids;
+    }
+};
+
+// Squared-L2 columns are the hot loop of every table; do them four codewords at a time.
+template <>
+inline void IVFPQ::addColumn<metric::Euclidean>(double r, const double *column, double *t) {
+    for (size_t c = 0; c < CODEBOOK_SIZE; c += 4) {
+        metric::vec4d w, acc;
+        memcpy(&w, column + c, sizeof(w));
+        memcpy(&acc, t + c, sizeof(acc));
+        metric::vec4d diff = r - w;
+        acc += diff * diff;
+        memcpy(t + c, &acc, sizeof(acc));
+    }
+}
+
+#endif // IVF_PQ_H
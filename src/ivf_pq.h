@@ -0,0 +1,86 @@
+#pragma once
+#ifndef IVF_PQ_H
+#define IVF_PQ_H
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <cstdint>
+#include "distance.h"
+
+class IVFPQ {
+public:
+    static constexpr size_t CODEBOOK_SIZE = 256;   // Codewords per subspace (one byte per code).
+
+    size_t nlist;                  // Requested number of coarse cells.
+    size_t nprobe;                 // Cells scanned per query.
+    size_t subspaces;              // PQ subspaces = bytes per encoded row.
+    size_t rerank;                 // Candidates re-scored exactly (0 disables re-ranking).
+    size_t trainSample;            // Rows sampled to train the quantizers.
+    int iterations;                // Lloyd iterations for every quantizer.
+    unsigned seed;                 // Seed for sampling and initialisation.
+
+    /**
+     * @brief Constructor for IVFPQ.
+     *
+     * @param lists Number of coarse cells (default: 256).
+     * @param probes Cells scanned per query (default: 8).
+     * @param subs PQ subspaces, i.e. bytes per row (default: 16).
+     * @param rerankCount Candidates re-scored on raw vectors, 0 to disable (default: 0).
+     * @param seed_val Random seed (default: 42).
+     */
+    IVFPQ(size_t lists = 256, size_t probes = 8, size_t subs = 16, size_t rerankCount = 0, unsigned seed_val = 42);
+
+    /**
+     * @brief Trains the coarse quantizer and residual codebooks, then encodes every row.
+     */
+    void build(const std::vector<double> &data, size_t m, size_t n,
+               metric::Metric met = metric::Metric::Euclidean);
+
+    /**
+     * @brief Trains the quantizers on a sample of at most trainSample rows.
+     */
+    void train(const std::vector<double> &data, size_t m, size_t n,
+               metric::Metric met = metric::Metric::Euclidean);
+
+    /**
+     * @brief Encodes m rows and appends them to their inverted lists.
+     */
+    void add(const std::vector<double> &data, size_t m, size_t firstId = SIZE_MAX);
+
+    /**
+     * @brief Approximate k-nearest search over the nprobe closest cells.
+     *
+     * @param out Filled with (reduced distance, row index), nearest first.
+     * @param raw Row-major raw vectors for exact re-ranking (nullptr disables it).
+     * @param skip Optional flag per row index; flagged rows are never returned.
+     */
+    void query(const double *query, size_t k, std::vector<std::pair<double, size_t>> &out,
+               const double *raw = nullptr, const char *skip = nullptr) const;
+
+    bool empty() const;
+    size_t size() const;
+    size_t codeMemoryBytes() const;
+
+    /**
+     * @brief Releases the index, keeping its parameters.
+     */
+    void clear();
+
+    /**
+     * @brief Writes / loads the quantizers and encoded lists as a binary stream.
+     */
+    void save(std::ostream &out) const;
+    void load(std::istream &in);
+
+    size_t dim;                                  // Number of features per row.
+    size_t subDim;                               // Columns per subspace (last one zero-padded).
+    size_t count;                                // Number of encoded rows.
+    metric::Metric metricType;                   // Metric used by query().
+    std::vector<double> coarse;                  // Coarse centroids, row-major.
+    std::vector<double> codebooks;               // Codewords, [subspace][column][codeword].
+    std::vector<std::vector<uint32_t>> listIds;  // Row index of every entry, per cell.
+    std::vector<std::vector<uint8_t>> listCodes; // Codes of every entry, per cell.
+};
+
+#endif // IVF_PQ_H
@@ -8,8 +8,17 @@
 #include <cmath>
 #include <cfloat>
 #include <algorithm>
+#include <random>
+#include <type_traits>
+#include <functional>
+#include <memory>
+#include <deque>
 #include "base.h"             // Assumes Model is defined here.
 #include "data_handling.h"
+#include "distance.h"
+#include "parallel.h"
+#include "kd_tree.cpp"
+#include "ball_tree.cpp"
 #include <gnuplot-iostream.h>
 
 
@@ -19,11 +28,70 @@ using namespace std;
 
 class KMeans : public Model {
 public:
+    // How train() picks the initial centroids.
+    enum class Init {
+        First,           // The first k rows (poor when the data is sorted).
+        KMeansPlusPlus,  // k-means++: D^2 sampling, one centroid at a time.
+        KMeansParallel   // k-means||: oversampled parallel rounds, then k-means++ on the weighted candidates.
+    };
+
+    // How train() finds the nearest centroid of every row in each iteration.
+    enum class Algorithm {
+        Auto,     // Elkan or Hamerly, from k and the dimension (see chooseAlgorithm()).
+        Lloyd,    // Every row against every centroid.
+        Elkan,    // Triangle-inequality bounds: k lower bounds per row plus centroid pair distances.
+        Hamerly,  // Triangle-inequality bounds: one lower bound per row.
+        MiniBatch // Per-centroid learning-rate updates on random batches (approximate; never chosen by Auto).
+    };
+
+    // Row source for fitStream(): writes up to maxRows rows of dim values to
+    // out and returns how many it wrote; 0 ends the stream.
+    typedef function<size_t(double *out, size_t maxRows)> RowSource;
+
+    // Auto uses Elkan from this many dimensions and clusters on...
+    static constexpr size_t ELKAN_MIN_DIMS = 20;
+    static constexpr size_t ELKAN_MIN_K = 8;
+    // ...as long as its m * k lower bounds stay below this many values.
+    static constexpr size_t ELKAN_MAX_BOUNDS = size_t(1) << 26;
+    // Rows per block of the parallel assign-and-update pass.
+    static constexpr size_t UPDATE_GRAIN = 2048;
+    // Prediction indexes the centroids from this many on (a scan is faster below)...
+    static constexpr size_t INDEX_MIN_K = 128;
+    // ...with a KD-tree up to KD_TREE_MAX_DIMS dimensions and a ball tree from
+    // BALL_TREE_MIN_DIMS to BALL_TREE_MAX_DIMS. In between, and above, neither
+    // prunes enough to beat the scan's tight loop.
+    static constexpr size_t KD_TREE_MAX_DIMS = 10;
+    static constexpr size_t BALL_TREE_MIN_DIMS = 32;
+    static constexpr size_t BALL_TREE_MAX_DIMS = 100;
+    // Rows per block of the parallel prediction pass.
+    static constexpr size_t PREDICT_GRAIN = 256;
+
     int k;                       // Number of clusters.
     int maxIterations;           // Maximum number of iterations.
     double tol;                  // Tolerance for centroid movement.
-    vector<vector<double>> centroids; // Current centroids.
+    vector<vector<double>> centroids; // Current centroids (call publishCentroids() after editing them by hand).
     vector<int> assignments;          // Cluster index assignment for each data point.
+    metric::Metric distanceMetric = metric::Metric::Euclidean; // Distance used to assign points.
+    int minkowskiP = 2;               // Exponent when distanceMetric is Minkowski.
+    Init init = Init::KMeansPlusPlus; // Seeding strategy.
+    unsigned long long seed = 42;     // Seed of every random choice, so runs are reproducible.
+    int parallelRounds = 5;           // k-means|| sampling rounds.
+    double oversampling = 2.0;        // k-means|| expected candidates per round, as a multiple of k.
+    Algorithm algorithm = Algorithm::Auto;       // Requested assignment strategy.
+    Algorithm usedAlgorithm = Algorithm::Lloyd;  // Strategy the last train() ran.
+    size_t distanceEvaluations = 0;   // Distances computed by the last train()'s iterations (all restarts).
+    int nInit = 1;                    // Seeded restarts run concurrently; the lowest-inertia one is kept.
+    double inertia = 0.0;             // Sum of squared distances from the rows to their centroids (kept run).
+    int iterations = 0;               // Iterations of the kept run.
+    vector<double> runInertia;        // Inertia of every restart of the last fit, in seed order.
+    vector<int> runIterations;        // Iterations of every restart of the last fit.
+    double decay = 1.0;               // partialFit(): weight the past keeps per batch (1 = mean of all rows seen).
+    size_t windowBatches = 0;         // partialFit(): if > 0, cluster only the coresets of this many recent batches.
+    size_t batchSize = 1024;          // Rows per mini-batch.
+    double inertiaSmoothing = 0.1;    // Weight of the newest batch in the smoothed mini-batch inertia.
+    int maxNoImprovement = 10;        // Mini-batch stops after this many batches without a lower smoothed inertia.
+    size_t batchesRun = 0;            // Mini-batches processed by the last mini-batch fit.
+    bool verbose = true;              // Print training progress (iterations, every 100th mini-batch).
 
     /**
      * @brief Computes the Euclidean distance between two points.
@@ -32,13 +100,32 @@ public:
      * @param b Second point as a vector of doubles.
      * @return The Euclidean distance.
      */
-    double euclideanDistance(vector<double>& a, vector<double>& b) {
-        double sum = 0.0;
-        for (size_t i = 0; i < a.size(); i++) {
-            double diff = a[i] - b[i];
-            sum += diff * diff;
+    double euclideanDistance(const vector<double>& a, const vector<double>& b) const {
+        return metric::Euclidean::fromReduced(metric::Euclidean::reduced(a.data(), b.data(), min(a.size(), b.size())));
+    }
+
+    /**
+     * @brief Index of the centroid nearest to a point.
+     *
+     * Compares reduced distances (squared for Euclidean), so no square root
+     * or power is taken per comparison; Dist is a metric:: policy, possibly
+     * specialised for the dimension, chosen once per train()/predict() call.
+     *
+     * @param point dim values.
+     * @param centers Row-major buffer of count * dim centroid values.
+     */
+    template <class Dist>
+    static int nearestCentroid(const double *point, const double *centers, size_t count, size_t dim) {
+        double minDist = DBL_MAX;
+        int bestCluster = -1;
+        for (size_t cluster = 0; cluster < count; cluster++) {
+            double dist = Dist::reduced(point, centers + cluster * dim, dim);
+            if (dist < minDist) {
+                minDist = dist;
+                bestCluster = static_cast<int>(cluster);
+            }
         }
-        return sqrt(sum);
+        return bestCluster;
     }
 
     /**
@@ -59,11 +146,13 @@ public:
      * @brief Clusters the data using k-Means and stores the final assignments.
      * 
      * The algorithm converts feature values and the target into a numerical point
-     * in an augmented space (features plus target), initializes centroids as the first k
-     * points, and iteratively refines cluster assignments and centroid locations.
+     * in an augmented space (features plus target), seeds the centroids as chosen
+     * by `init`, and iteratively refines cluster assignments and centroid locations.
+     * Points are assigned by distanceMetric, whose kernel is selected once per call.
      * 
      * @param data The dataset to cluster.
      * @throws runtime_error if data is empty, inconsistent, or if k is larger than the number of data points.
+     * @throws invalid_argument for an unsupported Minkowski exponent.
      */
     void* train(handle::Data &data) override {
         size_t m = data.features.size();  // number of data points
@@ -76,92 +165,1502 @@ public:
         size_t dim = originalDim + 1;  // combine features and target
 
         // Convert features from string to double and include the target column.
-        vector<vector<double>> points(m, vector<double>(dim, 0.0));
+        // Rows are stored contiguously (row-major) so the distance kernels stream through them.
+        vector<double> points(m * dim, 0.0);
         for (size_t i = 0; i < m; i++) {
             if (data.features[i].size() != originalDim) {
                 throw runtime_error("Inconsistent feature dimensions in data.");
             }
             // Convert the feature columns.
             for (size_t j = 0; j < originalDim; j++) {
-                std::string temp = data.features[i][j];
-                points[i][j] = handle::toDouble(temp);
+                points[i * dim + j] = handle::toDouble(data.features[i][j]);
             }
             // Append the target column (treated as a feature) at the end.
-            points[i][dim - 1] = handle::toDouble(data.target[i]);
+            points[i * dim + dim - 1] = handle::toDouble(data.target[i]);
+        }
+        fit(points, m, dim);
+        vector<int> params = assignments; // Return assignments as a vector of integers.
+        return static_cast<void*>(new vector<int>(params)); // Return as void pointer.
+    }
+
+    /**
+     * @brief Clusters m row-major points of dim values (no target column is appended).
+     *
+     * Stores the centroids and the assignment of every row, like train().
+     * With sample weights, seeding, centroid means and inertia all weigh
+     * row i by weights[i], so a weighted summary such as a coreset (see
+     * CoresetBuilder) stands in for the rows it summarises.
+     *
+     * @param weights Non-negative weight per row, or empty for weight 1.
+     * @throws runtime_error if the buffer is empty or its size does not match, or if k > m.
+     * @throws invalid_argument for an unsupported Minkowski exponent, negative
+     *         weights, or weights with Algorithm::MiniBatch.
+     */
+    void fit(const vector<double> &points, size_t m, size_t dim, const vector<double> &weights = {}) {
+        if (m == 0) {
+            throw runtime_error("No data available for clustering.");
+        }
+        if (points.size() != m * dim) {
+            throw runtime_error("Point buffer size does not match dimensions.");
         }
-        
         // Ensure that k is not greater than the number of points.
         if (k > m) {
             throw runtime_error("k cannot be greater than the number of data points.");
         }
-        
-        // Initialize centroids: choose the first k points as initial centroids.
-        centroids.assign(points.begin(), points.begin() + k);
-        // Initialize assignments container.
-        assignments.assign(m, -1);
-        
-        for (int iter = 0; iter < maxIterations; iter++) {
-            bool assignmentChanged = false;
-            
-            // Step 1: Assign each point to the nearest centroid.
+        metric::checkMetric(distanceMetric, minkowskiP);
+        if (!weights.empty()) {
+            if (weights.size() != m) {
+                throw runtime_error("Sample weight count does not match the number of points.");
+            }
+            if (algorithm == Algorithm::MiniBatch) {
+                throw invalid_argument("Mini-batch KMeans does not take sample weights.");
+            }
+            for (double w : weights) {
+                if (!(w >= 0.0)) {
+                    throw invalid_argument("Sample weights must be non-negative.");
+                }
+            }
+        }
+        const double *rowWeights = weights.empty() ? nullptr : weights.data();
+        resetOnline();
+        if (algorithm == Algorithm::MiniBatch) {
+            fitMiniBatch(points, m, dim);
+            return;
+        }
+        const vector<double> *rows = &points;
+        vector<double> normalized;
+        if (distanceMetric == metric::Metric::Cosine) {
+            normalized = points;
+            metric::normalizeRows(normalized.data(), m, dim);
+            rows = &normalized;
+        }
+
+        // Run the restarts side by side on the shared rows; the threads are
+        // split between them.
+        size_t restarts = static_cast<size_t>(max(nInit, 1));
+        size_t concurrent = min<size_t>(restarts, handle::numThreads());
+        size_t threads = max<size_t>(1, handle::numThreads() / concurrent);
+        usedAlgorithm = chooseAlgorithm(m, dim, concurrent);
+        vector<Run> runs(restarts);
+        metric::withKernel(distanceMetric, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            handle::parallelFor(restarts, [&](size_t r0, size_t r1) {
+                for (size_t r = r0; r < r1; r++) {
+                    // Initialize centroids with the chosen seeding, then refine them.
+                    runs[r].centers = seedCentroids<Dist>(rows->data(), rowWeights, m, dim, k, restartSeed(r), threads);
+                    lloyd<Dist>(*rows, rowWeights, m, dim, runs[r], threads, verbose && restarts == 1);
+                }
+            });
+        });
+
+        size_t best = 0;
+        distanceEvaluations = 0;
+        runInertia.clear();
+        runIterations.clear();
+        for (size_t r = 0; r < restarts; r++) {
+            runInertia.push_back(runs[r].inertia);
+            runIterations.push_back(runs[r].iterations);
+            distanceEvaluations += runs[r].evaluations;
+            if (runs[r].inertia < runs[best].inertia) {
+                best = r;
+            }
+        }
+        inertia = runs[best].inertia;
+        iterations = runs[best].iterations;
+        assignments.swap(runs[best].assignments);
+        centroids.assign(k, vector<double>(dim));
+        for (int cluster = 0; cluster < k; cluster++) {
+            copy(&runs[best].centers[cluster * dim], &runs[best].centers[(cluster + 1) * dim],
+                 centroids[cluster].begin());
+        }
+        publishCentroids();
+    }
+
+    /**
+     * @brief Seed of restart r; restart 0 uses `seed` itself.
+     */
+    unsigned long long restartSeed(size_t r) const {
+        return seed + r * 0x9E3779B97F4A7C15ULL;
+    }
+
+    // Mean silhouette of a clustering, with a 95% confidence interval when sampled.
+    struct Silhouette {
+        double mean = 0.0;
+        double low = 0.0;     // Interval bounds; equal to mean when computed exactly.
+        double high = 0.0;
+        size_t rows = 0;      // Rows whose silhouette was computed.
+    };
+
+    // Scores of sweepK() for every k from kMin to kMax, in order.
+    struct KSweep {
+        vector<int> k;
+        vector<double> inertia;
+        vector<int> iterations;
+        vector<Silhouette> silhouette;
+        int elbowK = 0;       // Knee of the inertia curve.
+        int bestK = 0;        // Highest mean silhouette.
+    };
+
+    /**
+     * @brief Clusters the rows for every k in [kMin, kMax] and scores each clustering.
+     *
+     * The sweep is warm-started: the solution for k plus one more row drawn
+     * k-means++ style (proportional to its squared distance to those
+     * centroids) seeds k + 1, so every step only refines. Only kMin is seeded
+     * with `init`; nInit is ignored. The elbow is the k whose (normalised)
+     * inertia lies farthest below the chord from kMin to kMax. Silhouettes
+     * are exact with silhouetteSample = 0 (O(m^2 * dim) per k, blocked and
+     * parallel), otherwise estimated from a stratified sample of that many
+     * rows (O(sample * m * dim) per k) with a 95% confidence interval.
+     * The model itself is not changed.
+     *
+     * @throws runtime_error for a bad buffer or k range.
+     */
+    KSweep sweepK(const vector<double> &points, size_t m, size_t dim, int kMin, int kMax,
+                  size_t silhouetteSample = 0) const {
+        if (points.size() != m * dim || m == 0) {
+            throw runtime_error("Point buffer size does not match dimensions.");
+        }
+        if (kMin < 1 || kMax < kMin || static_cast<size_t>(kMax) > m) {
+            throw runtime_error("Invalid k range for the sweep.");
+        }
+        metric::checkMetric(distanceMetric, minkowskiP);
+        const vector<double> *rows = &points;
+        vector<double> normalized;
+        if (distanceMetric == metric::Metric::Cosine) {
+            normalized = points;
+            metric::normalizeRows(normalized.data(), m, dim);
+            rows = &normalized;
+        }
+
+        bool cosine = distanceMetric == metric::Metric::Cosine;
+        KSweep sweep;
+        KMeans step(*this);
+        metric::withKernel(distanceMetric, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            mt19937_64 rng(seed);
+            vector<double> centers = seedCentroids<Dist>(rows->data(), nullptr, m, dim, kMin, seed,
+                                                         handle::numThreads());
+            vector<double> closest(m);
+            for (int kk = kMin; kk <= kMax; kk++) {
+                if (kk > kMin) {
+                    // Warm start: the previous centroids plus one k-means++ draw.
+                    handle::parallelFor(m, [&](size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; i++) {
+                            int c = nearestCentroid<Dist>(&(*rows)[i * dim], centers.data(), kk - 1, dim);
+                            closest[i] = squaredDistance<Dist>(&(*rows)[i * dim], &centers[c * dim], dim);
+                        }
+                    }, 1024);
+                    size_t pick = drawRow(closest, nullptr, m, rng, false);
+                    centers.insert(centers.end(), &(*rows)[pick * dim], &(*rows)[(pick + 1) * dim]);
+                }
+                step.k = kk;
+                step.usedAlgorithm = step.chooseAlgorithm(m, dim);
+                Run run;
+                run.centers = centers;
+                step.lloyd<Dist>(*rows, nullptr, m, dim, run, handle::numThreads(), false);
+                centers = run.centers;
+                sweep.k.push_back(kk);
+                sweep.inertia.push_back(run.inertia);
+                sweep.iterations.push_back(run.iterations);
+                sweep.silhouette.push_back(silhouetteOf<Dist>(rows->data(), m, dim, run.assignments, kk,
+                                                              silhouetteSample, seed + kk, cosine));
+            }
+        });
+
+        // Elbow: largest drop below the chord of the min-max normalised curve.
+        size_t n = sweep.k.size();
+        sweep.elbowK = sweep.k[0];
+        double span = sweep.inertia[0] - sweep.inertia[n - 1];
+        double deepest = 0.0;
+        for (size_t i = 1; n > 2 && span > 0.0 && i + 1 < n; i++) {
+            double x = static_cast<double>(i) / (n - 1);
+            double y = (sweep.inertia[i] - sweep.inertia[n - 1]) / span;
+            if (1.0 - x - y > deepest) {
+                deepest = 1.0 - x - y;
+                sweep.elbowK = sweep.k[i];
+            }
+        }
+        sweep.bestK = sweep.k[0];
+        double best = -DBL_MAX;
+        for (size_t i = 0; i < n; i++) {
+            if (sweep.k[i] > 1 && sweep.silhouette[i].mean > best) {
+                best = sweep.silhouette[i].mean;
+                sweep.bestK = sweep.k[i];
+            }
+        }
+        return sweep;
+    }
+
+    /**
+     * @brief Mean silhouette of `labels` (clusters 0..clusters-1) over m row-major rows.
+     *
+     * s(i) = (b - a) / max(a, b), where a is the mean distance from row i to
+     * the other rows of its cluster and b the smallest mean distance to
+     * another cluster; rows alone in their cluster score 0. With sample = 0
+     * (or sample >= m) every row is scored against every row. Otherwise
+     * each cluster contributes rows in proportion to its size (at least two
+     * where it has them), each sampled row is still scored exactly against
+     * all m rows, and the stratified mean comes with a 95% normal interval
+     * (including the finite-population correction).
+     */
+    Silhouette silhouetteScore(const vector<double> &points, size_t m, size_t dim, const vector<int> &labels,
+                               size_t sample = 0) const {
+        if (points.size() != m * dim || labels.size() != m || m == 0) {
+            throw runtime_error("Point buffer size does not match dimensions.");
+        }
+        metric::checkMetric(distanceMetric, minkowskiP);
+        const vector<double> *rows = &points;
+        vector<double> normalized;
+        if (distanceMetric == metric::Metric::Cosine) {
+            normalized = points;
+            metric::normalizeRows(normalized.data(), m, dim);
+            rows = &normalized;
+        }
+        int clusters = *max_element(labels.begin(), labels.end()) + 1;
+        Silhouette score;
+        metric::withKernel(distanceMetric, minkowskiP, dim, [&](auto kernel) {
+            score = silhouetteOf<decltype(kernel)>(rows->data(), m, dim, labels, clusters, sample, seed,
+                                                   distanceMetric == metric::Metric::Cosine);
+        });
+        return score;
+    }
+
+    // Rows per query block and per column tile of the silhouette kernel.
+    static constexpr size_t SILHOUETTE_BLOCK = 32;
+    static constexpr size_t SILHOUETTE_TILE = 512;
+
+    // Silhouette kernel over rows already prepared for Dist (normalised for
+    // cosine, whose distance 1 - cos is half the squared chord).
+    template <class Dist>
+    static Silhouette silhouetteOf(const double *points, size_t m, size_t dim, const vector<int> &labels,
+                                   int clusters, size_t sample, unsigned long long seedValue, bool cosine) {
+        vector<size_t> size(clusters, 0);
+        for (int c : labels) {
+            size[c]++;
+        }
+
+        // Rows to score, grouped by cluster.
+        vector<vector<size_t>> members(clusters);
+        bool exact = sample == 0 || sample >= m;
+        if (exact) {
+            for (size_t i = 0; i < m; i++) {
+                members[labels[i]].push_back(i);
+            }
+        } else {
+            vector<vector<size_t>> all(clusters);
             for (size_t i = 0; i < m; i++) {
-                double minDist = DBL_MAX;
-                int bestCluster = -1;
-                for (int cluster = 0; cluster < k; cluster++) {
-                    double dist = euclideanDistance(points[i], centroids[cluster]);
-                    if (dist < minDist) {
-                        minDist = dist;
-                        bestCluster = cluster;
+                all[labels[i]].push_back(i);
+            }
+            mt19937_64 rng(seedValue);
+            for (int c = 0; c < clusters; c++) {
+                size_t want = (sample * size[c] + m - 1) / m;
+                want = min(size[c], max<size_t>(want, 2));
+                // Partial Fisher-Yates shuffle: the first `want` rows are a uniform sample.
+                for (size_t j = 0; j < want; j++) {
+                    swap(all[c][j], all[c][j + uniform_int_distribution<size_t>(0, size[c] - 1 - j)(rng)]);
+                }
+                members[c].assign(all[c].begin(), all[c].begin() + want);
+            }
+        }
+        vector<size_t> scored;
+        for (auto &group : members) {
+            scored.insert(scored.end(), group.begin(), group.end());
+        }
+
+        // Sum of distances from every scored row to every cluster, blocked so a
+        // tile of rows stays in cache for a block of scored rows.
+        vector<double> value(scored.size());
+        size_t blocks = (scored.size() + SILHOUETTE_BLOCK - 1) / SILHOUETTE_BLOCK;
+        handle::parallelFor(blocks, [&](size_t b0, size_t b1) {
+            vector<double> sums(SILHOUETTE_BLOCK * clusters);
+            for (size_t b = b0; b < b1; b++) {
+                size_t first = b * SILHOUETTE_BLOCK;
+                size_t count = min(SILHOUETTE_BLOCK, scored.size() - first);
+                fill(sums.begin(), sums.end(), 0.0);
+                for (size_t tile = 0; tile < m; tile += SILHOUETTE_TILE) {
+                    size_t tileEnd = min(m, tile + SILHOUETTE_TILE);
+                    for (size_t q = 0; q < count; q++) {
+                        const double *row = points + scored[first + q] * dim;
+                        double *sum = &sums[q * clusters];
+                        for (size_t j = tile; j < tileEnd; j++) {
+                            double r = Dist::reduced(row, points + j * dim, dim);
+                            sum[labels[j]] += cosine ? 0.5 * r : Dist::fromReduced(r);
+                        }
                     }
                 }
-                if (assignments[i] != bestCluster) {
-                    assignments[i] = bestCluster;
-                    assignmentChanged = true;
+                for (size_t q = 0; q < count; q++) {
+                    size_t i = scored[first + q];
+                    int own = labels[i];
+                    if (size[own] <= 1) {
+                        value[first + q] = 0.0;
+                        continue;
+                    }
+                    const double *sum = &sums[q * clusters];
+                    double a = sum[own] / (size[own] - 1);
+                    double bNear = DBL_MAX;
+                    for (int c = 0; c < clusters; c++) {
+                        if (c != own && size[c] > 0) {
+                            bNear = min(bNear, sum[c] / size[c]);
+                        }
+                    }
+                    double denom = max(a, bNear);
+                    value[first + q] = bNear == DBL_MAX || denom <= 0.0 ? 0.0 : (bNear - a) / denom;
                 }
             }
-            
-            // Step 2: Update centroids based on current assignments.
-            vector<vector<double>> newCentroids(k, vector<double>(dim, 0.0));
-            vector<int> counts(k, 0);
-            for (size_t i = 0; i < m; i++) {
-                int cluster = assignments[i];
-                counts[cluster]++;
-                for (size_t j = 0; j < dim; j++) {
-                    newCentroids[cluster][j] += points[i][j];
+        });
+
+        // Stratified mean and variance (exact scoring has no sampling error).
+        Silhouette score;
+        score.rows = scored.size();
+        double variance = 0.0;
+        size_t offset = 0;
+        for (int c = 0; c < clusters; c++) {
+            size_t n = members[c].size();
+            if (n == 0) {
+                continue;
+            }
+            double mean = 0.0, squares = 0.0;
+            for (size_t j = 0; j < n; j++) {
+                mean += value[offset + j];
+            }
+            mean /= n;
+            for (size_t j = 0; j < n; j++) {
+                squares += (value[offset + j] - mean) * (value[offset + j] - mean);
+            }
+            double share = static_cast<double>(size[c]) / m;
+            score.mean += share * mean;
+            if (!exact && n > 1) {
+                double fpc = 1.0 - static_cast<double>(n) / size[c];
+                variance += share * share * (squares / (n - 1)) / n * fpc;
+            }
+            offset += n;
+        }
+        double half = 1.96 * sqrt(variance);
+        score.low = score.mean - half;
+        score.high = score.mean + half;
+        return score;
+    }
+
+    /**
+     * @brief Mini-batch k-means over an in-memory buffer.
+     *
+     * Runs up to maxIterations epochs of m / batchSize batches, each drawn
+     * uniformly at random (with replacement), and stops early once the
+     * smoothed batch inertia has not improved for maxNoImprovement batches.
+     * Only one batch is copied at a time; the final assignment of every row
+     * is computed in one parallel pass at the end.
+     */
+    void fitMiniBatch(const vector<double> &points, size_t m, size_t dim) {
+        mt19937_64 rng(seed);
+        uniform_int_distribution<size_t> pick(0, m - 1);
+        size_t epochBatches = (m + batchSize - 1) / batchSize;
+        size_t batchLimit = static_cast<size_t>(max(maxIterations, 1)) * epochBatches;
+        size_t drawn = 0;
+        RowSource sample = [&](double *out, size_t maxRows) -> size_t {
+            if (drawn >= batchLimit) {
+                return 0;
+            }
+            drawn++;
+            for (size_t r = 0; r < maxRows; r++) {
+                size_t i = pick(rng);
+                copy(&points[i * dim], &points[(i + 1) * dim], out + r * dim);
+            }
+            return maxRows;
+        };
+        runMiniBatch(sample, dim, rng);
+
+        // Final assignment of every row, and its inertia.
+        usedAlgorithm = Algorithm::MiniBatch;
+        assignments.assign(m, 0);
+        vector<double> centers = flatCentroids();
+        size_t blocks = min<size_t>(handle::numThreads(), max<size_t>(1, m / UPDATE_GRAIN));
+        size_t step = (m + blocks - 1) / blocks;
+        vector<double> blockCost(blocks, 0.0);
+        metric::withKernel(distanceMetric, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            handle::parallelFor(blocks, [&](size_t b0, size_t b1) {
+                vector<double> row(dim);
+                for (size_t b = b0; b < b1; b++) {
+                    for (size_t i = b * step; i < min(m, (b + 1) * step); i++) {
+                        copy(&points[i * dim], &points[(i + 1) * dim], row.begin());
+                        if (distanceMetric == metric::Metric::Cosine) {
+                            metric::normalizeRows(row.data(), 1, dim);
+                        }
+                        int c = nearestCentroid<Dist>(row.data(), centers.data(), k, dim);
+                        assignments[i] = c;
+                        blockCost[b] += squaredDistance<Dist>(row.data(), &centers[c * dim], dim);
+                    }
                 }
+            });
+        });
+        distanceEvaluations += m * k;
+        inertia = 0.0;
+        for (double cost : blockCost) {
+            inertia += cost;
+        }
+        iterations = static_cast<int>(batchesRun);
+        runInertia.assign(1, inertia);
+        runIterations.assign(1, iterations);
+        publishCentroids();
+    }
+
+    /**
+     * @brief Mini-batch k-means over a stream of rows that need not fit in memory.
+     *
+     * Memory stays at a few batches of rows whatever the stream length. The
+     * first max(batchSize, 3k) rows seed the centroids with `init` and are
+     * then used as the first batches. The fit ends when the source is
+     * exhausted or the smoothed inertia stops improving; assignments and
+     * inertia are not kept (nothing is left to measure them on).
+     *
+     * @param source Fills batches of dim-value rows (see RowSource).
+     * @param dim Number of values per row.
+     * @throws runtime_error if the stream has fewer than k rows.
+     */
+    void fitStream(const RowSource &source, size_t dim) {
+        metric::checkMetric(distanceMetric, minkowskiP);
+        resetOnline();
+        mt19937_64 rng(seed);
+        runMiniBatch(source, dim, rng);
+        usedAlgorithm = Algorithm::MiniBatch;
+        assignments.clear();
+        inertia = 0.0;
+        iterations = static_cast<int>(batchesRun);
+        runInertia.clear();
+        runIterations.clear();
+        publishCentroids();
+    }
+
+    /**
+     * @brief Online (sequential) k-means: updates the centroids with one batch of rows.
+     *
+     * Rows are buffered until max(batchSize, 3k) have arrived and seeded
+     * with `init`; from then on every call costs O(count * k * dim). Each
+     * centroid keeps a weight that is multiplied by `decay` per batch, and
+     * each row moves its centroid by 1 / weight, so decay < 1 forgets old
+     * data with a horizon of about 1 / (1 - decay) batches.
+     *
+     * With windowBatches > 0 every batch is summarised instead by a coreset
+     * of at most k weighted points (the means of its rows per centroid, with
+     * their counts), and the centroids are refitted by weighted Lloyd on the
+     * coresets of the last windowBatches batches (older coresets decayed),
+     * which costs O(windowBatches * k * k * dim) more per call.
+     *
+     * Once the first call has returned, one writer may keep calling
+     * partialFit() while any number of threads call predict() or
+     * predictSingle(): each update publishes a new immutable centroid
+     * snapshot, so readers see the centroids of one batch or the next, never
+     * a mix (and "not trained" until the seed). getCentroids() and
+     * `centroids` are updated too but are not safe to read concurrently.
+     *
+     * @param rows count row-major rows of dim values.
+     * @throws runtime_error if the buffer size or dim does not match the earlier batches.
+     * @throws invalid_argument for an unsupported Minkowski exponent.
+     */
+    void partialFit(const vector<double> &rows, size_t count, size_t dim) {
+        metric::checkMetric(distanceMetric, minkowskiP);
+        if (rows.size() != count * dim || dim == 0) {
+            throw runtime_error("Point buffer size does not match dimensions.");
+        }
+        if (online.dim != 0 && online.dim != dim) {
+            throw runtime_error("Batch dimension does not match the online model.");
+        }
+        online.dim = dim;
+        if (!atomic_load(&snapshot)) {
+            // From now on readers only look at snapshots.
+            atomic_store(&snapshot, make_shared<const Snapshot>());
+        }
+        if (count == 0) {
+            return;
+        }
+        vector<double> normalized;
+        const double *batch = rows.data();
+        if (distanceMetric == metric::Metric::Cosine) {
+            normalized = rows;
+            metric::normalizeRows(normalized.data(), count, dim);
+            batch = normalized.data();
+        }
+
+        metric::withKernel(distanceMetric, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            if (online.centers.empty()) {
+                // Not seeded yet: buffer, and seed once enough rows have arrived.
+                online.pending.insert(online.pending.end(), batch, batch + count * dim);
+                size_t have = online.pending.size() / dim;
+                if (have < max(batchSize, static_cast<size_t>(3 * k))) {
+                    return;
+                }
+                online.centers = seedCentroids<Dist>(online.pending.data(), nullptr, have, dim, k, seed,
+                                                     handle::numThreads());
+                online.seen.assign(k, 0.0);
+                // The buffered rows become the first batch.
+                normalized.swap(online.pending);
+                online.pending = vector<double>();
+                batch = normalized.data();
+                count = have;
+            }
+            online.nearest.resize(count);
+            online.rowCost.resize(count);
+            if (windowBatches == 0) {
+                for (double &w : online.seen) {
+                    w *= decay;
+                }
+                miniBatchStep<Dist>(batch, count, dim, online.centers, online.seen, online.nearest, online.rowCost);
+            } else {
+                slideWindow<Dist>(batch, count, dim);
             }
-            // Compute the mean for each centroid.
+            batchesRun++;
+
+            centroids.assign(k, vector<double>(dim));
             for (int cluster = 0; cluster < k; cluster++) {
-                if (counts[cluster] == 0) {
-                    // No points assigned to this centroid; retain the old centroid.
-                    newCentroids[cluster] = centroids[cluster];
-                } else {
-                    for (size_t j = 0; j < dim; j++) {
-                        newCentroids[cluster][j] /= counts[cluster];
+                copy(&online.centers[cluster * dim], &online.centers[(cluster + 1) * dim], centroids[cluster].begin());
+            }
+            publishCentroids();
+        });
+    }
+
+    // How a snapshot finds the nearest centroid.
+    enum class CentroidSearch {
+        Scan,     // Every centroid.
+        KDTree,   // KD-tree over the centroids.
+        BallTree  // Ball tree over the centroids.
+    };
+
+    // Centroids published for prediction (and for concurrent readers of partialFit()).
+    struct Snapshot {
+        vector<double> centers;  // count * dim
+        size_t dim = 0;
+        size_t count = 0;
+        CentroidSearch search = CentroidSearch::Scan;
+        KDTree kdTree;           // Built when search is KDTree.
+        BallTree ballTree;       // Built when search is BallTree.
+    };
+
+    /**
+     * @brief Publishes `centroids` for predict(), predictSingle() and predictRows().
+     *
+     * Every fit publishes its centroids, together with a KD-tree or ball
+     * tree over them when there are at least INDEX_MIN_K of them, so that
+     * each prediction costs about O(log k) distances instead of k. Call it
+     * again after assigning `centroids` by hand; until then predictions use
+     * the centroids last published.
+     */
+    void publishCentroids() {
+        auto next = make_shared<Snapshot>();
+        next->centers = flatCentroids();
+        next->count = centroids.size();
+        next->dim = centroids.empty() ? 0 : centroids[0].size();
+        indexCenters(*next);
+        atomic_store(&snapshot, shared_ptr<const Snapshot>(move(next)));
+    }
+
+    // Chooses and builds the centroid search of a snapshot.
+    void indexCenters(Snapshot &s) const {
+        s.search = CentroidSearch::Scan;
+        bool kd = s.dim <= KD_TREE_MAX_DIMS;
+        bool ball = s.dim >= BALL_TREE_MIN_DIMS && s.dim <= BALL_TREE_MAX_DIMS;
+        if (s.count < INDEX_MIN_K || s.dim == 0 || !(kd || ball)) {
+            return;
+        }
+        // Cosine rows are normalised and compared by Euclidean distance, but
+        // their centroids are plain means, not unit vectors.
+        metric::Metric met = distanceMetric == metric::Metric::Cosine ? metric::Metric::Euclidean : distanceMetric;
+        if (kd) {
+            s.kdTree.build(s.centers, s.count, s.dim, met, minkowskiP);
+            s.search = CentroidSearch::KDTree;
+        } else {
+            s.ballTree.build(s.centers, s.count, s.dim, met, minkowskiP);
+            s.search = CentroidSearch::BallTree;
+        }
+    }
+
+    /**
+     * @brief Nearest centroid of a snapshot, through its index if it has one.
+     *
+     * @param scratch Reused buffer for the index query.
+     */
+    template <class Dist>
+    static int nearestIn(const Snapshot &s, const double *point, vector<pair<double, size_t>> &scratch) {
+        switch (s.search) {
+        case CentroidSearch::KDTree:
+            s.kdTree.query(point, 1, scratch);
+            return static_cast<int>(scratch[0].second);
+        case CentroidSearch::BallTree:
+            s.ballTree.query(point, 1, scratch);
+            return static_cast<int>(scratch[0].second);
+        default:
+            return nearestCentroid<Dist>(point, s.centers.data(), s.count, s.dim);
+        }
+    }
+
+    // Assigns count row-major rows of s.dim values (normalised here for the
+    // cosine metric) in parallel blocks.
+    void assignRows(const Snapshot &s, const double *rows, size_t count, int *out) const {
+        size_t dim = s.dim;
+        metric::withKernel(distanceMetric, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            handle::parallelFor(count, [&](size_t begin, size_t end) {
+                vector<pair<double, size_t>> scratch;
+                vector<double> row(dim);
+                for (size_t i = begin; i < end; i++) {
+                    const double *point = rows + i * dim;
+                    if (distanceMetric == metric::Metric::Cosine) {
+                        copy(point, point + dim, row.begin());
+                        metric::normalizeRows(row.data(), 1, dim);
+                        point = row.data();
                     }
+                    out[i] = nearestIn<Dist>(s, point, scratch);
                 }
+            }, PREDICT_GRAIN);
+        });
+    }
+
+    // Per-block sums and counts of one assignment pass.
+    // Only the centroids a block actually touched are cleared and reduced.
+    struct Partial {
+        vector<double> sums;      // k * dim: weighted rows added minus removed.
+        vector<double> mass;      // k: weight gained minus weight lost.
+        vector<long long> counts; // k: rows gained minus rows lost.
+        vector<char> touched;     // k: whether sums/counts of a centroid are live.
+        vector<int> touchedList;  // Centroids with touched set, capacity k.
+        size_t evals = 0;         // Distances computed.
+        size_t moved = 0;         // Rows of the block that changed cluster.
+        double cost = 0.0;        // Squared distances of the block's rows (final pass).
+
+        void reset(size_t k, size_t dim) {
+            sums.resize(k * dim);
+            mass.resize(k);
+            counts.resize(k);
+            touched.assign(k, 0);
+            touchedList.reserve(k);
+        }
+
+        // Adds (sign 1) or removes (sign -1) a row of weight w from centroid c.
+        void apply(int c, const double *row, double w, int sign, size_t dim) {
+            double *sum = &sums[c * dim];
+            if (!touched[c]) {
+                touched[c] = 1;
+                touchedList.push_back(c);
+                mass[c] = 0.0;
+                counts[c] = 0;
+                fill(sum, sum + dim, 0.0);
             }
-            
+            double signedWeight = sign * w;
+            mass[c] += signedWeight;
+            counts[c] += sign;
+            for (size_t j = 0; j < dim; j++) {
+                sum[j] += signedWeight * row[j];
+            }
+        }
+    };
+
+    // State and result of one seeded restart.
+    struct Run {
+        vector<double> centers;    // k * dim
+        vector<int> assignments;
+        double inertia = 0.0;
+        int iterations = 0;
+        size_t evaluations = 0;    // Distances computed.
+    };
+
+    /**
+     * @brief Iterates assignment and mean update over row-major points,
+     *        refining centers (k * dim) in place.
+     *
+     * The assignment step is plain Lloyd or one of the bound-based variants
+     * (see Algorithm); all of them produce the same assignments (up to exact
+     * distance ties). The centroid
+     * update is the arithmetic mean of the assigned rows for every metric;
+     * convergence is measured as the total centroid movement in the metric.
+     *
+     * Assignment and update run as one parallel pass over fixed row blocks.
+     * Every centroid keeps a running sum and count of its rows; a block only
+     * records the rows that changed cluster (removed from the old centroid,
+     * added to the new one), and the block deltas are reduced into the
+     * running sums of the centroids they touched. Centroids no row entered or
+     * left do not move and are not recomputed, so once few rows move an
+     * iteration costs little beyond the assignment test itself, and the
+     * moved-row count doubles as the convergence check. The worker threads
+     * (a handle::WorkerPool), block partials and running sums are set up once
+     * per run, so iterations start no threads and allocate nothing.
+     *
+     * Only reads the model's settings, so restarts may run concurrently on
+     * the same points, each with its own Run.
+     *
+     * @param weights Weight per row, or nullptr for weight 1.
+     * @param run Seeded centers in; final centers, assignments, inertia and counts out.
+     * @param threads Worker threads this run may use.
+     * @param verbose Whether to print progress.
+     */
+    template <class Dist>
+    void lloyd(const vector<double> &points, const double *weights, size_t m, size_t dim, Run &run, size_t threads,
+               bool verbose) const {
+        vector<double> &centers = run.centers;
+        vector<int> &assigned = run.assignments;
+        assigned.assign(m, -1);
+        run.evaluations = 0;
+        handle::WorkerPool pool(threads);
+        Bounds bounds;
+        if (usedAlgorithm == Algorithm::Elkan) {
+            bounds.perRow = k;
+            bounds.upper.assign(m, 0.0);
+            bounds.lower.assign(m * k, 0.0);
+        } else if (usedAlgorithm == Algorithm::Hamerly) {
+            bounds.perRow = 1;
+            bounds.upper.assign(m, DBL_MAX);
+            bounds.lower.assign(m, 0.0);
+        }
+        size_t blocks = min<size_t>(threads, max<size_t>(1, m / UPDATE_GRAIN));
+        size_t step = (m + blocks - 1) / blocks;
+        vector<Partial> partial(blocks);
+        for (auto &p : partial) {
+            p.reset(k, dim);
+        }
+        vector<double> sums(k * dim, 0.0), mass(k, 0.0), mean(k * dim);
+        vector<long long> counts(k, 0);
+        vector<double> shift(k);
+        run.iterations = 0;
+        for (int iter = 0; iter < maxIterations; iter++) {
+            bool first = iter == 0;
+            run.iterations = iter + 1;
+            if (usedAlgorithm != Algorithm::Lloyd) {
+                run.evaluations += centerGaps<Dist>(centers, dim, bounds, usedAlgorithm == Algorithm::Elkan);
+            }
+
+            // Steps 1 and 2: assign each row to its nearest centroid and record
+            // the rows that moved in their block's deltas.
+            pool.parallelFor(blocks, [&](size_t b0, size_t b1) {
+                for (size_t b = b0; b < b1; b++) {
+                    assignBlock<Dist>(points.data(), weights, b * step, min(m, (b + 1) * step), dim, centers,
+                                      assigned, bounds, first, partial[b]);
+                }
+            });
+            size_t moved = 0;
+            for (auto &p : partial) {
+                moved += p.moved;
+                run.evaluations += p.evals;
+            }
+
+            // Fold the block deltas into the running sums of the centroids they
+            // touched and move only those centroids.
+            pool.parallelFor(k, [&](size_t c0, size_t c1) {
+                for (size_t cluster = c0; cluster < c1; cluster++) {
+                    shift[cluster] = 0.0;
+                    bool dirty = false;
+                    double *sum = &sums[cluster * dim];
+                    for (auto &p : partial) {
+                        if (!p.touched[cluster]) {
+                            continue;
+                        }
+                        dirty = true;
+                        mass[cluster] += p.mass[cluster];
+                        counts[cluster] += p.counts[cluster];
+                        const double *delta = &p.sums[cluster * dim];
+                        for (size_t j = 0; j < dim; j++) {
+                            sum[j] += delta[j];
+                        }
+                    }
+                    if (!dirty || counts[cluster] == 0 || mass[cluster] <= 0.0) {
+                        // No row entered or left, or none (of positive weight) is left;
+                        // retain the old centroid.
+                        continue;
+                    }
+                    double *next = &mean[cluster * dim];
+                    for (size_t j = 0; j < dim; j++) {
+                        next[j] = sum[j] / mass[cluster];
+                    }
+                    shift[cluster] = distance<Dist>(&centers[cluster * dim], next, dim);
+                    copy(next, next + dim, &centers[cluster * dim]);
+                }
+            }, max<size_t>(16, (k + threads - 1) / threads));
+
             // Step 3: Check for convergence (centroid movement less than tol).
             double totalMovement = 0.0;
             for (int cluster = 0; cluster < k; cluster++) {
-                totalMovement += euclideanDistance(centroids[cluster], newCentroids[cluster]);
+                totalMovement += shift[cluster];
+            }
+            if (usedAlgorithm != Algorithm::Lloyd) {
+                bounds.moveCenters(pool, assigned, shift, max<size_t>(UPDATE_GRAIN, (m + threads - 1) / threads));
             }
-            
-            centroids = newCentroids;  // Update centroids.
             
             // Optional: Print status every 10 iterations.
-            if (iter % 10 == 0) {
+            if (verbose && iter % 10 == 0) {
                 cout << "Iteration " << iter << ", total centroid movement: " << totalMovement << endl;
             }
             
-            if (!assignmentChanged || totalMovement < tol) {
-                cout << "Convergence reached at iteration " << iter << endl;
+            if (moved == 0 || totalMovement < tol) {
+                if (verbose) {
+                    cout << "Convergence reached at iteration " << iter << endl;
+                }
                 break;
             }
         }
-        vector<int> params = assignments; // Return assignments as a vector of integers.
-        return static_cast<void*>(new vector<int>(params)); // Return as void pointer.
+
+        // Inertia of the final assignment against the final centroids.
+        pool.parallelFor(blocks, [&](size_t b0, size_t b1) {
+            for (size_t b = b0; b < b1; b++) {
+                double cost = 0.0;
+                for (size_t i = b * step; i < min(m, (b + 1) * step); i++) {
+                    cost += (weights ? weights[i] : 1.0) *
+                            squaredDistance<Dist>(&points[i * dim], &centers[assigned[i] * dim], dim);
+                }
+                partial[b].cost = cost;
+            }
+        });
+        run.inertia = 0.0;
+        for (auto &p : partial) {
+            run.inertia += p.cost;
+        }
+    }
+
+    /**
+     * @brief Resolves `algorithm` for m rows of dim values.
+     *
+     * Auto picks Elkan (k lower bounds per row) in ELKAN_MIN_DIMS+ dimensions
+     * with k >= ELKAN_MIN_K, where its tighter bounds skip far more distances
+     * than they cost, as long as the m * k bounds fit in ELKAN_MAX_BOUNDS;
+     * otherwise Hamerly (one lower bound per row), which wins in low
+     * dimensions. A single cluster needs no bounds. `concurrent` restarts
+     * each hold their own bounds.
+     */
+    Algorithm chooseAlgorithm(size_t m, size_t dim, size_t concurrent = 1) const {
+        if (algorithm != Algorithm::Auto) {
+            return algorithm;
+        }
+        if (k <= 1) {
+            return Algorithm::Lloyd;
+        }
+        if (dim >= ELKAN_MIN_DIMS && static_cast<size_t>(k) >= ELKAN_MIN_K && m * k * concurrent <= ELKAN_MAX_BOUNDS) {
+            return Algorithm::Elkan;
+        }
+        return Algorithm::Hamerly;
+    }
+
+    /**
+     * @brief True distance in the metric of policy Dist.
+     */
+    template <class Dist>
+    static double distance(const double *a, const double *b, size_t dim) {
+        return Dist::fromReduced(Dist::reduced(a, b, dim));
+    }
+
+    // Distance bounds carried between iterations by Elkan and Hamerly.
+    struct Bounds {
+        vector<double> upper;        // Per row: >= distance to its assigned centroid.
+        vector<double> lower;        // Per row (Hamerly) or per row and centroid (Elkan): <= the distance.
+        vector<double> halfNearest;  // Per centroid: half the distance to the closest other centroid.
+        vector<double> between;      // Elkan: half the distance between every pair of centroids (k * k).
+        size_t perRow = 1;           // Lower bounds per row (1 for Hamerly, k for Elkan).
+
+        // After the centroids moved by shift[c], loosen the bounds so they stay valid.
+        void moveCenters(handle::WorkerPool &pool, const vector<int> &assigned, const vector<double> &shift,
+                         size_t grain) {
+            size_t kk = shift.size();
+            size_t m = upper.size();
+            if (perRow == 1) {
+                // A row's lower bound covers every other centroid, so it drops by
+                // the largest shift among them.
+                size_t top = max_element(shift.begin(), shift.end()) - shift.begin();
+                double second = 0.0;
+                for (size_t c = 0; c < kk; c++) {
+                    if (c != top) {
+                        second = max(second, shift[c]);
+                    }
+                }
+                pool.parallelFor(m, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        upper[i] += shift[assigned[i]];
+                        lower[i] -= static_cast<size_t>(assigned[i]) == top ? second : shift[top];
+                    }
+                }, grain);
+            } else {
+                pool.parallelFor(m, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        upper[i] += shift[assigned[i]];
+                        double *l = &lower[i * kk];
+                        for (size_t c = 0; c < kk; c++) {
+                            l[c] = max(0.0, l[c] - shift[c]);
+                        }
+                    }
+                }, grain);
+            }
+        }
+    };
+
+    // Centroid-to-centroid distances for the bound tests: halfNearest always, `between` for Elkan.
+    // Returns the number of distances computed.
+    template <class Dist>
+    size_t centerGaps(const vector<double> &centers, size_t dim, Bounds &bounds, bool pairs) const {
+        bounds.halfNearest.assign(k, DBL_MAX);
+        if (pairs) {
+            bounds.between.assign(k * k, 0.0);
+        }
+        for (int a = 0; a < k; a++) {
+            for (int b = a + 1; b < k; b++) {
+                double half = 0.5 * distance<Dist>(&centers[a * dim], &centers[b * dim], dim);
+                bounds.halfNearest[a] = min(bounds.halfNearest[a], half);
+                bounds.halfNearest[b] = min(bounds.halfNearest[b], half);
+                if (pairs) {
+                    bounds.between[a * k + b] = bounds.between[b * k + a] = half;
+                }
+            }
+        }
+        return k * (k - 1) / 2;
+    }
+
+    // Assigns rows [begin, end) with the chosen strategy and records the rows that moved in `out`.
+    template <class Dist>
+    void assignBlock(const double *points, const double *weights, size_t begin, size_t end, size_t dim,
+                     const vector<double> &centers, vector<int> &assigned, Bounds &bounds, bool first,
+                     Partial &out) const {
+        for (int c : out.touchedList) {
+            out.touched[c] = 0;
+        }
+        out.touchedList.clear();
+        size_t evals = 0, moved = 0;
+        for (size_t i = begin; i < end; i++) {
+            const double *row = &points[i * dim];
+            int a;
+            if (usedAlgorithm == Algorithm::Elkan) {
+                a = elkanRow<Dist>(row, i, dim, centers, assigned[i], bounds, first, evals);
+            } else if (usedAlgorithm == Algorithm::Hamerly) {
+                a = hamerlyRow<Dist>(row, i, dim, centers, assigned[i], bounds, first, evals);
+            } else {
+                a = nearestCentroid<Dist>(row, centers.data(), k, dim);
+                evals += k;
+            }
+            if (assigned[i] != a) {
+                double w = weights ? weights[i] : 1.0;
+                if (assigned[i] >= 0) {
+                    out.apply(assigned[i], row, w, -1, dim);
+                }
+                out.apply(a, row, w, 1, dim);
+                assigned[i] = a;
+                moved++;
+            }
+        }
+        out.evals = evals;
+        out.moved = moved;
+    }
+
+    /**
+     * @brief Elkan assignment of row i: k lower bounds per row and the centroid pair distances.
+     *
+     * Centroid c is only measured for the row when neither l(i, c) nor half
+     * the distance between c and the assigned centroid proves it farther than
+     * the upper bound u(i); the upper bound itself is only refreshed once per
+     * row and iteration, when a test fails.
+     */
+    template <class Dist>
+    int elkanRow(const double *row, size_t i, size_t dim, const vector<double> &centers, int current, Bounds &bounds,
+                 bool first, size_t &evals) const {
+        double *l = &bounds.lower[i * k];
+        if (first) {
+            for (int c = 0; c < k; c++) {
+                l[c] = distance<Dist>(row, &centers[c * dim], dim);
+            }
+            evals += k;
+            int best = static_cast<int>(min_element(l, l + k) - l);
+            bounds.upper[i] = l[best];
+            return best;
+        }
+        int a = current;
+        double u = bounds.upper[i];
+        if (u <= bounds.halfNearest[a]) {
+            return a;
+        }
+        bool stale = true;
+        for (int c = 0; c < k; c++) {
+            if (c == a || u <= l[c] || u <= bounds.between[a * k + c]) {
+                continue;
+            }
+            if (stale) {
+                u = l[a] = distance<Dist>(row, &centers[a * dim], dim);
+                evals++;
+                stale = false;
+                if (u <= l[c] || u <= bounds.between[a * k + c]) {
+                    continue;
+                }
+            }
+            double d = l[c] = distance<Dist>(row, &centers[c * dim], dim);
+            evals++;
+            if (d < u || (d == u && c < a)) {
+                a = c;
+                u = d;
+            }
+        }
+        bounds.upper[i] = u;
+        return a;
+    }
+
+    /**
+     * @brief Hamerly assignment of row i: one lower bound per row (on the second-closest centroid).
+     *
+     * The row is skipped while its upper bound stays below both its lower
+     * bound and half the gap from its centroid to the nearest other one;
+     * otherwise the upper bound is tightened and, if that is not enough, all
+     * k distances are recomputed.
+     */
+    template <class Dist>
+    int hamerlyRow(const double *row, size_t i, size_t dim, const vector<double> &centers, int current, Bounds &bounds,
+                   bool first, size_t &evals) const {
+        int a = current;
+        if (!first) {
+            double z = max(bounds.lower[i], bounds.halfNearest[a]);
+            if (bounds.upper[i] <= z) {
+                return a;
+            }
+            bounds.upper[i] = distance<Dist>(row, &centers[a * dim], dim);
+            evals++;
+            if (bounds.upper[i] <= z) {
+                return a;
+            }
+        }
+        double best = DBL_MAX, second = DBL_MAX;
+        int bestCluster = 0;
+        for (int c = 0; c < k; c++) {
+            double d = distance<Dist>(row, &centers[c * dim], dim);
+            if (d < best) {
+                second = best;
+                best = d;
+                bestCluster = c;
+            } else if (d < second) {
+                second = d;
+            }
+        }
+        evals += k;
+        bounds.upper[i] = best;
+        bounds.lower[i] = second;
+        return bestCluster;
+    }
+
+    // Windowed partialFit(): adds the batch's coreset to the window and refits
+    // the centroids to the weighted coresets by Lloyd iterations.
+    template <class Dist>
+    void slideWindow(const double *batch, size_t count, size_t dim) {
+        vector<double> sums(k * dim, 0.0), weights(k, 0.0);
+        handle::parallelFor(count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                online.nearest[i] = nearestCentroid<Dist>(batch + i * dim, online.centers.data(), k, dim);
+            }
+        }, 64);
+        distanceEvaluations += count * k;
+        for (size_t i = 0; i < count; i++) {
+            int c = online.nearest[i];
+            weights[c] += 1.0;
+            for (size_t j = 0; j < dim; j++) {
+                sums[c * dim + j] += batch[i * dim + j];
+            }
+        }
+        BatchSummary summary;
+        for (int c = 0; c < k; c++) {
+            if (weights[c] == 0.0) {
+                continue;
+            }
+            for (size_t j = 0; j < dim; j++) {
+                summary.points.push_back(sums[c * dim + j] / weights[c]);
+            }
+            summary.weights.push_back(weights[c]);
+        }
+        for (auto &older : online.window) {
+            for (double &w : older.weights) {
+                w *= decay;
+            }
+        }
+        online.window.push_back(move(summary));
+        while (online.window.size() > windowBatches) {
+            online.window.pop_front();
+        }
+
+        vector<double> points, pointWeights;
+        for (auto &entry : online.window) {
+            points.insert(points.end(), entry.points.begin(), entry.points.end());
+            pointWeights.insert(pointWeights.end(), entry.weights.begin(), entry.weights.end());
+        }
+        size_t n = pointWeights.size();
+        vector<int> owner(n);
+        for (int iter = 0; iter < maxIterations; iter++) {
+            fill(sums.begin(), sums.end(), 0.0);
+            fill(weights.begin(), weights.end(), 0.0);
+            for (size_t i = 0; i < n; i++) {
+                int c = owner[i] = nearestCentroid<Dist>(&points[i * dim], online.centers.data(), k, dim);
+                weights[c] += pointWeights[i];
+                for (size_t j = 0; j < dim; j++) {
+                    sums[c * dim + j] += pointWeights[i] * points[i * dim + j];
+                }
+            }
+            distanceEvaluations += n * k;
+            double movement = 0.0;
+            for (int c = 0; c < k; c++) {
+                if (weights[c] <= 0.0) {
+                    continue;
+                }
+                for (size_t j = 0; j < dim; j++) {
+                    sums[c * dim + j] /= weights[c];
+                }
+                movement += distance<Dist>(&online.centers[c * dim], &sums[c * dim], dim);
+                copy(&sums[c * dim], &sums[(c + 1) * dim], &online.centers[c * dim]);
+            }
+            if (movement < tol) {
+                break;
+            }
+        }
+    }
+
+    // Weighted points summarising one batch of partialFit().
+    struct BatchSummary {
+        vector<double> points;
+        vector<double> weights;
+    };
+
+    // partialFit() state between batches.
+    struct Online {
+        size_t dim = 0;
+        vector<double> centers;      // k * dim, empty until seeded.
+        vector<double> seen;         // Decayed row weight of every centroid.
+        vector<double> pending;      // Rows buffered before seeding.
+        deque<BatchSummary> window;       // windowBatches > 0: recent batch coresets.
+        vector<int> nearest;         // Per batch row scratch.
+        vector<double> rowCost;
+    };
+    Online online;
+    shared_ptr<const Snapshot> snapshot;
+
+    // Drops the partialFit() state; batch fits start from scratch.
+    void resetOnline() {
+        online = Online();
+        atomic_store(&snapshot, shared_ptr<const Snapshot>());
+    }
+
+    // Seeds from the head of `source`, then applies mini-batch updates until
+    // the source ends or the smoothed inertia stalls. Sets centroids.
+    void runMiniBatch(const RowSource &source, size_t dim, mt19937_64 &rng) {
+        size_t seedRows = max(batchSize, static_cast<size_t>(3 * k));
+        vector<double> head(seedRows * dim);
+        size_t have = 0;
+        while (have < seedRows) {
+            size_t got = source(&head[have * dim], min(batchSize, seedRows - have));
+            if (got == 0) {
+                break;
+            }
+            have += got;
+        }
+        if (have < static_cast<size_t>(k)) {
+            throw runtime_error("k cannot be greater than the number of data points.");
+        }
+        if (distanceMetric == metric::Metric::Cosine) {
+            metric::normalizeRows(head.data(), have, dim);
+        }
+
+        metric::withKernel(distanceMetric, minkowskiP, dim, [&](auto kernel) {
+            typedef decltype(kernel) Dist;
+            vector<double> centers = seedCentroids<Dist>(head.data(), nullptr, have, dim, k, rng(),
+                                                         handle::numThreads());
+            vector<double> seen(k, 0.0);
+            vector<double> batch(batchSize * dim);
+            vector<int> nearest(batchSize);
+            vector<double> rowCost(batchSize);
+            distanceEvaluations = 0;
+            batchesRun = 0;
+            double smoothed = -1.0, best = DBL_MAX;
+            int stalled = 0;
+            size_t headUsed = 0;
+            while (true) {
+                size_t count;
+                if (headUsed < have) {
+                    // The seeding rows are replayed as the first batches.
+                    count = min(batchSize, have - headUsed);
+                    copy(&head[headUsed * dim], &head[(headUsed + count) * dim], batch.begin());
+                    headUsed += count;
+                } else {
+                    count = source(batch.data(), batchSize);
+                    if (count == 0) {
+                        break;
+                    }
+                    if (distanceMetric == metric::Metric::Cosine) {
+                        metric::normalizeRows(batch.data(), count, dim);
+                    }
+                }
+                double inertia = miniBatchStep<Dist>(batch.data(), count, dim, centers, seen, nearest, rowCost);
+                batchesRun++;
+                smoothed = smoothed < 0.0 ? inertia : (1.0 - inertiaSmoothing) * smoothed + inertiaSmoothing * inertia;
+                if (verbose && batchesRun % 100 == 0) {
+                    cout << "Batch " << batchesRun << ", smoothed inertia: " << smoothed << endl;
+                }
+                if (smoothed < best) {
+                    best = smoothed;
+                    stalled = 0;
+                } else if (++stalled >= maxNoImprovement) {
+                    if (verbose) {
+                        cout << "Convergence reached at batch " << batchesRun << endl;
+                    }
+                    break;
+                }
+            }
+            centroids.assign(k, vector<double>(dim));
+            for (int cluster = 0; cluster < k; cluster++) {
+                copy(&centers[cluster * dim], &centers[(cluster + 1) * dim], centroids[cluster].begin());
+            }
+        });
+    }
+
+    /**
+     * @brief One mini-batch update (Sculley, 2010).
+     *
+     * The batch is assigned in parallel against the current centroids; then
+     * every row pulls its centroid towards itself with learning rate
+     * 1 / (rows the centroid has absorbed so far), so each centroid is the
+     * running mean of the rows it has seen.
+     *
+     * @return Mean squared distance of the batch rows to their centroids.
+     */
+    template <class Dist>
+    double miniBatchStep(const double *batch, size_t count, size_t dim, vector<double> &centers, vector<double> &seen,
+                         vector<int> &nearest, vector<double> &rowCost) {
+        handle::parallelFor(count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                int c = nearestCentroid<Dist>(batch + i * dim, centers.data(), k, dim);
+                nearest[i] = c;
+                rowCost[i] = squaredDistance<Dist>(batch + i * dim, &centers[c * dim], dim);
+            }
+        }, 64);
+        distanceEvaluations += count * k;
+        double inertia = 0.0;
+        for (size_t i = 0; i < count; i++) {
+            int c = nearest[i];
+            seen[c] += 1.0;
+            double eta = 1.0 / seen[c];
+            double *center = &centers[c * dim];
+            const double *row = batch + i * dim;
+            for (size_t j = 0; j < dim; j++) {
+                center[j] += eta * (row[j] - center[j]);
+            }
+            inertia += rowCost[i];
+        }
+        return inertia / static_cast<double>(count);
+    }
+
+    /**
+     * @brief Picks `count` initial centroids from row-major points.
+     *
+     * @param weights Optional per-row weights (nullptr = all 1), used as
+     *                sampling weights.
+     * @param seedValue Seed of the random choices; the same seed gives the same centroids.
+     * @param threads Worker threads the seeding passes may use.
+     * @return Row-major buffer of count * dim values.
+     */
+    template <class Dist>
+    vector<double> seedCentroids(const double *points, const double *weights, size_t m, size_t dim, size_t count,
+                                 unsigned long long seedValue, size_t threads) const {
+        vector<double> centers(count * dim);
+        mt19937_64 rng(seedValue);
+        if (init == Init::First) {
+            copy(points, points + count * dim, centers.begin());
+        } else if (init == Init::KMeansParallel && m > count * static_cast<size_t>(oversampling * parallelRounds + 1)) {
+            seedParallel<Dist>(points, weights, m, dim, count, rng, centers, threads);
+        } else {
+            seedPlusPlus<Dist>(points, weights, m, dim, count, rng, centers, threads);
+        }
+        return centers;
+    }
+
+    /**
+     * @brief Squared true distance used for D^2 sampling (the reduced distance itself for Euclidean).
+     */
+    template <class Dist>
+    static double squaredDistance(const double *a, const double *b, size_t dim) {
+        double r = Dist::reduced(a, b, dim);
+        if constexpr (is_base_of<metric::Euclidean, Dist>::value) {
+            return r;
+        } else {
+            double d = Dist::fromReduced(r);
+            return d * d;
+        }
+    }
+
+    /**
+     * @brief k-means++: each next centroid is a row drawn with probability
+     *        proportional to weight * (squared distance to the closest centroid so far).
+     *
+     * Closest distances are updated in parallel after every pick, O(m * count * dim) in total,
+     * split into at most `threads` chunks.
+     */
+    template <class Dist>
+    static void seedPlusPlus(const double *points, const double *weights, size_t m, size_t dim, size_t count,
+                             mt19937_64 &rng, vector<double> &centers, size_t threads) {
+        auto weightOf = [&](size_t i) { return weights == nullptr ? 1.0 : weights[i]; };
+        vector<double> closest(m, DBL_MAX);
+        size_t pick = drawRow(closest, weights, m, rng, true);
+        for (size_t c = 0; c < count; c++) {
+            if (c > 0) {
+                pick = drawRow(closest, weights, m, rng, false);
+            }
+            const double *center = points + pick * dim;
+            copy(center, center + dim, &centers[c * dim]);
+            handle::parallelFor(m, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    if (weightOf(i) > 0.0) {
+                        closest[i] = min(closest[i], squaredDistance<Dist>(points + i * dim, center, dim));
+                    }
+                }
+            }, seedGrain(m, threads));
+        }
+    }
+
+    /**
+     * @brief Draws a row with probability proportional to weight * closest
+     *        (or to weight alone when `uniform` is set or every closest is 0).
+     */
+    static size_t drawRow(const vector<double> &closest, const double *weights, size_t m, mt19937_64 &rng,
+                          bool uniform) {
+        auto score = [&](size_t i) {
+            double w = weights == nullptr ? 1.0 : weights[i];
+            return uniform ? w : w * closest[i];
+        };
+        double total = 0.0;
+        for (size_t i = 0; i < m; i++) {
+            total += score(i);
+        }
+        if (total <= 0.0) {
+            return uniform ? uniform_int_distribution<size_t>(0, m - 1)(rng) : drawRow(closest, weights, m, rng, true);
+        }
+        double target = uniform_real_distribution<double>(0.0, total)(rng);
+        double running = 0.0;
+        size_t last = 0;
+        for (size_t i = 0; i < m; i++) {
+            double si = score(i);
+            if (si <= 0.0) {
+                continue;
+            }
+            running += si;
+            last = i;
+            if (running > target) {
+                return i;
+            }
+        }
+        return last;
+    }
+
+    /**
+     * @brief k-means|| (Bahmani et al.): a few rounds that each keep every row
+     *        independently with probability min(1, l * weight * closest / cost),
+     *        with l = oversampling * count, then k-means++ over the candidates
+     *        weighted by how much row weight is closest to each of them.
+     *
+     * Every round is one parallel pass over the rows. The keep decision of a
+     * row is a hash of (seed, round, row), so results do not depend on
+     * `threads`, which only bounds how many chunks each pass is split into.
+     */
+    template <class Dist>
+    void seedParallel(const double *points, const double *weights, size_t m, size_t dim, size_t count,
+                      mt19937_64 &rng, vector<double> &centers, size_t threads) const {
+        auto weightOf = [&](size_t i) { return weights == nullptr ? 1.0 : weights[i]; };
+        vector<double> closest(m, DBL_MAX);
+        vector<size_t> nearest(m, 0);
+        vector<size_t> candidates{drawRow(closest, weights, m, rng, true)};
+        unsigned long long roundSeed = rng();
+        double l = oversampling * static_cast<double>(count);
+        vector<char> keep(m, 0);
+
+        size_t first = 0;
+        for (int round = 0; round <= parallelRounds; round++) {
+            // Distances to the candidates added by the previous round.
+            handle::parallelFor(m, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    for (size_t c = first; c < candidates.size(); c++) {
+                        double d = squaredDistance<Dist>(points + i * dim, points + candidates[c] * dim, dim);
+                        if (d < closest[i]) {
+                            closest[i] = d;
+                            nearest[i] = c;
+                        }
+                    }
+                }
+            }, seedGrain(m, threads));
+            first = candidates.size();
+            if (round == parallelRounds) {
+                break;
+            }
+            double cost = 0.0;
+            for (size_t i = 0; i < m; i++) {
+                cost += weightOf(i) * closest[i];
+            }
+            if (cost <= 0.0) {
+                break;
+            }
+            handle::parallelFor(m, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    keep[i] = unitHash(roundSeed, static_cast<unsigned long long>(round), i) * cost <
+                              l * weightOf(i) * closest[i];
+                }
+            }, seedGrain(m, threads));
+            for (size_t i = 0; i < m; i++) {
+                if (keep[i] && closest[i] > 0.0) {
+                    candidates.push_back(i);
+                }
+            }
+        }
+
+        if (candidates.size() <= count) {
+            seedPlusPlus<Dist>(points, weights, m, dim, count, rng, centers, threads);
+            return;
+        }
+        vector<double> candidatePoints(candidates.size() * dim);
+        vector<double> candidateWeights(candidates.size(), 0.0);
+        for (size_t c = 0; c < candidates.size(); c++) {
+            copy(points + candidates[c] * dim, points + (candidates[c] + 1) * dim, &candidatePoints[c * dim]);
+        }
+        for (size_t i = 0; i < m; i++) {
+            candidateWeights[nearest[i]] += weightOf(i);
+        }
+        seedPlusPlus<Dist>(candidatePoints.data(), candidateWeights.data(), candidates.size(), dim, count, rng,
+                           centers, threads);
+    }
+
+    // Rows per seeding chunk: at least 1024, and few enough chunks for `threads` workers.
+    static size_t seedGrain(size_t m, size_t threads) {
+        return max<size_t>(1024, (m + threads - 1) / max<size_t>(threads, 1));
+    }
+
+    // Uniform value in [0, 1) from a SplitMix64 hash of (seed, round, row).
+    static double unitHash(unsigned long long seedValue, unsigned long long round, size_t row) {
+        unsigned long long z = seedValue ^ (round * 0x9E3779B97F4A7C15ULL) ^ (static_cast<unsigned long long>(row) << 1);
+        z += 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        return static_cast<double>(z >> 11) * 0x1.0p-53;
+    }
+
+    /**
+     * @brief Centroids for prediction: the published snapshot if there is
+     *        one, otherwise a copy of `centroids` (indexed only if `indexed`,
+     *        as an index pays off over many rows but not over one).
+     */
+    shared_ptr<const Snapshot> currentCenters(bool indexed = false) const {
+        shared_ptr<const Snapshot> current = atomic_load(&snapshot);
+        if (current) {
+            return current;
+        }
+        auto copyOf = make_shared<Snapshot>();
+        copyOf->centers = flatCentroids();
+        copyOf->count = centroids.size();
+        copyOf->dim = centroids.empty() ? 0 : centroids[0].size();
+        if (indexed) {
+            indexCenters(*copyOf);
+        }
+        return copyOf;
+    }
+
+    /**
+     * @brief Centroids as one row-major buffer (centroids.size() * dim values).
+     */
+    vector<double> flatCentroids() const {
+        vector<double> flat;
+        for (const auto &c : centroids) {
+            flat.insert(flat.end(), c.begin(), c.end());
+        }
+        return flat;
     }
 
     /**
@@ -181,34 +1680,46 @@ public:
         }
         size_t originalDim = data.features[0].size();
         size_t dim = originalDim + 1;
-        vector<double> predictions;
-        
-        // Process each point in the input data.
+        shared_ptr<const Snapshot> centers = currentCenters(true);
+        if (centers->dim != dim) {
+            throw runtime_error("Feature dimension mismatch with trained model.");
+        }
+
+        // Form every augmented point once, then assign them all in one parallel pass.
+        vector<double> points(m * dim);
         for (size_t i = 0; i < m; i++) {
-            // Form the augmented point.
-            vector<double> point(dim, 0.0);
             if (data.features[i].size() != originalDim) {
                 throw runtime_error("Inconsistent feature dimensions in data.");
             }
             for (size_t j = 0; j < originalDim; j++) {
-                point[j] = handle::toDouble(data.features[i][j]);
-            }
-            point[dim - 1] = handle::toDouble(data.target[i]);
-            
-            // Assign the point to the nearest centroid.
-            double minDist = DBL_MAX;
-            int bestCluster = -1;
-            for (size_t cluster = 0; cluster < centroids.size(); cluster++) {
-                double dist = euclideanDistance(point, centroids[cluster]);
-                if (dist < minDist) {
-                    minDist = dist;
-                    bestCluster = static_cast<int>(cluster);
-                }
+                points[i * dim + j] = handle::toDouble(data.features[i][j]);
             }
-            predictions.push_back(static_cast<double>(bestCluster));
+            points[i * dim + dim - 1] = handle::toDouble(data.target[i]);
         }
-        
-        return predictions;
+        vector<int> assigned(m);
+        assignRows(*centers, points.data(), m, assigned.data());
+        return vector<double>(assigned.begin(), assigned.end());
+    }
+
+    /**
+     * @brief Nearest centroid of each of count row-major rows of dim values.
+     *
+     * The batch counterpart of predictSingle(): rows are already numeric
+     * (no target column is appended) and are assigned in parallel.
+     *
+     * @throws runtime_error if the model is not trained, or the buffer size or dim does not match it.
+     */
+    vector<int> predictRows(const vector<double> &rows, size_t count, size_t dim) const {
+        shared_ptr<const Snapshot> centers = currentCenters(true);
+        if (centers->dim == 0) {
+            throw runtime_error("Model has not been trained. No centroids available.");
+        }
+        if (centers->dim != dim || rows.size() != count * dim) {
+            throw runtime_error("Feature dimension mismatch with trained model.");
+        }
+        vector<int> assigned(count);
+        assignRows(*centers, rows.data(), count, assigned.data());
+        return assigned;
     }
     
         /**
@@ -219,7 +1730,8 @@ public:
      * @return The cluster index (as an integer) assigned to this data point.
      */
     int predictSingle(vector<string>& features) {
-        size_t expectedDim = centroids.empty() ? 0 : centroids[0].size();
+        shared_ptr<const Snapshot> centers = currentCenters();
+        size_t expectedDim = centers->dim;
         if (expectedDim == 0) {
             throw runtime_error("Model has not been trained. No centroids available.");
         }
@@ -232,16 +1744,15 @@ public:
         for (size_t j = 0; j < features.size(); j++) {
             point[j] = handle::toDouble(features[j]);
         }
+        if (distanceMetric == metric::Metric::Cosine) {
+            metric::normalizeRows(point.data(), 1, expectedDim);
+        }
 
-        double minDist = DBL_MAX;
         int bestCluster = -1;
-        for (size_t cluster = 0; cluster < centroids.size(); cluster++) {
-            double dist = euclideanDistance(point, centroids[cluster]);
-            if (dist < minDist) {
-                minDist = dist;
-                bestCluster = static_cast<int>(cluster);
-            }
-        }
+        metric::withKernel(distanceMetric, minkowskiP, expectedDim, [&](auto kernel) {
+            vector<pair<double, size_t>> scratch;
+            bestCluster = nearestIn<decltype(kernel)>(*centers, point.data(), scratch);
+        });
         return bestCluster;
     }
 
@@ -3,6 +3,7 @@
 #define KMEANS_H
 
 #include <vector>
+#include <functional>
 #include "base.h"
 #include "data_handling.h"
 
@@ -25,6 +26,51 @@ public:
      */
     void* train(handle::Data &data) override;
 
+    /**
+     * @brief Clusters m row-major points of dim values directly, optionally weighted.
+     */
+    void fit(const std::vector<double> &points, size_t m, size_t dim, const std::vector<double> &weights = {});
+
+    /**
+     * @brief Mini-batch clustering of rows pulled from a source, a batch at a time.
+     */
+    void fitStream(const std::function<size_t(double *, size_t)> &source, size_t dim);
+
+    /**
+     * @brief Online k-means: folds one batch of rows into the centroids.
+     */
+    void partialFit(const std::vector<double> &rows, size_t count, size_t dim);
+
+    // Mean silhouette, with a 95% interval when sampled.
+    struct Silhouette {
+        double mean = 0.0;
+        double low = 0.0;
+        double high = 0.0;
+        size_t rows = 0;
+    };
+
+    // Scores of every k in a sweep.
+    struct KSweep {
+        std::vector<int> k;
+        std::vector<double> inertia;
+        std::vector<int> iterations;
+        std::vector<Silhouette> silhouette;
+        int elbowK = 0;
+        int bestK = 0;
+    };
+
+    /**
+     * @brief Warm-started sweep over k with inertia, elbow and (exact or sampled) silhouette scores.
+     */
+    KSweep sweepK(const std::vector<double> &points, size_t m, size_t dim, int kMin, int kMax,
+                  size_t silhouetteSample = 0) const;
+
+    /**
+     * @brief Mean silhouette of a labelling, exact or on a stratified sample with a 95% interval.
+     */
+    Silhouette silhouetteScore(const std::vector<double> &points, size_t m, size_t dim, const std::vector<int> &labels,
+                               size_t sample = 0) const;
+
     /**
      * @brief Predicts cluster assignments for new data points.
      * @param data The dataset to predict.
@@ -32,6 +78,16 @@ public:
      */
     std::vector<double> predict(handle::Data &data) override;
 
+    /**
+     * @brief Nearest centroid of each of count row-major rows, assigned in parallel.
+     */
+    std::vector<int> predictRows(const std::vector<double> &rows, size_t count, size_t dim) const;
+
+    /**
+     * @brief Publishes `centroids` (indexed when there are many) for prediction.
+     */
+    void publishCentroids();
+
     /**
      * @brief Retrieves final cluster assignments from training.
      */
@@ -0,0 +1,296 @@
+#pragma once
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <vector>
+#include <utility>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cstdint>
+#include <cfloat>
+#include "distance.h"
+#include "serialize.h"
+
+using namespace std;
+
+// A KD-tree over a contiguous, row-major point buffer used to answer exact
+// k-nearest-neighbour queries without scanning every training row.
+class KDTree {
+public:
+    // Structure for a node in the tree. Leaves are buckets of up to leafSize rows.
+    struct Node {
+        size_t start, end;   // Range of rows (in tree order) covered by this node.
+        int splitDim;        // Splitting dimension, -1 for a leaf bucket.
+        double splitValue;   // Rows with value < splitValue go left.
+        int left, right;     // Child node indices, -1 for a leaf bucket.
+    };
+
+    size_t dim;                    // Number of features per row.
+    size_t leafSize;               // Maximum number of rows in a leaf bucket.
+    metric::Metric metricType;     // Metric used by query() (see metric::searchMetric()).
+    int minkowskiP;                // Exponent when metricType is Minkowski.
+    handle::MappedArray<double> points;  // Rows reordered so that every leaf is contiguous.
+    handle::MappedArray<size_t> indices; // Original row index of every reordered row.
+    handle::MappedArray<Node> nodes;     // Node storage; nodes[0] is the root.
+
+    /**
+     * @brief Constructor for KDTree.
+     *
+     * @param leaf Maximum number of rows stored in a leaf bucket (default: 16).
+     */
+    explicit KDTree(size_t leaf = 16)
+        : dim(0), leafSize(leaf < 1 ? 1 : leaf), metricType(metric::Metric::Euclidean), minkowskiP(2) {}
+
+    /**
+     * @brief Builds the tree over a row-major point buffer.
+     *
+     * Each internal node splits its rows at the median of the dimension with the
+     * largest spread. Once built, rows are copied into tree order so that a leaf
+     * scan touches one contiguous block of memory.
+     *
+     * @param data Row-major buffer of m * n values.
+     * @param m Number of rows.
+     * @param n Number of columns.
+     * @param met Any metric::Metric (Cosine expects L2-normalised rows and is
+     *            searched with Euclidean distance).
+     * @param p Exponent for metric::Metric::Minkowski.
+     * @throws runtime_error if the buffer size does not match m * n.
+     * @throws invalid_argument for an unsupported Minkowski exponent.
+     */
+    void build(const vector<double> &data, size_t m, size_t n, metric::Metric met = metric::Metric::Euclidean,
+               int p = 2) {
+        if (data.size() != m * n) {
+            throw runtime_error("KDTree: point buffer size does not match dimensions.");
+        }
+        dim = n;
+        metric::checkMetric(met, p);
+        metricType = metric::searchMetric(met, p);
+        minkowskiP = p;
+        nodes.clear();
+        vector<size_t> &order = indices.own();
+        order.resize(m);
+        iota(order.begin(), order.end(), 0);
+        if (m > 0) {
+            nodes.own().reserve(2 * (m / leafSize + 1));
+            buildNode(data, 0, m);
+        }
+
+        vector<double> &rows = points.own();
+        rows.resize(m * n);
+        for (size_t i = 0; i < m; i++) {
+            copy(data.begin() + order[i] * n, data.begin() + (order[i] + 1) * n, rows.begin() + i * n);
+        }
+    }
+
+    /**
+     * @brief Exact k-nearest search.
+     *
+     * The k best candidates are kept in a bounded max-heap. A subtree is only
+     * visited when the distance from the query to its cell does not exceed the
+     * current k-th best distance. Ties are broken by row index, so the result
+     * matches a full sort of (distance, index) pairs.
+     *
+     * @param query Pointer to dim feature values.
+     * @param k Number of neighbours to return.
+     * @param out Filled with (reduced distance, original row index), nearest first.
+     *            Distances are reduced: squared for Euclidean/Cosine, |d|^p summed
+     *            for Minkowski, plain for Manhattan and Chebyshev.
+     * @param skip Optional flag per original row; rows with a nonzero flag are never returned.
+     */
+    void query(const double *query, size_t k, vector<pair<double, size_t>> &out, const char *skip = nullptr) const {
+        out.clear();
+        if (nodes.empty() || k == 0) {
+            return;
+        }
+        out.reserve(k);
+        vector<double> offsets(dim, 0.0);
+        metric::withKernel(metricType, minkowskiP, dim, [&](auto kernel) {
+            search<decltype(kernel)>(0, query, k, 0.0, offsets, out, skip);
+        });
+        sort_heap(out.begin(), out.end());
+    }
+
+    /**
+     * @brief Appends every row within a reduced distance of the query.
+     *
+     * Subtrees whose cell lies beyond the radius are skipped.
+     *
+     * @param query Pointer to dim feature values.
+     * @param radius Inclusive bound on the reduced distance (r^2 for Euclidean).
+     * @param out Appended with (reduced distance, original row index), in tree order.
+     */
+    void radiusQuery(const double *query, double radius, vector<pair<double, size_t>> &out) const {
+        if (nodes.empty()) {
+            return;
+        }
+        thread_local vector<double> offsets;
+        offsets.assign(dim, 0.0);
+        metric::withKernel(metricType, minkowskiP, dim, [&](auto kernel) {
+            radiusSearch<decltype(kernel)>(0, query, radius, 0.0, offsets, out);
+        });
+    }
+
+    bool empty() const { return nodes.empty(); }
+    size_t size() const { return indices.size(); }
+
+    /**
+     * @brief Writes the built tree (nodes, row order and reordered points) to a binary stream.
+     *
+     * The arrays are aligned (see handle::writeArray()) so that load() can map them.
+     */
+    void save(ostream &out) const {
+        uint64_t header[4] = {dim, leafSize, static_cast<uint64_t>(metricType), static_cast<uint64_t>(minkowskiP)};
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        handle::writeArray(out, points);
+        handle::writeArray(out, indices);
+        handle::writeArray(out, nodes);
+    }
+
+    /**
+     * @brief Loads a tree written by save(), replacing the current one.
+     *
+     * Read from a handle::MemoryBuffer, the arrays stay in the mapped file.
+     * @throws runtime_error if the stream does not hold a valid tree.
+     */
+    void load(istream &in) {
+        uint64_t header[4];
+        in.read(reinterpret_cast<char *>(header), sizeof(header));
+        dim = header[0];
+        leafSize = header[1];
+        metricType = static_cast<metric::Metric>(header[2]);
+        minkowskiP = static_cast<int>(header[3]);
+        handle::readArray(in, points);
+        handle::readArray(in, indices);
+        handle::readArray(in, nodes);
+        if (!in || points.size() != indices.size() * dim) {
+            throw runtime_error("Corrupt KD-tree data.");
+        }
+    }
+
+private:
+    // Recursively partitions indices[start, end) and returns the new node index.
+    int buildNode(const vector<double> &data, size_t start, size_t end) {
+        vector<size_t> &order = indices.own();
+        int id = static_cast<int>(nodes.size());
+        nodes.own().push_back({start, end, -1, 0.0, -1, -1});
+        if (end - start <= leafSize) {
+            return id;
+        }
+
+        // Pick the dimension with the largest spread.
+        int bestDim = -1;
+        double bestSpread = 0.0;
+        for (size_t j = 0; j < dim; j++) {
+            double lo = DBL_MAX, hi = -DBL_MAX;
+            for (size_t i = start; i < end; i++) {
+                double v = data[order[i] * dim + j];
+                lo = min(lo, v);
+                hi = max(hi, v);
+            }
+            if (hi - lo > bestSpread) {
+                bestSpread = hi - lo;
+                bestDim = static_cast<int>(j);
+            }
+        }
+        // All rows identical: keep them in one bucket.
+        if (bestDim < 0) {
+            return id;
+        }
+
+        size_t mid = start + (end - start) / 2;
+        auto byDim = [&](size_t a, size_t b) { return data[a * dim + bestDim] < data[b * dim + bestDim]; };
+        nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, byDim);
+        double split = data[order[mid] * dim + bestDim];
+
+        // Rows equal to the median may sit on both sides; move them right so the
+        // invariant (left < split <= right) holds.
+        size_t cut = partition(order.begin() + start, order.begin() + end,
+                               [&](size_t r) { return data[r * dim + bestDim] < split; }) - order.begin();
+        if (cut == start) {
+            // The median is also the minimum (many duplicates): split just above
+            // it at the smallest larger value, which exists since the spread is > 0.
+            cut = partition(order.begin() + start, order.begin() + end,
+                            [&](size_t r) { return data[r * dim + bestDim] <= split; }) - order.begin();
+            double above = DBL_MAX;
+            for (size_t i = cut; i < end; i++) {
+                above = min(above, data[order[i] * dim + bestDim]);
+            }
+            split = above;
+        }
+
+        int left = buildNode(data, start, cut);
+        int right = buildNode(data, cut, end);
+        Node &node = nodes.own()[id];
+        node.splitDim = bestDim;
+        node.splitValue = split;
+        node.left = left;
+        node.right = right;
+        return id;
+    }
+
+    // Visits a subtree whose cell lies at reduced distance rd from the query.
+    // offsets[j] holds the per-dimension offset to the cell along the current path.
+    template <class Dist>
+    void search(int nodeId, const double *q, size_t k, double rd, vector<double> &offsets,
+                vector<pair<double, size_t>> &heap, const char *skip) const {
+        const Node &node = nodes[nodeId];
+        if (node.splitDim < 0) {
+            for (size_t i = node.start; i < node.end; i++) {
+                if (skip != nullptr && skip[indices[i]]) {
+                    continue;
+                }
+                const double *row = &points[i * dim];
+                double dist = heap.size() < k ? Dist::reduced(row, q, dim)
+                                              : Dist::reducedBounded(row, q, dim, heap.front().first);
+                metric::offerCandidate(heap, k, dist, indices[i]);
+            }
+            return;
+        }
+
+        double diff = q[node.splitDim] - node.splitValue;
+        int nearChild = diff < 0 ? node.left : node.right;
+        int farChild = diff < 0 ? node.right : node.left;
+        search<Dist>(nearChild, q, k, rd, offsets, heap, skip);
+
+        double old = offsets[node.splitDim];
+        double farDist = Dist::moveAxis(rd, old, diff);
+        if (heap.size() < k || farDist <= heap.front().first) {
+            offsets[node.splitDim] = diff;
+            search<Dist>(farChild, q, k, farDist, offsets, heap, skip);
+            offsets[node.splitDim] = old;
+        }
+    }
+
+    // Like search(), collecting every row within `radius` instead of the k best.
+    template <class Dist>
+    void radiusSearch(int nodeId, const double *q, double radius, double rd, vector<double> &offsets,
+                      vector<pair<double, size_t>> &out) const {
+        const Node &node = nodes[nodeId];
+        if (node.splitDim < 0) {
+            for (size_t i = node.start; i < node.end; i++) {
+                double dist = Dist::reducedBounded(&points[i * dim], q, dim, radius);
+                if (dist <= radius) {
+                    out.emplace_back(dist, indices[i]);
+                }
+            }
+            return;
+        }
+
+        double diff = q[node.splitDim] - node.splitValue;
+        int nearChild = diff < 0 ? node.left : node.right;
+        int farChild = diff < 0 ? node.right : node.left;
+        radiusSearch<Dist>(nearChild, q, radius, rd, offsets, out);
+
+        double old = offsets[node.splitDim];
+        double farDist = Dist::moveAxis(rd, old, diff);
+        if (farDist <= radius) {
+            offsets[node.splitDim] = diff;
+            radiusSearch<Dist>(farChild, q, radius, farDist, offsets, out);
+            offsets[node.splitDim] = old;
+        }
+    }
+};
+
+#endif // KD_TREE_H
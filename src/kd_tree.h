@@ -0,0 +1,67 @@
+#pragma once
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include "distance.h"
+#include "serialize.h"
+
+class KDTree {
+public:
+    struct Node {
+        size_t start, end;   // Range of rows (in tree order) covered by this node.
+        int splitDim;        // Splitting dimension, -1 for a leaf bucket.
+        double splitValue;   // Rows with value < splitValue go left.
+        int left, right;     // Child node indices, -1 for a leaf bucket.
+    };
+
+    /**
+     * @brief Constructor for KDTree.
+     *
+     * @param leaf Maximum number of rows stored in a leaf bucket (default: 16).
+     */
+    explicit KDTree(size_t leaf = 16);
+
+    /**
+     * @brief Builds the tree over a row-major point buffer of m rows and n columns.
+     */
+    void build(const std::vector<double> &data, size_t m, size_t n,
+               metric::Metric met = metric::Metric::Euclidean, int p = 2);
+
+    /**
+     * @brief Exact k-nearest search under the metric given to build().
+     *
+     * @param query Pointer to n feature values.
+     * @param k Number of neighbours to return.
+     * @param out Filled with (reduced distance, original row index), nearest first.
+     * @param skip Optional flag per original row; flagged rows are never returned.
+     */
+    void query(const double *query, size_t k, std::vector<std::pair<double, size_t>> &out,
+               const char *skip = nullptr) const;
+
+    /**
+     * @brief Appends every row whose reduced distance to the query is at most radius.
+     */
+    void radiusQuery(const double *query, double radius, std::vector<std::pair<double, size_t>> &out) const;
+
+    bool empty() const;
+    size_t size() const;
+
+    /**
+     * @brief Writes / loads the built tree as a binary stream.
+     */
+    void save(std::ostream &out) const;
+    void load(std::istream &in);
+
+    size_t dim;                         // Number of features per row.
+    size_t leafSize;                    // Maximum number of rows in a leaf bucket.
+    metric::Metric metricType;          // Metric used by query().
+    int minkowskiP;                     // Exponent when metricType is Minkowski.
+    handle::MappedArray<double> points;  // Rows reordered so that every leaf is contiguous.
+    handle::MappedArray<size_t> indices; // Original row index of every reordered row.
+    handle::MappedArray<Node> nodes;     // Node storage; nodes[0] is the root.
+};
+
+#endif // KD_TREE_H
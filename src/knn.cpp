@@ -4,11 +4,26 @@
 
 #include <iostream>
 #include <vector>
+#include <fstream>
 #include <stdexcept>
 #include <algorithm>
 #include <map>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <shared_mutex>
+#include <mutex>
+#include <exception>
 #include "base.h"             // Assuming Model is defined here
 #include "data_handling.h"   // Assuming Data, toDouble(), etc. are defined here
+#include "distance.h"
+#include "parallel.h"
+#include "serialize.h"
+#include "kd_tree.cpp"
+#include "ball_tree.cpp"
+#include "hnsw.cpp"
+#include "ivf_pq.cpp"
+#include "lsh.cpp"
 #include "gnuplot-iostream.h"
 
 
@@ -17,8 +32,68 @@ using namespace std;
 
 class KNN : public Model {
 public:
-    handle::Data trainingData; // Storage for the training data.
+    // Strategy used to find the k closest training examples.
+    enum class Algorithm {
+        Auto,        // Pick one of the strategies below from the data shape.
+        BruteForce,  // Scan every training row.
+        KDTree,      // Exact search over a KD-tree built in train().
+        BallTree,    // Exact search over a ball tree built in train().
+        HNSW,        // Approximate search over an HNSW graph (never chosen by Auto).
+        IVFPQ,       // Approximate search over product-quantised inverted lists (never chosen by Auto).
+        LSH          // Approximate search over locality-sensitive hash tables (never chosen by Auto).
+    };
+
+    // How neighbours are weighted in votes and regression.
+    enum class Weighting {
+        Uniform,     // Every neighbour counts once.
+        Distance     // Neighbours count 1 / distance; exact matches (distance 0) outweigh all others.
+    };
+
     int k;           // Number of closest neighbours to consider.
+    Algorithm algorithm = Algorithm::Auto;   // Requested neighbour search strategy.
+    Algorithm searchAlgorithm = Algorithm::BruteForce; // Strategy chosen by train().
+    metric::Metric distanceMetric = metric::Metric::Euclidean; // Distance used for neighbours.
+    int minkowskiP = 2;        // Exponent when distanceMetric is Minkowski (1 to metric::MAX_MINKOWSKI_P).
+    Weighting weighting = Weighting::Uniform; // Neighbour weights in predictions.
+    size_t numRows = 0;        // Number of training rows.
+    size_t numFeatures = 0;    // Number of features per training row.
+    handle::MappedArray<double> points;     // Training features, row-major (m * numFeatures).
+    handle::MappedArray<double> pointNorms; // Squared L2 norm of every training row (batch brute force only).
+    handle::MappedArray<int> labels;        // Label code of every training row.
+    vector<string> labelNames; // Label code -> label string, sorted.
+    vector<double> featureMean;  // Optional scaler: every training row and query is mapped to
+    vector<double> featureScale; // (x - featureMean) / featureScale before use; empty = no scaling.
+    KDTree kdTree;             // Index over points (when searchAlgorithm is KDTree).
+    BallTree ballTree;         // Index over points (when searchAlgorithm is BallTree).
+    HNSW hnsw;                 // Graph over points (when searchAlgorithm is HNSW); set M/ef* before train().
+    IVFPQ ivfpq;               // Compressed index (when searchAlgorithm is IVFPQ); set nlist/nprobe/rerank before train().
+    LSH lsh;                   // Hash tables (when searchAlgorithm is LSH); set numTables/numHashes/probes before train().
+    handle::MappedArray<size_t> rowIds; // Stable id of every base row, ascending.
+    vector<char> removed;      // Tombstone flag per base row (empty until a row is removed).
+    size_t removedCount = 0;   // Number of tombstoned base rows.
+    vector<double> deltaPoints; // Rows added since the last compaction, prepared like points.
+    vector<int> deltaLabels;   // Label code of every delta row.
+    vector<size_t> deltaIds;   // Id of every delta row, ascending.
+    size_t nextId = 0;         // Id given to the next added row.
+
+    // Below this many rows a linear scan is as fast as any index.
+    static constexpr size_t BRUTE_FORCE_MAX_ROWS = 2048;
+    // KD-tree pruning degrades quickly above this many dimensions.
+    static constexpr size_t KD_TREE_MAX_DIMS = 10;
+    // Above this many dimensions even ball trees visit most leaves.
+    static constexpr size_t BALL_TREE_MAX_DIMS = 100;
+    // From this many dimensions batch brute force uses the dot-product expansion.
+    static constexpr size_t GEMM_MIN_DIMS = 16;
+    // Query rows and training rows per distance tile in the batch path.
+    static constexpr size_t QUERY_BLOCK = 64;
+    static constexpr size_t TRAIN_BLOCK = 256;
+    // Model file signature and format version (see save()).
+    static constexpr const char *MODEL_MAGIC = "KNNM";
+    static constexpr uint64_t MODEL_VERSION = 6;
+    // A background compaction starts once delta rows plus tombstones exceed
+    // max(COMPACT_MIN_ROWS, numRows / COMPACT_FRACTION).
+    static constexpr size_t COMPACT_MIN_ROWS = 256;
+    static constexpr size_t COMPACT_FRACTION = 16;
 
     /**
      * @brief Constructor for KNN.
@@ -30,18 +105,391 @@ public:
      * @param ep Not used.
      */
     KNN(int k_val = 3, double lr = 0.0, int ep = 0)
-        : Model(lr, ep), k(k_val) {}
+        : Model(lr, ep), k(k_val), updates(make_unique<UpdateState>()) {}
+
+    // A background compaction refers to the object that started it, so models are not copied.
+    KNN(const KNN &) = delete;
+    KNN &operator=(const KNN &) = delete;
+
+    /**
+     * @brief Waits for a running background compaction, which refers to this object.
+     */
+    ~KNN() override {
+        if (updates->worker.joinable()) {
+            updates->worker.join();
+        }
+    }
+
+    /**
+     * @brief Resolves Algorithm::Auto for a training set of m rows and n features.
+     *
+     * Small sets use brute force, low-dimensional sets a KD-tree, medium
+     * dimensions a ball tree and very high dimensions fall back to brute force.
+     */
+    static Algorithm chooseAlgorithm(size_t m, size_t n) {
+        if (m <= BRUTE_FORCE_MAX_ROWS) return Algorithm::BruteForce;
+        if (n <= KD_TREE_MAX_DIMS) return Algorithm::KDTree;
+        if (n <= BALL_TREE_MAX_DIMS) return Algorithm::BallTree;
+        return Algorithm::BruteForce;
+    }
 
     /**
      * @brief Train the KNN model.
      * 
-     * For KNN, training simply means storing the training data.
+     * Parses the features once into a contiguous row-major buffer
+     * (L2-normalised for the cosine metric), encodes the labels and builds the
+     * search index selected by `algorithm`. The Data object itself is not kept.
+     * IVF-PQ without re-ranking only keeps the compressed codes.
      * 
      * @param data The training data.
+     * @throws runtime_error if the feature rows have inconsistent sizes.
      */
     void* train(handle::Data &data) override {
-        trainingData = data;
-        return nullptr; // No training needed for KNN.
+        waitForCompaction();
+        unique_lock<shared_mutex> lock(updates->lock);
+        size_t m = data.features.size();
+        numRows = m;
+        numFeatures = m == 0 ? 0 : data.features[0].size();
+        vector<double> &rows = points.own();
+        rows.assign(m * numFeatures, 0.0);
+        for (size_t i = 0; i < m; i++) {
+            if (data.features[i].size() != numFeatures) {
+                throw runtime_error("Inconsistent feature dimensions in data.");
+            }
+            for (size_t j = 0; j < numFeatures; j++) {
+                rows[i * numFeatures + j] = handle::toDouble(data.features[i][j]);
+            }
+        }
+        scaleRows(rows.data(), m);
+        if (distanceMetric == metric::Metric::Cosine) {
+            metric::normalizeRows(rows.data(), m, numFeatures);
+        }
+
+        // Encode labels as integers. Codes follow the sorted label order so that
+        // ties in the vote still resolve to the lexicographically smallest label.
+        labelNames = data.target;
+        sort(labelNames.begin(), labelNames.end());
+        labelNames.erase(unique(labelNames.begin(), labelNames.end()), labelNames.end());
+        vector<int> &codes = labels.own();
+        codes.resize(m);
+        for (size_t i = 0; i < m; i++) {
+            codes[i] = static_cast<int>(lower_bound(labelNames.begin(), labelNames.end(), data.target[i]) - labelNames.begin());
+        }
+
+        vector<size_t> &ids = rowIds.own();
+        ids.resize(m);
+        iota(ids.begin(), ids.end(), 0);
+        nextId = m;
+        removed.clear();
+        removedCount = 0;
+        deltaPoints.clear();
+        deltaLabels.clear();
+        deltaIds.clear();
+        buildIndex();
+        return nullptr; // No parameters to return for KNN.
+    }
+
+    /**
+     * @brief Resolves `algorithm` and builds the search index over points (numRows rows).
+     *
+     * @throws invalid_argument for an unsupported Minkowski exponent, or for an
+     *         approximate index with a metric other than Euclidean, Manhattan or cosine.
+     */
+    void buildIndex() {
+        size_t m = numRows;
+        searchAlgorithm = algorithm == Algorithm::Auto ? chooseAlgorithm(m, numFeatures) : algorithm;
+        metric::checkMetric(distanceMetric, minkowskiP);
+        metric::Metric searched = metric::searchMetric(distanceMetric, minkowskiP);
+        bool approximate = searchAlgorithm == Algorithm::HNSW || searchAlgorithm == Algorithm::IVFPQ ||
+                           searchAlgorithm == Algorithm::LSH;
+        if (approximate && searched != metric::Metric::Euclidean && searched != metric::Metric::Manhattan) {
+            throw invalid_argument("HNSW, IVF-PQ and LSH only support Euclidean, Manhattan and cosine distances.");
+        }
+        pointNorms.clear();
+        const vector<double> &rows = points.own();
+        if (searchAlgorithm == Algorithm::BruteForce && useDistanceTiles()) {
+            vector<double> &norms = pointNorms.own();
+            norms.resize(m);
+            for (size_t i = 0; i < m; i++) {
+                norms[i] = inner_product(&rows[i * numFeatures], &rows[(i + 1) * numFeatures], &rows[i * numFeatures], 0.0);
+            }
+        }
+        kdTree = KDTree();
+        ballTree = BallTree();
+        if (searchAlgorithm == Algorithm::KDTree) {
+            kdTree.build(rows, m, numFeatures, distanceMetric, minkowskiP);
+        } else if (searchAlgorithm == Algorithm::BallTree) {
+            ballTree.build(rows, m, numFeatures, distanceMetric, minkowskiP);
+        }
+        if (searchAlgorithm == Algorithm::HNSW) {
+            hnsw.build(rows, m, numFeatures, searched);
+        } else {
+            hnsw.clear();
+        }
+        if (searchAlgorithm == Algorithm::IVFPQ) {
+            ivfpq.build(rows, m, numFeatures, searched);
+            if (ivfpq.rerank == 0) {
+                points.clear();
+            }
+        } else {
+            ivfpq.clear();
+        }
+        if (searchAlgorithm == Algorithm::LSH) {
+            lsh.build(rows, m, numFeatures, distanceMetric == metric::Metric::Cosine ? distanceMetric : searched);
+        } else {
+            lsh.clear();
+        }
+    }
+
+    /**
+     * @brief Finds the kk nearest training rows to a query.
+     *
+     * @param query A vector of numFeatures feature values.
+     * @param kk Number of neighbours to return.
+     * @param out Filled with (reduced distance, training row index), nearest first.
+     *            Reduced distances are squared for Euclidean and cosine, and
+     *            sums of |d|^p for Minkowski (see metric::fromReduced()). Rows
+     *            added since the last compaction follow the base rows; rowId()
+     *            maps a row index to its stable id.
+     */
+    void findNeighbours(const vector<double> &query, size_t kk, vector<pair<double, size_t>> &out) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        neighboursUnlocked(query, kk, out);
+    }
+
+    void neighboursUnlocked(const vector<double> &query, size_t kk, vector<pair<double, size_t>> &out) const {
+        if (distanceMetric == metric::Metric::Cosine || !featureMean.empty()) {
+            vector<double> row = query;
+            scaleRows(row.data(), 1);
+            if (distanceMetric == metric::Metric::Cosine) {
+                metric::normalizeRows(row.data(), 1, row.size());
+            }
+            searchRow(row.data(), kk, out);
+        } else {
+            searchRow(query.data(), kk, out);
+        }
+    }
+
+    /**
+     * @brief Applies the optional feature scaler in place to `count` rows of numFeatures values.
+     *
+     * @throws runtime_error if the scaler does not have numFeatures entries.
+     */
+    void scaleRows(double *rows, size_t count) const {
+        if (featureMean.empty()) {
+            return;
+        }
+        if (featureMean.size() != numFeatures || featureScale.size() != numFeatures) {
+            throw runtime_error("Feature scaler size does not match training data.");
+        }
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = 0; j < numFeatures; j++) {
+                rows[i * numFeatures + j] = (rows[i * numFeatures + j] - featureMean[j]) / featureScale[j];
+            }
+        }
+    }
+
+    /**
+     * @brief Finds the kk nearest training rows for a batch of queries.
+     *
+     * Queries are processed in parallel blocks. With brute force on Euclidean
+     * or cosine data of GEMM_MIN_DIMS+ columns, distances are computed a tile
+     * at a time as ||q||^2 + ||t||^2 - 2 q.t from precomputed norms, with the
+     * dot products done as a cache-blocked matrix product; the selected
+     * neighbours are then re-scored exactly. Otherwise every query runs the
+     * single-query search of the active index.
+     *
+     * @param queries Row-major buffer of q * numFeatures values, prepared by prepareQueries().
+     * @param q Number of queries.
+     * @param kk Number of neighbours per query.
+     * @param rows Filled with q * width training row indices, nearest first.
+     * @param dists Filled with the matching q * width reduced distances.
+     * @param counts Filled with the number of neighbours found for every query.
+     *               Approximate indexes may find fewer than width; query i's
+     *               slots from counts[i] on are unused.
+     * @return width = min(kk, number of training rows).
+     */
+    size_t batchNeighbours(const vector<double> &queries, size_t q, size_t kk,
+                           vector<size_t> &rows, vector<double> &dists, vector<size_t> &counts) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        return batchUnlocked(queries, q, kk, rows, dists, counts);
+    }
+
+    size_t batchUnlocked(const vector<double> &queries, size_t q, size_t kk,
+                         vector<size_t> &rows, vector<double> &dists, vector<size_t> &counts) const {
+        size_t width = min(kk, liveRows());
+        rows.assign(q * width, 0);
+        dists.assign(q * width, 0.0);
+        counts.assign(q, 0);
+        if (width == 0 || q == 0) {
+            return width;
+        }
+
+        if (searchAlgorithm == Algorithm::BruteForce && useDistanceTiles() && !hasPendingUpdates()) {
+            size_t blocks = (q + QUERY_BLOCK - 1) / QUERY_BLOCK;
+            handle::parallelFor(blocks, [&](size_t b0, size_t b1) {
+                for (size_t b = b0; b < b1; b++) {
+                    size_t first = b * QUERY_BLOCK;
+                    tileBlock(queries, first, min(q, first + QUERY_BLOCK), width, rows, dists, counts);
+                }
+            });
+            return width;
+        }
+
+        handle::parallelFor(q, [&](size_t begin, size_t end) {
+            vector<pair<double, size_t>> found;
+            for (size_t i = begin; i < end; i++) {
+                searchRow(&queries[i * numFeatures], width, found);
+                counts[i] = found.size();
+                for (size_t j = 0; j < found.size(); j++) {
+                    dists[i * width + j] = found[j].first;
+                    rows[i * width + j] = found[j].second;
+                }
+            }
+        }, 16);
+        return width;
+    }
+
+    /**
+     * @brief Parses the features of a dataset into a contiguous query buffer.
+     *
+     * @param data A Data object containing query examples.
+     * @return Row-major buffer of data.features.size() * numFeatures values
+     *         (scaled, then L2-normalised for the cosine metric).
+     * @throws runtime_error if a row does not have numFeatures values.
+     */
+    vector<double> prepareQueries(handle::Data &data) const {
+        size_t q = data.features.size();
+        vector<double> queries(q * numFeatures);
+        for (size_t i = 0; i < q; i++) {
+            if (data.features[i].size() != numFeatures) {
+                throw runtime_error("Query feature size does not match training data.");
+            }
+            for (size_t j = 0; j < numFeatures; j++) {
+                queries[i * numFeatures + j] = handle::toDouble(data.features[i][j]);
+            }
+        }
+        scaleRows(queries.data(), q);
+        if (distanceMetric == metric::Metric::Cosine) {
+            metric::normalizeRows(queries.data(), q, numFeatures);
+        }
+        return queries;
+    }
+
+    /**
+     * @brief Predicts a label code for every query row of a dataset.
+     *
+     * @param names If not null, receives the label dictionary the codes refer to.
+     * @throws runtime_error if there is no training data or if a query size mismatches.
+     */
+    vector<int> predictCodes(handle::Data &data, vector<string> *names = nullptr) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        if (liveRows() == 0) {
+            throw runtime_error("No training data available.");
+        }
+        size_t q = data.features.size();
+        vector<double> queries = prepareQueries(data);
+        vector<size_t> rows, counts;
+        vector<double> dists;
+        size_t width = batchUnlocked(queries, q, static_cast<size_t>(max(k, 0)), rows, dists, counts);
+        if (names != nullptr) {
+            *names = labelNames;
+        }
+
+        vector<int> codes(q);
+        vector<int> freq;
+        vector<double> weights, scores;
+        for (size_t i = 0; i < q; i++) {
+            codes[i] = weighting == Weighting::Uniform
+                           ? voteRows(&rows[i * width], counts[i], freq)
+                           : weightedVote(&rows[i * width], &dists[i * width], counts[i], weights, scores);
+        }
+        return codes;
+    }
+
+    /**
+     * @brief Runs the active search for one prepared (already normalised) query.
+     *
+     * The base index skips tombstoned rows while it scans, so its kk best are
+     * all live; rows added since the last compaction are then merged in by a
+     * linear scan of the delta buffer.
+     */
+    void searchRow(const double *q, size_t kk, vector<pair<double, size_t>> &out) const {
+        searchBase(q, kk, out);
+        if (!deltaIds.empty() && kk > 0) {
+            metric::withKernel(distanceMetric, minkowskiP, numFeatures, [&](auto kernel) {
+                mergeDelta<decltype(kernel)>(q, kk, out);
+            });
+        }
+    }
+
+    // Offers every delta row (as row numRows + j) to the sorted neighbour list `out`.
+    template <class Dist>
+    void mergeDelta(const double *q, size_t kk, vector<pair<double, size_t>> &out) const {
+        make_heap(out.begin(), out.end());
+        for (size_t j = 0; j < deltaIds.size(); j++) {
+            const double *row = &deltaPoints[j * numFeatures];
+            double dist = out.size() < kk ? Dist::reduced(row, q, numFeatures)
+                                          : Dist::reducedBounded(row, q, numFeatures, out.front().first);
+            metric::offerCandidate(out, kk, dist, numRows + j);
+        }
+        sort_heap(out.begin(), out.end());
+    }
+
+    // Appends the live rows (base and delta) within reduced distance `bound` of one prepared query.
+    void radiusRow(const double *q, double bound, vector<pair<double, size_t>> &out) const {
+        size_t before = out.size();
+        if (searchAlgorithm == Algorithm::KDTree) {
+            kdTree.radiusQuery(q, bound, out);
+        } else if (searchAlgorithm == Algorithm::BallTree) {
+            ballTree.radiusQuery(q, bound, out);
+        } else {
+            metric::withKernel(distanceMetric, minkowskiP, numFeatures, [&](auto kernel) {
+                radiusScan<decltype(kernel)>(q, bound, points.data(), numRows, 0, out);
+            });
+        }
+        if (removedCount > 0) {
+            out.erase(remove_if(out.begin() + before, out.end(),
+                                [&](const pair<double, size_t> &c) { return removed[c.second] != 0; }),
+                      out.end());
+        }
+        if (!deltaIds.empty()) {
+            metric::withKernel(distanceMetric, minkowskiP, numFeatures, [&](auto kernel) {
+                radiusScan<decltype(kernel)>(q, bound, deltaPoints.data(), deltaIds.size(), numRows, out);
+            });
+        }
+    }
+
+    // Appends (distance, first + i) for every one of `count` rows within `bound`.
+    template <class Dist>
+    void radiusScan(const double *q, double bound, const double *rowsData, size_t count, size_t first,
+                    vector<pair<double, size_t>> &out) const {
+        for (size_t i = 0; i < count; i++) {
+            double dist = Dist::reducedBounded(&rowsData[i * numFeatures], q, numFeatures, bound);
+            if (dist <= bound) {
+                out.emplace_back(dist, first + i);
+            }
+        }
+    }
+
+    // Dispatches one query to the index built over the base rows, skipping tombstones.
+    void searchBase(const double *q, size_t kk, vector<pair<double, size_t>> &out) const {
+        const char *skip = removedCount > 0 ? removed.data() : nullptr;
+        if (searchAlgorithm == Algorithm::KDTree) {
+            kdTree.query(q, kk, out, skip);
+        } else if (searchAlgorithm == Algorithm::BallTree) {
+            ballTree.query(q, kk, out, skip);
+        } else if (searchAlgorithm == Algorithm::HNSW) {
+            hnsw.query(q, kk, out, points.data(), skip);
+        } else if (searchAlgorithm == Algorithm::IVFPQ) {
+            ivfpq.query(q, kk, out, points.empty() ? nullptr : points.data(), skip);
+        } else if (searchAlgorithm == Algorithm::LSH) {
+            lsh.query(q, kk, out, points.data(), skip);
+        } else {
+            metric::withKernel(distanceMetric, minkowskiP, numFeatures, [&](auto kernel) {
+                bruteForce<decltype(kernel)>(q, kk, skip, out);
+            });
+        }
     }
 
     /**
@@ -52,48 +500,303 @@ public:
      * @throws runtime_error if there is no training data or if the query size mismatches.
      */
     string predictOne(const vector<double> &query) {
-        size_t m = trainingData.features.size();
-        if (m == 0) {
+        shared_lock<shared_mutex> lock(updates->lock);
+        if (liveRows() == 0) {
             throw runtime_error("No training data available.");
         }
-        size_t n = trainingData.features[0].size();
+        size_t n = numFeatures;
         if (query.size() != n) {
             throw runtime_error("Query feature size does not match training data.");
         }
-        
-        // Compute the squared Euclidean distance from the query to each training example.
-        vector<pair<double, string>> distances;
-        for (size_t i = 0; i < m; i++) {
-            double distance = 0.0;
-            for (size_t j = 0; j < n; j++) {
-                double value = handle::toDouble(trainingData.features[i][j]);
-                double diff = value - query[j];
-                distance += diff * diff;
-            }
-            distances.push_back(make_pair(distance, trainingData.target[i]));
+
+        vector<pair<double, size_t>> neighbours;
+        neighboursUnlocked(query, static_cast<size_t>(max(k, 0)), neighbours);
+
+        return labelNames[vote(neighbours)];
+    }
+
+    /**
+     * @brief Saves the trained model to a binary file.
+     *
+     * The file holds the packed feature buffer, squared norms, label codes and
+     * row ids, the label dictionary, the feature scaler and the built search
+     * index, so load() needs no CSV parsing, label encoding or index construction.
+     * The row arrays and the KD-tree and ball tree arrays are 64-byte aligned
+     * so that load() can use them in place.
+     *
+     * @param path Output file path.
+     * @throws runtime_error if the file cannot be written or updates are pending.
+     */
+    void save(const string &path) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        if (hasPendingUpdates()) {
+            throw runtime_error("KNN model has pending updates; call compact() before save().");
+        }
+        ofstream out(path, ios::binary);
+        if (!out) {
+            throw runtime_error("Cannot open file " + path);
+        }
+        out.write(MODEL_MAGIC, 4);
+        uint64_t header[7] = {MODEL_VERSION, static_cast<uint64_t>(k), static_cast<uint64_t>(searchAlgorithm),
+                              static_cast<uint64_t>(distanceMetric), numRows, numFeatures,
+                              static_cast<uint64_t>(minkowskiP)};
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        handle::writeArray(out, points);
+        handle::writeArray(out, pointNorms);
+        handle::writeArray(out, labels);
+        handle::writeArray(out, rowIds);
+        handle::writeVector(out, featureMean);
+        handle::writeVector(out, featureScale);
+        uint64_t names = labelNames.size();
+        out.write(reinterpret_cast<const char *>(&names), sizeof(names));
+        for (const auto &name : labelNames) {
+            handle::writeString(out, name);
+        }
+        if (searchAlgorithm == Algorithm::KDTree) {
+            kdTree.save(out);
+        } else if (searchAlgorithm == Algorithm::BallTree) {
+            ballTree.save(out);
+        } else if (searchAlgorithm == Algorithm::HNSW) {
+            hnsw.save(out);
+        } else if (searchAlgorithm == Algorithm::IVFPQ) {
+            ivfpq.save(out);
+        } else if (searchAlgorithm == Algorithm::LSH) {
+            lsh.save(out);
         }
+        if (!out) {
+            throw runtime_error("Failed to write KNN model to " + path);
+        }
+    }
 
-        // Sort training examples by increasing distance.
-        sort(distances.begin(), distances.end(), [](const pair<double, string> &a, const pair<double, string> &b) {
-            return a.first < b.first;
-        });
+    /**
+     * @brief Loads a model written by save(), replacing the current one.
+     *
+     * The file is memory-mapped read-only. The training rows, norms, label
+     * codes, row ids and the KD-tree or ball tree arrays are served straight
+     * from the mapping, so opening a model costs the same whatever its size;
+     * pages are read as queries touch them. Only the label dictionary, the
+     * scaler and the HNSW, IVF-PQ and LSH structures are copied out. An
+     * array is copied into memory only if the model later changes it (an
+     * add() with LSH, a new label, compaction or retraining).
+     *
+     * @param path Model file path.
+     * @throws runtime_error if the file cannot be read or is not a KNN model.
+     */
+    void load(const string &path) {
+        waitForCompaction();
+        unique_lock<shared_mutex> lock(updates->lock);
+        handle::MemoryBuffer buffer(make_shared<const handle::MappedFile>(path));
+        istream in(&buffer);
+        char magic[4];
+        uint64_t header[7];
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (!in || memcmp(magic, MODEL_MAGIC, 4) != 0 || header[0] != MODEL_VERSION) {
+            throw runtime_error("Not a valid KNN model file: " + path);
+        }
+        k = static_cast<int>(header[1]);
+        searchAlgorithm = static_cast<Algorithm>(header[2]);
+        algorithm = searchAlgorithm;
+        distanceMetric = static_cast<metric::Metric>(header[3]);
+        numRows = header[4];
+        numFeatures = header[5];
+        minkowskiP = static_cast<int>(header[6]);
+        handle::readArray(in, points);
+        handle::readArray(in, pointNorms);
+        handle::readArray(in, labels);
+        handle::readArray(in, rowIds);
+        handle::readVector(in, featureMean);
+        handle::readVector(in, featureScale);
+        uint64_t names = 0;
+        in.read(reinterpret_cast<char *>(&names), sizeof(names));
+        labelNames.assign(in ? names : 0, string());
+        for (auto &name : labelNames) {
+            handle::readString(in, name);
+        }
+        kdTree = KDTree();
+        ballTree = BallTree();
+        hnsw.clear();
+        ivfpq.clear();
+        lsh.clear();
+        if (searchAlgorithm == Algorithm::KDTree) {
+            kdTree.load(in);
+        } else if (searchAlgorithm == Algorithm::BallTree) {
+            ballTree.load(in);
+        } else if (searchAlgorithm == Algorithm::HNSW) {
+            hnsw.load(in);
+        } else if (searchAlgorithm == Algorithm::IVFPQ) {
+            ivfpq.load(in);
+        } else if (searchAlgorithm == Algorithm::LSH) {
+            lsh.load(in);
+        }
+        bool keepsPoints = !(searchAlgorithm == Algorithm::IVFPQ && ivfpq.rerank == 0);
+        if (!in || labels.size() != numRows || rowIds.size() != numRows ||
+            (keepsPoints && points.size() != numRows * numFeatures) ||
+            (!pointNorms.empty() && pointNorms.size() != numRows)) {
+            throw runtime_error("Corrupt KNN model file: " + path);
+        }
+        nextId = rowIds.empty() ? 0 : rowIds.back() + 1;
+        removed.clear();
+        removedCount = 0;
+        deltaPoints.clear();
+        deltaLabels.clear();
+        deltaIds.clear();
+    }
 
-        // Vote among the k closest neighbours.
-        map<string, int> freq;
-        for (int i = 0; i < k && i < distances.size(); i++) {
-            freq[distances[i].second]++;
+    /**
+     * @brief Majority vote over the label codes of a neighbour list.
+     *
+     * @param neighbours (distance, training row index) pairs, nearest first.
+     * @return The most frequent label code; ties go to the smallest code.
+     */
+    int vote(const vector<pair<double, size_t>> &neighbours) const {
+        vector<size_t> rows;
+        vector<double> dists;
+        for (int i = 0; i < k && i < static_cast<int>(neighbours.size()); i++) {
+            rows.push_back(neighbours[i].second);
+            dists.push_back(neighbours[i].first);
+        }
+        if (weighting == Weighting::Distance) {
+            vector<double> weights, scores;
+            return weightedVote(rows.data(), dists.data(), rows.size(), weights, scores);
+        }
+        vector<int> freq;
+        return voteRows(rows.data(), rows.size(), freq);
+    }
+
+    /**
+     * @brief Majority vote over `count` training rows, using freq as scratch space.
+     */
+    int voteRows(const size_t *rows, size_t count, vector<int> &freq) const {
+        freq.assign(labelNames.size(), 0);
+        for (size_t i = 0; i < count; i++) {
+            freq[labelOf(rows[i])]++;
+        }
+        return static_cast<int>(max_element(freq.begin(), freq.end()) - freq.begin());
+    }
+
+    /**
+     * @brief Distance-weighted vote over `count` training rows with reduced distances dists.
+     *
+     * @return The label code with the largest total weight; ties go to the smallest code.
+     */
+    int weightedVote(const size_t *rows, const double *dists, size_t count, vector<double> &weights,
+                     vector<double> &scores) const {
+        neighbourWeights(dists, count, weights);
+        scores.assign(labelNames.size(), 0.0);
+        for (size_t i = 0; i < count; i++) {
+            scores[labelOf(rows[i])] += weights[i];
+        }
+        return static_cast<int>(max_element(scores.begin(), scores.end()) - scores.begin());
+    }
+
+    /**
+     * @brief Weights of `count` neighbours with reduced distances dists (see Weighting).
+     */
+    void neighbourWeights(const double *dists, size_t count, vector<double> &weights) const {
+        weights.assign(count, 1.0);
+        if (weighting == Weighting::Uniform) {
+            return;
+        }
+        bool exact = false;
+        for (size_t i = 0; i < count; i++) {
+            exact = exact || dists[i] <= 0.0;
+        }
+        for (size_t i = 0; i < count; i++) {
+            weights[i] = exact ? (dists[i] <= 0.0 ? 1.0 : 0.0)
+                               : 1.0 / metric::fromReduced(distanceMetric, dists[i], minkowskiP);
+        }
+    }
+
+    /**
+     * @brief k-nearest-neighbour regression.
+     *
+     * Predicts the mean target of the k nearest rows, weighted by `weighting`,
+     * with the same batch search as predict(). Targets are the labels parsed
+     * as numbers (0.0 when a label is not numeric).
+     *
+     * @param data A Data object containing query examples.
+     * @throws runtime_error if there is no training data or if a query size mismatches.
+     */
+    vector<double> regress(handle::Data &data) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        if (liveRows() == 0) {
+            throw runtime_error("No training data available.");
         }
+        size_t q = data.features.size();
+        vector<double> queries = prepareQueries(data);
+        vector<size_t> rows, counts;
+        vector<double> dists;
+        size_t width = batchUnlocked(queries, q, static_cast<size_t>(max(k, 0)), rows, dists, counts);
+        vector<double> values = labelValues(labelNames);
 
-        // Find the label with the highest frequency.
-        string bestLabel;
-        int maxCount = -1;
-        for (const auto &entry : freq) {
-            if (entry.second > maxCount) {
-                bestLabel = entry.first;
-                maxCount = entry.second;
+        vector<double> predictions(q, 0.0);
+        vector<double> weights;
+        for (size_t i = 0; i < q; i++) {
+            neighbourWeights(&dists[i * width], counts[i], weights);
+            double sum = 0.0, total = 0.0;
+            for (size_t j = 0; j < counts[i]; j++) {
+                sum += weights[j] * values[labelOf(rows[i * width + j])];
+                total += weights[j];
             }
+            predictions[i] = total > 0.0 ? sum / total : 0.0;
         }
-        return bestLabel;
+        return predictions;
+    }
+
+    /**
+     * @brief Finds every training row within `radius` of each query, in CSR form.
+     *
+     * Query i's neighbours are rows[offsets[i] .. offsets[i + 1]) with matching
+     * reduced distances in dists, nearest first. KD-trees and ball trees prune
+     * by the radius; every other strategy scans the raw rows exactly. Queries
+     * run in parallel blocks that each append to one buffer, so no memory is
+     * allocated per query.
+     *
+     * @param queries Row-major buffer of q * numFeatures values, prepared by prepareQueries().
+     * @param q Number of queries.
+     * @param radius Inclusive radius in the metric's true units (1 - cos for cosine).
+     * @param offsets Filled with q + 1 offsets into rows/dists.
+     * @param rows Filled with the neighbour row indices (see rowId()).
+     * @param dists Filled with the matching reduced distances.
+     * @return The total number of neighbours found.
+     * @throws runtime_error if the index keeps no raw rows (IVF-PQ without re-ranking).
+     */
+    size_t radiusNeighbours(const vector<double> &queries, size_t q, double radius, vector<size_t> &offsets,
+                            vector<size_t> &rows, vector<double> &dists) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        if (numRows > 0 && points.empty()) {
+            throw runtime_error("IVF-PQ without re-ranking keeps no raw rows for radius queries.");
+        }
+        double bound = metric::toReduced(distanceMetric, radius, minkowskiP);
+        size_t blocks = (q + QUERY_BLOCK - 1) / QUERY_BLOCK;
+        vector<vector<pair<double, size_t>>> found(blocks);
+        offsets.assign(q + 1, 0);
+        handle::parallelFor(blocks, [&](size_t b0, size_t b1) {
+            for (size_t b = b0; b < b1; b++) {
+                for (size_t i = b * QUERY_BLOCK; i < min(q, (b + 1) * QUERY_BLOCK); i++) {
+                    size_t before = found[b].size();
+                    radiusRow(&queries[i * numFeatures], bound, found[b]);
+                    sort(found[b].begin() + before, found[b].end());
+                    offsets[i + 1] = found[b].size() - before;
+                }
+            }
+        });
+        for (size_t i = 0; i < q; i++) {
+            offsets[i + 1] += offsets[i];
+        }
+        rows.resize(offsets[q]);
+        dists.resize(offsets[q]);
+        handle::parallelFor(blocks, [&](size_t b0, size_t b1) {
+            for (size_t b = b0; b < b1; b++) {
+                size_t at = offsets[b * QUERY_BLOCK];
+                for (auto &c : found[b]) {
+                    dists[at] = c.first;
+                    rows[at++] = c.second;
+                }
+            }
+        });
+        return offsets[q];
     }
 
     /**
@@ -107,23 +810,160 @@ public:
      * @return A vector of doubles representing the predicted labels.
      */
     vector<double> predict(handle::Data &data) override {
+        vector<string> names;
+        vector<int> codes = predictCodes(data, &names);
+        // Convert each distinct label once.
+        vector<double> values = labelValues(names);
         vector<double> predictions;
-        for (auto &feat : data.features) {
-            vector<double> query;
-            for (auto &val : feat) {
-                query.push_back(handle::toDouble(val));
-            }
-            string label = predictOne(query);
+        for (int code : codes) {
+            predictions.push_back(values[code]);
+        }
+        return predictions;
+    }
+
+    /**
+     * @brief Numeric value of every label name (0.0 if it does not parse).
+     */
+    static vector<double> labelValues(const vector<string> &names) {
+        vector<double> values(names.size(), 0.0);
+        for (size_t c = 0; c < names.size(); c++) {
             try {
-                predictions.push_back(stod(label));
+                values[c] = stod(names[c]);
             } catch (...) {
-                predictions.push_back(0.0);  // Could not convert label to double.
+                values[c] = 0.0;  // Could not convert label to double.
             }
         }
-        return predictions;
+        return values;
     }
 
     
+    /**
+     * @brief Linear scan over all training rows keeping the kk best in a max-heap.
+     *
+     * Once the heap is full, a row's distance is only accumulated until it
+     * exceeds the current kk-th best, so most rows are rejected after a few
+     * columns. The scan is O(m log kk) instead of a full O(m log m) sort.
+     * Rows flagged in skip (tombstones) are passed over.
+     */
+    template <class Dist>
+    void bruteForce(const double *q, size_t kk, const char *skip, vector<pair<double, size_t>> &out) const {
+        out.clear();
+        if (kk == 0) {
+            return;
+        }
+        out.reserve(kk);
+        for (size_t i = 0; i < numRows; i++) {
+            if (skip != nullptr && skip[i]) {
+                continue;
+            }
+            const double *row = &points[i * numFeatures];
+            double dist = out.size() < kk ? Dist::reduced(row, q, numFeatures)
+                                          : Dist::reducedBounded(row, q, numFeatures, out.front().first);
+            metric::offerCandidate(out, kk, dist, i);
+        }
+        sort_heap(out.begin(), out.end());
+    }
+
+    // True when batch brute force should use the dot-product tiles.
+    bool useDistanceTiles() const {
+        return metric::isEuclidean(distanceMetric, minkowskiP) && numFeatures >= GEMM_MIN_DIMS;
+    }
+
+    /**
+     * @brief Batch brute force for queries [first, last) using distance tiles.
+     *
+     * Each training tile is packed column-major so the inner loop is a
+     * contiguous multiply-add over TRAIN_BLOCK values that the compiler
+     * vectorises; the packed tile stays in cache while every query of the
+     * block is scored against it.
+     */
+    void tileBlock(const vector<double> &queries, size_t first, size_t last, size_t width,
+                   vector<size_t> &rows, vector<double> &dists, vector<size_t> &counts) const {
+        size_t n = numFeatures;
+        size_t nq = last - first;
+        vector<double> packed(n * TRAIN_BLOCK);
+        vector<double> tile(nq * TRAIN_BLOCK);
+        vector<double> queryNorms(nq);
+        vector<vector<pair<double, size_t>>> heaps(nq);
+        for (size_t i = 0; i < nq; i++) {
+            const double *qi = &queries[(first + i) * n];
+            queryNorms[i] = inner_product(qi, qi + n, qi, 0.0);
+            heaps[i].reserve(width);
+        }
+
+        for (size_t t0 = 0; t0 < numRows; t0 += TRAIN_BLOCK) {
+            size_t nt = min(TRAIN_BLOCK, numRows - t0);
+            for (size_t j = 0; j < nt; j++) {
+                const double *row = &points[(t0 + j) * n];
+                for (size_t d = 0; d < n; d++) {
+                    packed[d * TRAIN_BLOCK + j] = row[d];
+                }
+            }
+            for (size_t i = 0; i < nq; i += 4) {
+                for (size_t j = 0; j < nt; j += 4) {
+                    dotKernel(queries, first + i, min<size_t>(4, nq - i), packed, j, min<size_t>(4, nt - j),
+                              &tile[i * TRAIN_BLOCK + j]);
+                }
+            }
+            for (size_t i = 0; i < nq; i++) {
+                const double *dot = &tile[i * TRAIN_BLOCK];
+                for (size_t j = 0; j < nt; j++) {
+                    double dist = max(0.0, queryNorms[i] + pointNorms[t0 + j] - 2.0 * dot[j]);
+                    metric::offerCandidate(heaps[i], width, dist, t0 + j);
+                }
+            }
+        }
+
+        // Re-score the selected neighbours exactly (with the kernel the
+        // single-query search uses) to remove expansion round-off.
+        for (size_t i = 0; i < nq; i++) {
+            const double *qi = &queries[(first + i) * n];
+            metric::withDimension<metric::Euclidean>(n, [&](auto kernel) {
+                for (auto &cand : heaps[i]) {
+                    cand.first = decltype(kernel)::reduced(&points[cand.second * n], qi, n);
+                }
+            });
+            sort(heaps[i].begin(), heaps[i].end());
+            counts[first + i] = heaps[i].size();
+            for (size_t j = 0; j < heaps[i].size(); j++) {
+                dists[(first + i) * width + j] = heaps[i][j].first;
+                rows[(first + i) * width + j] = heaps[i][j].second;
+            }
+        }
+    }
+
+    /**
+     * @brief 4x4 register-blocked dot products between queries and a packed tile.
+     *
+     * Computes out[i * TRAIN_BLOCK + j] = q_(row0+i) . t_(col0+j) for i < nr,
+     * j < nc. Each accumulator row is a 4-wide SIMD vector (metric::vec4d),
+     * so every packed training value is loaded once per 4 queries.
+     */
+    void dotKernel(const vector<double> &queries, size_t row0, size_t nr,
+                   const vector<double> &packed, size_t col0, size_t nc, double *out) const {
+        typedef metric::vec4d vec4;
+        size_t n = numFeatures;
+        const double *q[4];
+        for (size_t i = 0; i < 4; i++) {
+            q[i] = &queries[(row0 + min(i, nr - 1)) * n];
+        }
+        vec4 acc0 = {0, 0, 0, 0}, acc1 = acc0, acc2 = acc0, acc3 = acc0;
+        for (size_t d = 0; d < n; d++) {
+            vec4 t;
+            memcpy(&t, &packed[d * TRAIN_BLOCK + col0], sizeof(t));
+            acc0 += q[0][d] * t;
+            acc1 += q[1][d] * t;
+            acc2 += q[2][d] * t;
+            acc3 += q[3][d] * t;
+        }
+        const vec4 *acc[4] = {&acc0, &acc1, &acc2, &acc3};
+        for (size_t i = 0; i < nr; i++) {
+            for (size_t j = 0; j < nc; j++) {
+                out[i * TRAIN_BLOCK + j] = (*acc[i])[j];
+            }
+        }
+    }
+
     void plot(handle::Data& testData) {
         vector<double> predicted = predict(testData);
         if (testData.features.empty() || testData.features[0].size() < 2) {
@@ -180,16 +1020,446 @@ public:
      * @return A vector of strings representing the predicted labels.
      */
     vector<string> predictLabel(handle::Data &data) {
+        vector<string> names;
         vector<string> predictions;
-        for (auto &feat : data.features) {
-            vector<double> query;
-            for (auto &val : feat) {
-                query.push_back(handle::toDouble(val));
-            }
-            predictions.push_back(predictOne(query));
+        for (int code : predictCodes(data, &names)) {
+            predictions.push_back(names[code]);
         }
         return predictions;
     }
+
+    // Accuracy of every k from one neighbour computation (see selectK()).
+    struct KSelection {
+        vector<double> accuracy;  // accuracy[j] is the accuracy with k = j + 1.
+        int bestK = 0;            // Smallest k with the highest accuracy (0 if nothing was scored).
+    };
+
+    /**
+     * @brief Scores every k in [1, kMax] on a labelled validation set.
+     *
+     * The ordered neighbour lists are computed once for kMax with the parallel
+     * batch search; every smaller k is then a prefix of them, so its vote is
+     * updated incrementally while walking the list. The cost is about one
+     * predict() pass at k = kMax, whatever the number of candidate k.
+     * Votes are uniform (as with Weighting::Uniform) and break ties exactly
+     * like predict(). The model is not modified.
+     *
+     * @param data Validation examples with targets.
+     * @param kMax Largest k to score.
+     * @throws runtime_error if there is no training data or a query size mismatches.
+     */
+    KSelection selectK(handle::Data &data, size_t kMax) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        if (liveRows() == 0) {
+            throw runtime_error("No training data available.");
+        }
+        vector<double> queries = prepareQueries(data);
+        vector<int> truth(data.target.size());
+        for (size_t i = 0; i < truth.size(); i++) {
+            auto it = lower_bound(labelNames.begin(), labelNames.end(), data.target[i]);
+            truth[i] = it != labelNames.end() && *it == data.target[i] ? static_cast<int>(it - labelNames.begin()) : -1;
+        }
+        vector<size_t> self;
+        return scoreK(queries, truth, self, kMax);
+    }
+
+    /**
+     * @brief Leave-one-out selectK() over the training rows themselves.
+     *
+     * Each live row is queried with kMax + 1 neighbours and its own entry is
+     * dropped, which equals training without that row (ties keep their
+     * row-index order).
+     *
+     * @throws runtime_error if there is no training data or the index keeps no raw rows.
+     */
+    KSelection selectKLeaveOneOut(size_t kMax) const {
+        shared_lock<shared_mutex> lock(updates->lock);
+        if (liveRows() == 0) {
+            throw runtime_error("No training data available.");
+        }
+        if (numRows > 0 && points.empty()) {
+            throw runtime_error("IVF-PQ without re-ranking keeps no raw rows to leave out.");
+        }
+        size_t n = numFeatures;
+        vector<double> queries;
+        vector<int> truth;
+        vector<size_t> self;
+        queries.reserve(liveRows() * n);
+        for (size_t i = 0; i < numRows + deltaIds.size(); i++) {
+            if (i < numRows && removedCount > 0 && removed[i]) {
+                continue;
+            }
+            const double *row = i < numRows ? &points[i * n] : &deltaPoints[(i - numRows) * n];
+            queries.insert(queries.end(), row, row + n);
+            truth.push_back(labelOf(i));
+            self.push_back(i);
+        }
+        return scoreK(queries, truth, self, kMax);
+    }
+
+    /**
+     * @brief Adds one labelled example without retraining.
+     *
+     * The row is scaled/normalised like the training rows and appended to a
+     * delta buffer that every search scans next to the base index. Once the
+     * delta buffer and tombstones grow past the compaction threshold, a
+     * background thread rebuilds the index. LSH indexes absorb inserts
+     * directly, so with LSH the row is hashed into the tables and joins the
+     * base rows instead. Safe to call while other threads predict. A model
+     * that was never trained starts empty with this row's number of features
+     * and brute-force search.
+     *
+     * @param features numFeatures feature values.
+     * @param label The example's label.
+     * @return The row's stable id (see remove() and rowId()).
+     * @throws runtime_error if the feature count does not match or the index keeps no raw rows.
+     */
+    size_t add(const vector<double> &features, const string &label) {
+        unique_lock<shared_mutex> lock(updates->lock);
+        if (numRows == 0 && deltaIds.empty() && numFeatures == 0) {
+            numFeatures = features.size();
+            searchAlgorithm = Algorithm::BruteForce;
+        }
+        if (features.size() != numFeatures) {
+            throw runtime_error("Feature size does not match training data.");
+        }
+        if (numRows > 0 && points.empty()) {
+            throw runtime_error("IVF-PQ without re-ranking keeps no raw rows and cannot be updated.");
+        }
+        bool hashed = searchAlgorithm == Algorithm::LSH;
+        vector<double> &target = hashed ? points.own() : deltaPoints;
+        size_t first = target.size();
+        target.insert(target.end(), features.begin(), features.end());
+        scaleRows(&target[first], 1);
+        if (distanceMetric == metric::Metric::Cosine) {
+            metric::normalizeRows(&target[first], 1, numFeatures);
+        }
+        int code = labelCode(label);
+        if (hashed) {
+            lsh.insert(&points[first], 1);
+            labels.own().push_back(code);
+            rowIds.own().push_back(nextId);
+            if (!removed.empty()) {
+                removed.push_back(0);
+            }
+            numRows++;
+        } else {
+            deltaLabels.push_back(code);
+            deltaIds.push_back(nextId);
+        }
+        maybeCompact();
+        return nextId++;
+    }
+
+    /**
+     * @brief Removes the example with the given id.
+     *
+     * Base rows are tombstoned and skipped by every search until the next
+     * compaction drops them; delta rows are erased directly.
+     *
+     * @return false if no live row has this id.
+     */
+    bool remove(size_t id) {
+        unique_lock<shared_mutex> lock(updates->lock);
+        auto d = lower_bound(deltaIds.begin(), deltaIds.end(), id);
+        if (d != deltaIds.end() && *d == id) {
+            size_t j = d - deltaIds.begin();
+            deltaIds.erase(d);
+            deltaLabels.erase(deltaLabels.begin() + j);
+            deltaPoints.erase(deltaPoints.begin() + j * numFeatures, deltaPoints.begin() + (j + 1) * numFeatures);
+        } else {
+            auto b = lower_bound(rowIds.begin(), rowIds.end(), id);
+            size_t row = b - rowIds.begin();
+            if (b == rowIds.end() || *b != id || (!removed.empty() && removed[row])) {
+                return false;
+            }
+            if (removed.empty()) {
+                removed.assign(numRows, 0);
+            }
+            removed[row] = 1;
+            removedCount++;
+        }
+        if (updates->compacting) {
+            updates->removedDuring.push_back(id);
+        }
+        maybeCompact();
+        return true;
+    }
+
+    /**
+     * @brief Number of live rows (base rows without tombstones plus delta rows).
+     */
+    size_t liveRows() const {
+        return numRows - removedCount + deltaIds.size();
+    }
+
+    /**
+     * @brief Stable id of a row index returned by the neighbour searches.
+     */
+    size_t rowId(size_t row) const {
+        return row < numRows ? rowIds[row] : deltaIds[row - numRows];
+    }
+
+    /**
+     * @brief Folds the delta buffer and tombstones into a rebuilt index now.
+     *
+     * Waits for a running background compaction first.
+     * @throws The error of a failed background compaction, if any.
+     */
+    void compact() {
+        waitForCompaction();
+        {
+            unique_lock<shared_mutex> lock(updates->lock);
+            if (!hasPendingUpdates()) {
+                return;
+            }
+            updates->compacting = true;
+            updates->removedDuring.clear();
+        }
+        try {
+            runCompaction();
+        } catch (...) {
+            unique_lock<shared_mutex> lock(updates->lock);
+            updates->compacting = false;
+            throw;
+        }
+    }
+
+    /**
+     * @brief Blocks until a running background compaction has been swapped in.
+     *
+     * @throws The error of a failed background compaction, if any.
+     */
+    void waitForCompaction() {
+        thread worker;
+        exception_ptr error;
+        {
+            // add()/remove() may start a new worker concurrently; take it under the lock
+            // and join outside it, since the compaction needs the lock to swap.
+            unique_lock<shared_mutex> lock(updates->lock);
+            if (updates->worker.joinable() && updates->worker.get_id() != this_thread::get_id()) {
+                worker = move(updates->worker);
+            }
+        }
+        if (worker.joinable()) {
+            worker.join();
+        }
+        {
+            unique_lock<shared_mutex> lock(updates->lock);
+            swap(error, updates->error);
+        }
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+
+    bool hasPendingUpdates() const {
+        return removedCount > 0 || !deltaIds.empty();
+    }
+
+private:
+    // Reader/writer lock and background compaction state. Readers (searches
+    // and predictions) share the lock; add/remove/train and the final swap of
+    // a compaction take it exclusively. A compaction snapshots the live rows
+    // under a shared lock, rebuilds off-lock and only locks again to swap, so
+    // queries keep running while the index is rebuilt.
+    struct UpdateState {
+        shared_mutex lock;
+        thread worker;
+        bool compacting = false;          // A rebuild is in flight.
+        vector<size_t> removedDuring;     // Ids removed while it was rebuilding.
+        exception_ptr error;              // Failure of the last background rebuild.
+    };
+    unique_ptr<UpdateState> updates;
+
+    int labelOf(size_t row) const {
+        return row < numRows ? labels[row] : deltaLabels[row - numRows];
+    }
+
+    // Scores k = 1..kMax for prepared queries with true label codes (-1 never
+    // matches). When `self` is not empty, query i skips training row self[i].
+    KSelection scoreK(const vector<double> &queries, const vector<int> &truth, const vector<size_t> &self,
+                      size_t kMax) const {
+        KSelection result;
+        size_t q = truth.size();
+        size_t extra = self.empty() ? 0 : 1;
+        vector<size_t> rows, counts;
+        vector<double> dists;
+        size_t width = batchUnlocked(queries, q, kMax + extra, rows, dists, counts);
+        size_t depth = min(kMax, width - min(width, extra));
+        if (q == 0 || depth == 0) {
+            return result;
+        }
+
+        vector<size_t> correct(depth, 0);
+        mutex merge;
+        handle::parallelFor(q, [&](size_t begin, size_t end) {
+            vector<size_t> local(depth, 0);
+            vector<int> freq(labelNames.size());
+            for (size_t i = begin; i < end; i++) {
+                fill(freq.begin(), freq.end(), 0);
+                int best = -1;
+                size_t used = 0;
+                for (size_t j = 0; j < counts[i] && used < depth; j++) {
+                    size_t row = rows[i * width + j];
+                    if (extra && row == self[i]) {
+                        continue;
+                    }
+                    // Only one count grows, so the leader is either unchanged or this label.
+                    int c = labelOf(row);
+                    freq[c]++;
+                    if (best < 0 || freq[c] > freq[best] || (freq[c] == freq[best] && c < best)) {
+                        best = c;
+                    }
+                    local[used++] += best == truth[i] ? 1 : 0;
+                }
+                // A short list (approximate index) votes with all of its hits for
+                // every larger k, as predict() does; no hits predicts code 0.
+                for (int last = max(best, 0); used < depth; used++) {
+                    local[used] += last == truth[i] ? 1 : 0;
+                }
+            }
+            lock_guard<mutex> guard(merge);
+            for (size_t j = 0; j < depth; j++) {
+                correct[j] += local[j];
+            }
+        });
+
+        result.accuracy.resize(depth);
+        for (size_t j = 0; j < depth; j++) {
+            result.accuracy[j] = static_cast<double>(correct[j]) / q;
+            if (result.bestK == 0 || result.accuracy[j] > result.accuracy[result.bestK - 1]) {
+                result.bestK = static_cast<int>(j + 1);
+            }
+        }
+        return result;
+    }
+
+    // Code of a label, inserting it (and shifting larger codes) if it is new.
+    int labelCode(const string &label) {
+        auto it = lower_bound(labelNames.begin(), labelNames.end(), label);
+        int code = static_cast<int>(it - labelNames.begin());
+        if (it == labelNames.end() || *it != label) {
+            labelNames.insert(it, label);
+            for (auto &c : labels.own()) c += c >= code ? 1 : 0;
+            for (auto &c : deltaLabels) c += c >= code ? 1 : 0;
+        }
+        return code;
+    }
+
+    // Starts a background compaction if enough updates piled up (exclusive lock held).
+    void maybeCompact() {
+        size_t pending = removedCount + deltaIds.size();
+        if (updates->compacting || pending < max(COMPACT_MIN_ROWS, numRows / COMPACT_FRACTION)) {
+            return;
+        }
+        if (updates->worker.joinable()) {
+            updates->worker.join();  // Previous compaction already swapped in; only the thread exit is left.
+        }
+        updates->compacting = true;
+        updates->removedDuring.clear();
+        updates->worker = thread([this]() {
+            try {
+                runCompaction();
+            } catch (...) {
+                unique_lock<shared_mutex> lock(updates->lock);
+                updates->error = current_exception();
+                updates->compacting = false;
+            }
+        });
+    }
+
+    // Snapshot live rows, rebuild the index off-lock, then swap it in.
+    void runCompaction() {
+        KNN next(k);
+        next.algorithm = algorithm;
+        next.distanceMetric = distanceMetric;
+        next.minkowskiP = minkowskiP;
+        next.weighting = weighting;
+        next.hnsw = HNSW(hnsw.M, hnsw.efConstruction, hnsw.efSearch, hnsw.seed);
+        next.ivfpq = IVFPQ(ivfpq.nlist, ivfpq.nprobe, ivfpq.subspaces, ivfpq.rerank, ivfpq.seed);
+        next.lsh = LSH(lsh.numTables, lsh.numHashes, lsh.probes, lsh.bucketWidth, lsh.seed);
+        vector<string> snapshotNames;
+        size_t lastId;
+        {
+            shared_lock<shared_mutex> lock(updates->lock);
+            size_t n = numFeatures;
+            next.numFeatures = n;
+            next.numRows = liveRows();
+            vector<double> &rows = next.points.own();
+            vector<int> &codes = next.labels.own();
+            vector<size_t> &ids = next.rowIds.own();
+            rows.reserve(next.numRows * n);
+            for (size_t i = 0; i < numRows; i++) {
+                if (removedCount > 0 && removed[i]) {
+                    continue;
+                }
+                rows.insert(rows.end(), &points[i * n], &points[(i + 1) * n]);
+                codes.push_back(labels[i]);
+                ids.push_back(rowIds[i]);
+            }
+            rows.insert(rows.end(), deltaPoints.begin(), deltaPoints.end());
+            codes.insert(codes.end(), deltaLabels.begin(), deltaLabels.end());
+            ids.insert(ids.end(), deltaIds.begin(), deltaIds.end());
+            snapshotNames = labelNames;
+            lastId = nextId;
+        }
+
+        next.buildIndex();
+
+        unique_lock<shared_mutex> lock(updates->lock);
+        // Labels added during the rebuild may have shifted the codes.
+        if (snapshotNames.size() != labelNames.size()) {
+            for (auto &c : next.labels.own()) {
+                c = static_cast<int>(lower_bound(labelNames.begin(), labelNames.end(), snapshotNames[c]) - labelNames.begin());
+            }
+        }
+        // LSH rows added during the rebuild were appended to the old base; carry them over.
+        size_t tail = lower_bound(rowIds.begin(), rowIds.end(), lastId) - rowIds.begin();
+        if (tail < numRows) {
+            size_t first = next.numRows, n = numFeatures;
+            vector<double> &rows = next.points.own();
+            vector<int> &codes = next.labels.own();
+            vector<size_t> &ids = next.rowIds.own();
+            rows.insert(rows.end(), points.begin() + tail * n, points.begin() + numRows * n);
+            codes.insert(codes.end(), labels.begin() + tail, labels.end());
+            ids.insert(ids.end(), rowIds.begin() + tail, rowIds.end());
+            next.numRows += numRows - tail;
+            next.lsh.insert(&next.points[first * n], numRows - tail);
+        }
+        // Rows removed during the rebuild become tombstones of the new base.
+        for (size_t id : updates->removedDuring) {
+            auto b = lower_bound(next.rowIds.begin(), next.rowIds.end(), id);
+            if (b != next.rowIds.end() && *b == id) {
+                if (next.removed.empty()) {
+                    next.removed.assign(next.numRows, 0);
+                }
+                next.removed[b - next.rowIds.begin()] = 1;
+                next.removedCount++;
+            }
+        }
+        // Rows added during the rebuild stay in the delta buffer.
+        size_t keep = lower_bound(deltaIds.begin(), deltaIds.end(), lastId) - deltaIds.begin();
+        deltaIds.erase(deltaIds.begin(), deltaIds.begin() + keep);
+        deltaLabels.erase(deltaLabels.begin(), deltaLabels.begin() + keep);
+        deltaPoints.erase(deltaPoints.begin(), deltaPoints.begin() + keep * numFeatures);
+
+        searchAlgorithm = next.searchAlgorithm;
+        numRows = next.numRows;
+        points.swap(next.points);
+        pointNorms.swap(next.pointNorms);
+        labels.swap(next.labels);
+        rowIds.swap(next.rowIds);
+        removed.swap(next.removed);
+        removedCount = next.removedCount;
+        kdTree = move(next.kdTree);
+        ballTree = move(next.ballTree);
+        hnsw = move(next.hnsw);
+        ivfpq = move(next.ivfpq);
+        lsh = move(next.lsh);
+        updates->removedDuring.clear();
+        updates->compacting = false;
+    }
 };
 
 #endif // KNN_H
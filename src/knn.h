@@ -6,13 +6,57 @@
 #include <string>
 #include "base.h"
 #include "data_handling.h"
+#include "distance.h"
+#include "kd_tree.h"
+#include "ball_tree.h"
+#include "hnsw.h"
+#include "ivf_pq.h"
+#include "lsh.h"
 
 class KNN : public Model {
-private:
-    handle::Data trainingData;
+public:
+    enum class Algorithm {
+        Auto,        // Pick one of the strategies below from the data shape.
+        BruteForce,  // Scan every training row.
+        KDTree,      // Exact search over a KD-tree built in train().
+        BallTree,    // Exact search over a ball tree built in train().
+        HNSW,        // Approximate search over an HNSW graph (never chosen by Auto).
+        IVFPQ,       // Approximate search over product-quantised inverted lists (never chosen by Auto).
+        LSH          // Approximate search over locality-sensitive hash tables (never chosen by Auto).
+    };
+
+    enum class Weighting {
+        Uniform,     // Every neighbour counts once.
+        Distance     // Neighbours count 1 / distance; exact matches outweigh all others.
+    };
+
     int k;
+    Algorithm algorithm = Algorithm::Auto;                      // Requested search strategy.
+    Algorithm searchAlgorithm = Algorithm::BruteForce;          // Strategy chosen by train().
+    metric::Metric distanceMetric = metric::Metric::Euclidean;  // Distance used for neighbours.
+    int minkowskiP = 2;                                         // Exponent for metric::Metric::Minkowski.
+    Weighting weighting = Weighting::Uniform;                   // Neighbour weights in predictions.
+    size_t numRows = 0;                                         // Number of training rows.
+    size_t numFeatures = 0;                                     // Number of features per training row.
+    handle::MappedArray<double> points;                         // Training features, row-major.
+    handle::MappedArray<double> pointNorms;                     // Squared L2 norm of every training row.
+    handle::MappedArray<int> labels;                            // Label code of every training row.
+    std::vector<std::string> labelNames;                        // Label code -> label string, sorted.
+    std::vector<double> featureMean;                            // Optional scaler applied to rows and queries:
+    std::vector<double> featureScale;                           // (x - featureMean) / featureScale.
+    KDTree kdTree;                                              // Index over points.
+    BallTree ballTree;                                          // Index over points.
+    HNSW hnsw;                                                  // Approximate graph index over points.
+    IVFPQ ivfpq;                                                // Compressed approximate index.
+    LSH lsh;                                                    // Hash-table approximate index.
+    handle::MappedArray<size_t> rowIds;                         // Stable id of every base row.
+    std::vector<char> removed;                                  // Tombstone flag per base row.
+    size_t removedCount = 0;                                    // Number of tombstoned base rows.
+    std::vector<double> deltaPoints;                            // Rows added since the last compaction.
+    std::vector<int> deltaLabels;                               // Label codes of the delta rows.
+    std::vector<size_t> deltaIds;                               // Ids of the delta rows.
+    size_t nextId = 0;                                          // Id given to the next added row.
 
-public:
     /**
      * @brief Constructor for KNN.
      * 
@@ -22,8 +66,17 @@ public:
      */
     KNN(int k_val = 3, double lr = 0.0, int ep = 0);
 
+    // Not copyable: a background compaction refers to the object that started it.
+    KNN(const KNN &) = delete;
+    KNN &operator=(const KNN &) = delete;
+
+    /**
+     * @brief Resolves Algorithm::Auto from the number of rows and features.
+     */
+    static Algorithm chooseAlgorithm(size_t m, size_t n);
+
     /**
-     * @brief Stores the training data (KNN “training” is just memorizing).
+     * @brief Packs the training features and labels and builds the neighbour index.
      * 
      * @param data The training dataset.
      * @return Always returns a void pointer (may be nullptr).
@@ -47,7 +100,53 @@ public:
      */
     std::vector<std::string> predictLabel(handle::Data &data);
 
-private:
+    /**
+     * @brief Finds the kk nearest training rows as (reduced distance, row index) pairs.
+     */
+    void findNeighbours(const std::vector<double> &query, size_t kk,
+                        std::vector<std::pair<double, size_t>> &out) const;
+
+    /**
+     * @brief Parses a dataset's features into a contiguous query buffer.
+     */
+    std::vector<double> prepareQueries(handle::Data &data) const;
+
+    /**
+     * @brief Finds the kk nearest training rows for a batch of prepared queries.
+     *
+     * Brute force on 16+ Euclidean/cosine columns uses blocked distance tiles
+     * (||q||^2 + ||t||^2 - 2 q.t); other searches run per query in parallel.
+     * counts[i] is the number of neighbours found for query i (approximate
+     * indexes may find fewer than the returned width).
+     * @return The number of neighbour slots per query.
+     */
+    size_t batchNeighbours(const std::vector<double> &queries, size_t q, size_t kk,
+                           std::vector<size_t> &rows, std::vector<double> &dists,
+                           std::vector<size_t> &counts) const;
+
+    /**
+     * @brief Finds every row within a radius of each prepared query as CSR
+     *        offsets / rows / reduced distances; returns the total count.
+     */
+    size_t radiusNeighbours(const std::vector<double> &queries, size_t q, double radius,
+                            std::vector<size_t> &offsets, std::vector<size_t> &rows,
+                            std::vector<double> &dists) const;
+
+    /**
+     * @brief k-nearest-neighbour regression: the (weighted) mean numeric target of the k nearest rows.
+     */
+    std::vector<double> regress(handle::Data &data) const;
+
+    /**
+     * @brief Predicts a label code for every query row of a dataset.
+     */
+    std::vector<int> predictCodes(handle::Data &data, std::vector<std::string> *names = nullptr) const;
+
+    /**
+     * @brief Majority vote over the label codes of a neighbour list (ties go to the smallest code).
+     */
+    int vote(const std::vector<std::pair<double, size_t>> &neighbours) const;
+
     /**
      * @brief Predicts a single label for one query (vector<double>).
      * 
@@ -55,6 +154,57 @@ private:
      * @return A string label representing the majority vote among the k closest examples.
      */
     std::string predictOne(const std::vector<double> &query);
+
+    // Accuracy of every k from one neighbour computation.
+    struct KSelection {
+        std::vector<double> accuracy;  // accuracy[j] is the accuracy with k = j + 1.
+        int bestK = 0;                 // Smallest k with the highest accuracy.
+    };
+
+    /**
+     * @brief Scores every k in [1, kMax] on a validation set from one batch search at kMax.
+     */
+    KSelection selectK(handle::Data &data, size_t kMax) const;
+
+    /**
+     * @brief Leave-one-out selectK() over the training rows.
+     */
+    KSelection selectKLeaveOneOut(size_t kMax) const;
+
+    /**
+     * @brief Adds one labelled example to a delta buffer; returns its stable id.
+     *
+     * Safe to call while other threads predict. Enough pending updates start a
+     * background compaction that rebuilds the index off-lock and swaps it in.
+     */
+    size_t add(const std::vector<double> &features, const std::string &label);
+
+    /**
+     * @brief Removes the example with the given id (tombstone until the next compaction).
+     */
+    bool remove(size_t id);
+
+    /**
+     * @brief Number of live rows, and the stable id of a row index returned by a search.
+     */
+    size_t liveRows() const;
+    size_t rowId(size_t row) const;
+
+    /**
+     * @brief Folds pending updates into a rebuilt index now / waits for a background compaction.
+     */
+    void compact();
+    void waitForCompaction();
+
+    /**
+     * @brief Saves features, labels, label dictionary, scaler and built index to a binary file.
+     */
+    void save(const std::string &path) const;
+
+    /**
+     * @brief Loads a model written by save(), serving its row and tree arrays from a read-only mapping.
+     */
+    void load(const std::string &path);
 };
 
 #endif // KNN_H
\ No newline at end of file
@@ -0,0 +1,408 @@
+#pragma once
+#ifndef LSH_H
+#define LSH_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <iostream>
+#include "distance.h"
+#include "parallel.h"
+#include "serialize.h"
+
+using namespace std;
+
+// Locality-sensitive hashing index for approximate nearest-neighbour search.
+// Every table concatenates numHashes hash functions into one bucket key:
+// random hyperplanes (one sign bit each, Charikar) for cosine and p-stable
+// projections floor((a.x + b) / w) for L2 (Gaussian a) and L1 (Cauchy a),
+// after Datar et al. Queries visit their own bucket plus the `probes` most
+// likely neighbouring buckets in every table (multi-probe, Lv et al.) and
+// rank the union of candidates exactly. Inserting a row only hashes it and
+// appends its id to numTables buckets, so the index can absorb a high insert
+// rate while it is being queried. The tables hold row ids only: the rows stay
+// with the caller, who passes them to every query.
+class LSH {
+public:
+    size_t numTables;              // Independent hash tables.
+    size_t numHashes;              // Hash functions concatenated per table (<= 64).
+    size_t probes;                 // Extra buckets visited per table and query.
+    double bucketWidth;            // Projection bucket width for L2/L1; 0 picks one from the data.
+    unsigned seed;                 // Seed for the random projections.
+
+    double activeWidth = 0.0;      // Width the current tables were hashed with (bucketWidth or the estimate).
+    size_t dim = 0;                // Number of features per row.
+    size_t count = 0;              // Number of indexed rows.
+    metric::Metric metricType = metric::Metric::Euclidean;
+    vector<double> projections;    // (numTables * numHashes) x dim projection vectors, row-major.
+    vector<double> offsets;        // Random offset b in [0, w) of every projection.
+    vector<unordered_map<uint64_t, vector<uint32_t>>> tables; // Bucket key -> row ids, per table.
+
+    /**
+     * @brief Constructor for LSH.
+     *
+     * @param tablesCount Number of hash tables (default: 16).
+     * @param hashes Hash functions per table (default: 10).
+     * @param probeCount Extra buckets probed per table (default: 8).
+     * @param width Bucket width for L2/L1, 0 to estimate it in build() (default: 0).
+     * @param seed_val Seed for the projections (default: 7).
+     */
+    LSH(size_t tablesCount = 16, size_t hashes = 10, size_t probeCount = 8, double width = 0.0, unsigned seed_val = 7)
+        : numTables(max<size_t>(tablesCount, 1)), numHashes(min<size_t>(max<size_t>(hashes, 1), 64)),
+          probes(probeCount), bucketWidth(width), seed(seed_val), guard(make_shared<shared_mutex>()) {}
+
+    /**
+     * @brief Draws the hash functions and indexes every row, hashing and filling tables in parallel.
+     *
+     * @param data Row-major buffer of m * n values; they get ids 0 .. m - 1.
+     * @param m Number of rows.
+     * @param n Number of columns.
+     * @param met Euclidean, Manhattan or Cosine (Cosine expects L2-normalised rows;
+     *            candidates are ranked with Euclidean distance).
+     * @throws runtime_error if the buffer size does not match m * n.
+     */
+    void build(const vector<double> &data, size_t m, size_t n, metric::Metric met = metric::Metric::Euclidean) {
+        if (data.size() != m * n) {
+            throw runtime_error("LSH: point buffer size does not match dimensions.");
+        }
+        unique_lock<shared_mutex> lock(*guard);
+        dim = n;
+        metricType = met;
+        count = 0;
+        tables.assign(numTables, unordered_map<uint64_t, vector<uint32_t>>());
+        activeWidth = bucketWidth;
+        if (metricType != metric::Metric::Cosine && bucketWidth <= 0.0) {
+            activeWidth = estimateWidth(data, m);
+        }
+        drawProjections();
+        appendRows(data.data(), m);
+    }
+
+    /**
+     * @brief Adds m rows (row-major) to the index; they get ids size() .. size() + m - 1.
+     *
+     * Only the ids are stored, so the caller's row buffer passed to query()
+     * must hold these rows at those ids. Safe to call while other threads
+     * query. Hashing runs in parallel over the rows.
+     * @throws runtime_error if the index was never built or the buffer size is wrong.
+     */
+    void insert(const double *rows, size_t m) {
+        if (projections.empty()) {
+            throw runtime_error("LSH: build() must be called before insert().");
+        }
+        unique_lock<shared_mutex> lock(*guard);
+        appendRows(rows, m);
+    }
+
+    /**
+     * @brief Approximate k-nearest search over the probed buckets of every table.
+     *
+     * @param query Pointer to dim feature values.
+     * @param k Number of neighbours to return.
+     * @param out Filled with (reduced distance, row index), nearest first. Fewer
+     *            than k entries are returned when the buckets hold fewer rows.
+     * @param data Row-major buffer holding the indexed rows at their ids.
+     * @param skip Optional flag per id; rows with a nonzero flag are never returned.
+     */
+    void query(const double *query, size_t k, vector<pair<double, size_t>> &out, const double *data,
+               const char *skip = nullptr) const {
+        out.clear();
+        shared_lock<shared_mutex> lock(*guard);
+        if (count == 0 || k == 0) {
+            return;
+        }
+        vector<uint32_t> candidates;
+        vector<double> proj(numHashes);
+        vector<uint64_t> keys;
+        for (size_t t = 0; t < numTables; t++) {
+            project(query, t, proj.data());
+            probeKeys(proj.data(), keys);
+            for (uint64_t key : keys) {
+                auto it = tables[t].find(key);
+                if (it != tables[t].end()) {
+                    candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+                }
+            }
+        }
+        sort(candidates.begin(), candidates.end());
+        candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+        out.reserve(k);
+        if (metricType == metric::Metric::Manhattan) {
+            rank<metric::Manhattan>(data, query, candidates, k, skip, out);
+        } else {
+            rank<metric::Euclidean>(data, query, candidates, k, skip, out);
+        }
+        sort_heap(out.begin(), out.end());
+    }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+
+    /**
+     * @brief Writes the hash functions and buckets to a binary stream.
+     */
+    void save(ostream &out) const {
+        shared_lock<shared_mutex> lock(*guard);
+        uint64_t header[7] = {numTables, numHashes, probes, seed, dim, count, static_cast<uint64_t>(metricType)};
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(&bucketWidth), sizeof(bucketWidth));
+        out.write(reinterpret_cast<const char *>(&activeWidth), sizeof(activeWidth));
+        handle::writeVector(out, projections);
+        handle::writeVector(out, offsets);
+        for (const auto &table : tables) {
+            uint64_t buckets = table.size();
+            out.write(reinterpret_cast<const char *>(&buckets), sizeof(buckets));
+            for (const auto &bucket : table) {
+                out.write(reinterpret_cast<const char *>(&bucket.first), sizeof(bucket.first));
+                handle::writeVector(out, bucket.second);
+            }
+        }
+    }
+
+    /**
+     * @brief Loads an index written by save(), replacing the current one.
+     * @throws runtime_error if the stream does not hold a valid index.
+     */
+    void load(istream &in) {
+        unique_lock<shared_mutex> lock(*guard);
+        uint64_t header[7];
+        in.read(reinterpret_cast<char *>(header), sizeof(header));
+        in.read(reinterpret_cast<char *>(&bucketWidth), sizeof(bucketWidth));
+        in.read(reinterpret_cast<char *>(&activeWidth), sizeof(activeWidth));
+        numTables = header[0];
+        numHashes = header[1];
+        probes = header[2];
+        seed = static_cast<unsigned>(header[3]);
+        dim = header[4];
+        count = header[5];
+        metricType = static_cast<metric::Metric>(header[6]);
+        handle::readVector(in, projections);
+        handle::readVector(in, offsets);
+        tables.assign(numTables, unordered_map<uint64_t, vector<uint32_t>>());
+        for (auto &table : tables) {
+            uint64_t buckets = 0;
+            in.read(reinterpret_cast<char *>(&buckets), sizeof(buckets));
+            for (uint64_t b = 0; b < buckets && in; b++) {
+                uint64_t key = 0;
+                in.read(reinterpret_cast<char *>(&key), sizeof(key));
+                handle::readVector(in, table[key]);
+            }
+        }
+        if (!in || projections.size() != numTables * numHashes * dim) {
+            throw runtime_error("Corrupt LSH index.");
+        }
+    }
+
+    /**
+     * @brief Releases the index, keeping its parameters.
+     */
+    void clear() {
+        unique_lock<shared_mutex> lock(*guard);
+        dim = count = 0;
+        activeWidth = 0.0;
+        projections.clear();
+        offsets.clear();
+        tables.clear();
+    }
+
+private:
+    shared_ptr<shared_mutex> guard;   // Writers (build/insert/clear) exclusive, queries shared.
+
+    bool hyperplanes() const { return metricType == metric::Metric::Cosine; }
+
+    // Gaussian projections are 2-stable (L2), Cauchy projections 1-stable (L1).
+    void drawProjections() {
+        mt19937 rng(seed);
+        normal_distribution<double> gauss(0.0, 1.0);
+        cauchy_distribution<double> cauchy(0.0, 1.0);
+        uniform_real_distribution<double> uniform(0.0, hyperplanes() ? 1.0 : activeWidth);
+        projections.resize(numTables * numHashes * dim);
+        offsets.resize(numTables * numHashes);
+        for (auto &a : projections) {
+            a = metricType == metric::Metric::Manhattan ? cauchy(rng) : gauss(rng);
+        }
+        for (auto &b : offsets) {
+            b = hyperplanes() ? 0.0 : uniform(rng);
+        }
+    }
+
+    // A width of four typical nearest-neighbour distances, measured on a sample.
+    double estimateWidth(const vector<double> &data, size_t m) const {
+        if (m < 2) {
+            return 1.0;
+        }
+        mt19937 rng(seed);
+        size_t samples = min<size_t>(m, 200), pool = min<size_t>(m, 2000);
+        double total = 0.0;
+        for (size_t s = 0; s < samples; s++) {
+            size_t i = rng() % m;
+            double best = DBL_MAX;
+            for (size_t p = 0; p < pool; p++) {
+                size_t j = (i + 1 + p * (m / pool)) % m;
+                if (j == i) {
+                    continue;
+                }
+                double d = metricType == metric::Metric::Manhattan
+                               ? metric::Manhattan::reducedBounded(&data[i * dim], &data[j * dim], dim, best)
+                               : metric::Euclidean::reducedBounded(&data[i * dim], &data[j * dim], dim, best);
+                best = min(best, d);
+            }
+            total += metricType == metric::Metric::Manhattan ? best : sqrt(best);
+        }
+        double width = 4.0 * total / samples;
+        return width > 0.0 ? width : 1.0;
+    }
+
+    // Raw projections of one row for table t: a.x + b (hyperplanes: a.x).
+    void project(const double *row, size_t t, double *out) const {
+        for (size_t h = 0; h < numHashes; h++) {
+            const double *a = &projections[(t * numHashes + h) * dim];
+            double dot = offsets[t * numHashes + h];
+            for (size_t j = 0; j < dim; j++) {
+                dot += a[j] * row[j];
+            }
+            out[h] = dot;
+        }
+    }
+
+    // Integer hash value of projection h: its sign bit or its bucket number.
+    int64_t slot(const double *proj, size_t h) const {
+        return hyperplanes() ? (proj[h] >= 0.0 ? 1 : 0) : static_cast<int64_t>(floor(proj[h] / activeWidth));
+    }
+
+    static uint64_t combine(uint64_t key, int64_t value) {
+        uint64_t z = key ^ (static_cast<uint64_t>(value) + 0x9E3779B97F4A7C15ULL + (key << 6) + (key >> 2));
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t bucketKey(const double *proj, const vector<int> &delta) const {
+        uint64_t key = 0;
+        for (size_t h = 0; h < numHashes; h++) {
+            int64_t v = slot(proj, h);
+            if (hyperplanes()) {
+                v ^= delta[h] != 0 ? 1 : 0;
+            } else {
+                v += delta[h];
+            }
+            key = combine(key, v);
+        }
+        return key;
+    }
+
+    // Home bucket followed by the `probes` most promising perturbations. Every
+    // perturbation moves one hash value to an adjacent bucket (flips one bit for
+    // hyperplanes) and is scored by how close the query lies to that boundary;
+    // sets of perturbations are enumerated cheapest first with shift/expand.
+    void probeKeys(const double *proj, vector<uint64_t> &keys) const {
+        keys.clear();
+        vector<int> delta(numHashes, 0);
+        keys.push_back(bucketKey(proj, delta));
+        if (probes == 0) {
+            return;
+        }
+
+        // (score, hash index, direction) for every single-step perturbation.
+        vector<pair<double, pair<size_t, int>>> moves;
+        for (size_t h = 0; h < numHashes; h++) {
+            if (hyperplanes()) {
+                moves.push_back(make_pair(fabs(proj[h]), make_pair(h, 1)));
+            } else {
+                double frac = proj[h] / activeWidth - floor(proj[h] / activeWidth);
+                moves.push_back(make_pair(frac * frac, make_pair(h, -1)));
+                moves.push_back(make_pair((1.0 - frac) * (1.0 - frac), make_pair(h, 1)));
+            }
+        }
+        sort(moves.begin(), moves.end());
+
+        typedef pair<double, vector<size_t>> Set;  // Score and sorted move positions.
+        auto worse = [](const Set &a, const Set &b) { return a.first > b.first; };
+        priority_queue<Set, vector<Set>, decltype(worse)> heap(worse);
+        heap.push(Set(moves[0].first, vector<size_t>{0}));
+        while (!heap.empty() && keys.size() <= probes) {
+            Set set = heap.top();
+            heap.pop();
+            size_t last = set.second.back();
+            if (last + 1 < moves.size()) {
+                Set shifted = set;
+                shifted.second.back() = last + 1;
+                shifted.first += moves[last + 1].first - moves[last].first;
+                heap.push(shifted);
+                Set expanded = set;
+                expanded.second.push_back(last + 1);
+                expanded.first += moves[last + 1].first;
+                heap.push(expanded);
+            }
+            // A set may not move the same hash value both ways.
+            fill(delta.begin(), delta.end(), 0);
+            bool valid = true;
+            for (size_t pos : set.second) {
+                size_t h = moves[pos].second.first;
+                if (delta[h] != 0) {
+                    valid = false;
+                    break;
+                }
+                delta[h] = moves[pos].second.second;
+            }
+            if (valid) {
+                keys.push_back(bucketKey(proj, delta));
+            }
+        }
+    }
+
+    // Hashes m new rows in parallel, then fills every table on its own thread.
+    void appendRows(const double *rows, size_t m) {
+        if (m == 0) {
+            return;
+        }
+        if (count + m >= UINT32_MAX) {
+            throw runtime_error("LSH: too many rows.");
+        }
+        vector<uint64_t> keys(m * numTables);
+        handle::parallelFor(m, [&](size_t begin, size_t end) {
+            vector<double> proj(numHashes);
+            vector<int> none(numHashes, 0);
+            for (size_t i = begin; i < end; i++) {
+                for (size_t t = 0; t < numTables; t++) {
+                    project(rows + i * dim, t, proj.data());
+                    keys[i * numTables + t] = bucketKey(proj.data(), none);
+                }
+            }
+        }, 256);
+        handle::parallelFor(numTables, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; t++) {
+                for (size_t i = 0; i < m; i++) {
+                    tables[t][keys[i * numTables + t]].push_back(static_cast<uint32_t>(count + i));
+                }
+            }
+        });
+        count += m;
+    }
+
+    template <class Dist>
+    void rank(const double *data, const double *q, const vector<uint32_t> &candidates, size_t k, const char *skip,
+              vector<pair<double, size_t>> &heap) const {
+        for (uint32_t id : candidates) {
+            if (skip != nullptr && skip[id]) {
+                continue;
+            }
+            const double *row = data + static_cast<size_t>(id) * dim;
+            double dist = heap.size() < k ? Dist::reduced(row, q, dim)
+                                          : Dist::reducedBounded(row, q, dim, heap.front().first);
+            metric::offerCandidate(heap, k, dist, id);
+        }
+    }
+};
+
+#endif // LSH_H
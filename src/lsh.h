@@ -0,0 +1,79 @@
+#pragma once
+#ifndef LSH_H
+#define LSH_H
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <unordered_map>
+#include <cstdint>
+#include "distance.h"
+
+class LSH {
+public:
+    size_t numTables;              // Independent hash tables.
+    size_t numHashes;              // Hash functions concatenated per table (<= 64).
+    size_t probes;                 // Extra buckets visited per table and query.
+    double bucketWidth;            // Projection bucket width for L2/L1; 0 picks one from the data.
+    unsigned seed;                 // Seed for the random projections.
+
+    /**
+     * @brief Constructor for LSH.
+     *
+     * @param tablesCount Number of hash tables (default: 16).
+     * @param hashes Hash functions per table (default: 10).
+     * @param probeCount Extra buckets probed per table (default: 8).
+     * @param width Bucket width for L2/L1, 0 to estimate it in build() (default: 0).
+     * @param seed_val Seed for the projections (default: 7).
+     */
+    LSH(size_t tablesCount = 16, size_t hashes = 10, size_t probeCount = 8, double width = 0.0, unsigned seed_val = 7);
+
+    /**
+     * @brief Draws the hash functions and indexes a row-major buffer of m rows and n columns.
+     *
+     * Cosine uses random hyperplanes, Euclidean Gaussian and Manhattan Cauchy projections.
+     */
+    void build(const std::vector<double> &data, size_t m, size_t n,
+               metric::Metric met = metric::Metric::Euclidean);
+
+    /**
+     * @brief Adds m rows to the index; safe to call while other threads query.
+     *
+     * Only their ids are stored; the caller keeps the rows for query().
+     */
+    void insert(const double *rows, size_t m);
+
+    /**
+     * @brief Approximate k-nearest search with multi-probe over every table.
+     *
+     * @param out Filled with (reduced distance, row index), nearest first.
+     * @param data Row-major buffer holding the indexed rows at their ids.
+     * @param skip Optional flag per id; flagged rows are never returned.
+     */
+    void query(const double *query, size_t k, std::vector<std::pair<double, size_t>> &out,
+               const double *data, const char *skip = nullptr) const;
+
+    bool empty() const;
+    size_t size() const;
+
+    /**
+     * @brief Writes / loads the hash functions and buckets as a binary stream.
+     */
+    void save(std::ostream &out) const;
+    void load(std::istream &in);
+
+    /**
+     * @brief Releases the index, keeping its parameters.
+     */
+    void clear();
+
+    double activeWidth;                           // Width the current tables were hashed with.
+    size_t dim;                                   // Number of features per row.
+    size_t count;                                 // Number of indexed rows.
+    metric::Metric metricType;                    // Hash family and ranking metric.
+    std::vector<double> projections;              // Projection vectors, row-major.
+    std::vector<double> offsets;                  // Random offset of every projection.
+    std::vector<std::unordered_map<uint64_t, std::vector<uint32_t>>> tables; // Bucket key -> row ids.
+};
+
+#endif // LSH_H
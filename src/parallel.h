@@ -0,0 +1,206 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <exception>
+
+namespace handle
+{
+
+/**
+ * @brief Number of worker threads to use for parallel loops (at least 1).
+ */
+inline unsigned numThreads()
+{
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : hw;
+}
+
+/**
+ * @brief Runs fn(begin, end) over contiguous chunks of [0, n) on worker threads.
+ *
+ * The range is split into at most numThreads() chunks of at least `grain` items.
+ * Small ranges run inline on the calling thread. The first exception thrown by
+ * a worker is rethrown once all workers have joined.
+ *
+ * @param n Number of items.
+ * @param fn Callable taking (size_t begin, size_t end).
+ * @param grain Minimum number of items per chunk (default: 1).
+ */
+template <class F>
+void parallelFor(size_t n, F fn, size_t grain = 1)
+{
+    if (n == 0)
+        return;
+    size_t chunks = std::min<size_t>(numThreads(), (n + grain - 1) / std::max<size_t>(grain, 1));
+    if (chunks <= 1)
+    {
+        fn(size_t(0), n);
+        return;
+    }
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(chunks);
+    size_t step = (n + chunks - 1) / chunks;
+    for (size_t c = 0; c < chunks; c++)
+    {
+        size_t begin = c * step;
+        size_t end = std::min(n, begin + step);
+        if (begin >= end)
+            break;
+        workers.emplace_back([&, c, begin, end]() {
+            try
+            {
+                fn(begin, end);
+            }
+            catch (...)
+            {
+                errors[c] = std::current_exception();
+            }
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    for (auto &e : errors)
+        if (e)
+            std::rethrow_exception(e);
+}
+
+/**
+ * @brief A fixed set of worker threads for repeated parallelFor() passes.
+ *
+ * The threads start once, in the constructor, and sleep between passes, so a
+ * pass neither starts threads nor allocates. The calling thread runs the
+ * first chunk of every pass itself. Passes on one pool run one at a time;
+ * fn must not start another pass on the same pool.
+ */
+class WorkerPool
+{
+public:
+    /**
+     * @param threads Threads a pass may use, the caller included (at least 1).
+     */
+    explicit WorkerPool(size_t threads) : errors(std::max<size_t>(threads, 1))
+    {
+        for (size_t id = 1; id < errors.size(); id++)
+            workers.emplace_back([this, id]() { work(id); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    size_t size() const { return errors.size(); }
+
+    /**
+     * @brief Runs fn(begin, end) over contiguous chunks of [0, n), chunked like handle::parallelFor().
+     *
+     * The first exception thrown by a chunk is rethrown once the pass is done.
+     */
+    template <class F>
+    void parallelFor(size_t n, F fn, size_t grain = 1)
+    {
+        if (n == 0)
+            return;
+        size_t chunks = std::min<size_t>(size(), (n + grain - 1) / std::max<size_t>(grain, 1));
+        if (chunks <= 1)
+        {
+            fn(size_t(0), n);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            task = &invoke<F>;
+            context = &fn;
+            items = n;
+            step = (n + chunks - 1) / chunks;
+            active = chunks;
+            pending = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        runChunk(0);
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this]() { return pending == 0; });
+        std::exception_ptr first;
+        for (auto &e : errors)
+        {
+            if (e && !first)
+                first = e;
+            e = nullptr;
+        }
+        if (first)
+            std::rethrow_exception(first);
+    }
+
+private:
+    std::vector<std::exception_ptr> errors;  // One slot per chunk (= per thread).
+    std::vector<std::thread> workers;        // Threads 1 .. size() - 1.
+    std::mutex lock;
+    std::condition_variable wake;            // A new pass or shutdown.
+    std::condition_variable done;            // The last worker finished the pass.
+    void (*task)(void *, size_t, size_t) = nullptr;
+    void *context = nullptr;                 // The pass's fn.
+    size_t items = 0, step = 0, active = 0;  // Range, chunk length and chunks of the pass.
+    size_t pending = 0;                      // Workers yet to finish the pass.
+    size_t generation = 0;                   // Passes started.
+    bool stopping = false;
+
+    template <class F>
+    static void invoke(void *fn, size_t begin, size_t end)
+    {
+        (*static_cast<F *>(fn))(begin, end);
+    }
+
+    void runChunk(size_t c)
+    {
+        size_t begin = c * step;
+        size_t end = std::min(items, begin + step);
+        if (c >= active || begin >= end)
+            return;
+        try
+        {
+            task(context, begin, end);
+        }
+        catch (...)
+        {
+            errors[c] = std::current_exception();
+        }
+    }
+
+    void work(size_t id)
+    {
+        size_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            runChunk(id);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+};
+
+} // namespace handle
+
+#endif // PARALLEL_H
@@ -0,0 +1,315 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <streambuf>
+#include <memory>
+#include <utility>
+#include <stdexcept>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace handle
+{
+
+/**
+ * @brief Writes a vector of trivially copyable values as a uint64 count followed by the raw bytes.
+ */
+template <class T>
+void writeVector(std::ostream &out, const std::vector<T> &v)
+{
+    uint64_t n = v.size();
+    out.write(reinterpret_cast<const char *>(&n), sizeof(n));
+    out.write(reinterpret_cast<const char *>(v.data()), n * sizeof(T));
+}
+
+/**
+ * @brief Reads a vector written by writeVector(). Leaves the stream failed on a short read.
+ */
+template <class T>
+void readVector(std::istream &in, std::vector<T> &v)
+{
+    uint64_t n = 0;
+    in.read(reinterpret_cast<char *>(&n), sizeof(n));
+    if (!in)
+        return;
+    v.resize(n);
+    in.read(reinterpret_cast<char *>(v.data()), n * sizeof(T));
+}
+
+/**
+ * @brief Writes a string as a uint64 length followed by its characters.
+ */
+inline void writeString(std::ostream &out, const std::string &s)
+{
+    uint64_t n = s.size();
+    out.write(reinterpret_cast<const char *>(&n), sizeof(n));
+    out.write(s.data(), n);
+}
+
+/**
+ * @brief Reads a string written by writeString().
+ */
+inline void readString(std::istream &in, std::string &s)
+{
+    uint64_t n = 0;
+    in.read(reinterpret_cast<char *>(&n), sizeof(n));
+    if (!in)
+        return;
+    s.resize(n);
+    in.read(&s[0], n);
+}
+
+/**
+ * @brief Read-only memory mapping of a whole file, unmapped on destruction.
+ *
+ * Pages are loaded lazily by the kernel and shared with every other process
+ * mapping the same file, so opening it costs neither a parse nor a read.
+ */
+class MappedFile
+{
+public:
+    /**
+     * @throws runtime_error if the file cannot be opened or mapped.
+     */
+    explicit MappedFile(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open file " + path);
+        struct stat st{};
+        if (fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat file " + path);
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0)
+        {
+            void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Cannot map file " + path);
+            }
+            base = static_cast<char *>(p);
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (base != nullptr)
+            munmap(base, length);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    char *base = nullptr;
+    size_t length = 0;
+};
+
+/**
+ * @brief std::streambuf reading a MappedFile in place, for the parts of a file that are parsed.
+ *
+ * readArray() recognises it and maps arrays instead of reading them.
+ */
+class MemoryBuffer : public std::streambuf
+{
+public:
+    explicit MemoryBuffer(std::shared_ptr<const MappedFile> mapped) : file(std::move(mapped))
+    {
+        char *p = const_cast<char *>(file->data());
+        setg(p, p, p + file->size());
+    }
+
+    const std::shared_ptr<const MappedFile> &mapping() const { return file; }
+
+protected:
+    std::streamsize xsgetn(char *s, std::streamsize n) override
+    {
+        std::streamsize avail = egptr() - gptr();
+        if (n > avail)
+            n = avail;
+        std::copy(gptr(), gptr() + n, s);
+        setg(eback(), gptr() + n, egptr());
+        return n;
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+    {
+        if (!(which & std::ios_base::in))
+            return pos_type(off_type(-1));
+        off_type from = dir == std::ios_base::beg   ? 0
+                        : dir == std::ios_base::cur ? gptr() - eback()
+                                                    : egptr() - eback();
+        return seekpos(pos_type(from + off), which);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+    {
+        off_type at = off_type(pos);
+        if (!(which & std::ios_base::in) || at < 0 || at > egptr() - eback())
+            return pos_type(off_type(-1));
+        setg(eback(), eback() + at, egptr());
+        return pos;
+    }
+
+private:
+    std::shared_ptr<const MappedFile> file;
+};
+
+/**
+ * @brief A std::vector<T>, or a read-only view of a packed array inside a MappedFile.
+ *
+ * Reads (data(), size(), operator[], iteration) never copy. own() returns
+ * the vector to modify, copying a viewed array out of the mapping first,
+ * so an array loaded by readArray() is only copied once it is changed.
+ */
+template <class T>
+class MappedArray
+{
+public:
+    const T *data() const { return view != nullptr ? view : owned.data(); }
+    size_t size() const { return view != nullptr ? count : owned.size(); }
+    bool empty() const { return size() == 0; }
+    bool mapped() const { return view != nullptr; }
+
+    const T &operator[](size_t i) const { return data()[i]; }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+    const T &back() const { return data()[size() - 1]; }
+
+    std::vector<T> &own()
+    {
+        if (view != nullptr)
+        {
+            owned.assign(view, view + count);
+            view = nullptr;
+            count = 0;
+            file.reset();
+        }
+        return owned;
+    }
+
+    // Releases the storage (owned or mapped).
+    void clear()
+    {
+        std::vector<T>().swap(owned);
+        view = nullptr;
+        count = 0;
+        file.reset();
+    }
+
+    void swap(MappedArray &other)
+    {
+        owned.swap(other.owned);
+        file.swap(other.file);
+        std::swap(view, other.view);
+        std::swap(count, other.count);
+    }
+
+    // Views n values at `at`, which must lie inside `mapping`.
+    void map(std::shared_ptr<const MappedFile> mapping, const T *at, size_t n)
+    {
+        clear();
+        file = std::move(mapping);
+        view = at;
+        count = n;
+    }
+
+private:
+    std::vector<T> owned;
+    std::shared_ptr<const MappedFile> file;  // Keeps the mapping alive while it is viewed.
+    const T *view = nullptr;
+    size_t count = 0;
+};
+
+// Byte alignment of the data of every array written by writeArray().
+constexpr size_t ARRAY_ALIGN = 64;
+
+/**
+ * @brief Writes n values as a uint64 count, zero padding up to the next
+ *        ARRAY_ALIGN byte offset of the stream, and the raw bytes.
+ *
+ * The padding lets readArray() map the values in place.
+ */
+template <class T>
+void writeArray(std::ostream &out, const T *data, size_t n)
+{
+    static const char zeros[ARRAY_ALIGN] = {};
+    uint64_t count = n;
+    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    std::streamoff at = out.tellp();
+    if (at < 0)
+    {
+        out.setstate(std::ios_base::failbit);
+        return;
+    }
+    out.write(zeros, (ARRAY_ALIGN - at % ARRAY_ALIGN) % ARRAY_ALIGN);
+    out.write(reinterpret_cast<const char *>(data), n * sizeof(T));
+}
+
+template <class T>
+void writeArray(std::ostream &out, const std::vector<T> &v)
+{
+    writeArray(out, v.data(), v.size());
+}
+
+template <class T>
+void writeArray(std::ostream &out, const MappedArray<T> &a)
+{
+    writeArray(out, a.data(), a.size());
+}
+
+/**
+ * @brief Reads an array written by writeArray().
+ *
+ * From a MemoryBuffer the array becomes a view into the mapping (no copy);
+ * from any other stream it is read into owned storage. Leaves the stream
+ * failed on a short read.
+ */
+template <class T>
+void readArray(std::istream &in, MappedArray<T> &a)
+{
+    uint64_t n = 0;
+    in.read(reinterpret_cast<char *>(&n), sizeof(n));
+    std::streamoff at = in ? std::streamoff(in.tellg()) : -1;
+    if (at < 0)
+    {
+        in.setstate(std::ios_base::failbit);
+        return;
+    }
+    std::streamoff start = at + (ARRAY_ALIGN - at % ARRAY_ALIGN) % ARRAY_ALIGN;
+    auto *memory = dynamic_cast<MemoryBuffer *>(in.rdbuf());
+    if (memory != nullptr)
+    {
+        const std::shared_ptr<const MappedFile> &file = memory->mapping();
+        if (n > (file->size() - std::min<size_t>(file->size(), start)) / sizeof(T))
+        {
+            in.setstate(std::ios_base::failbit);
+            return;
+        }
+        a.map(file, reinterpret_cast<const T *>(file->data() + start), n);
+        in.seekg(start + std::streamoff(n * sizeof(T)));
+        return;
+    }
+    in.seekg(start);
+    std::vector<T> &v = a.own();
+    v.resize(in ? n : 0);
+    in.read(reinterpret_cast<char *>(v.data()), v.size() * sizeof(T));
+}
+
+} // namespace handle
+
+#endif // SERIALIZE_H
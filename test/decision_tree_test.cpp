@@ -10,6 +10,8 @@
 #include <cstdlib>
 #include <cmath>
 #include <string>
+#include <random>
+#include <algorithm>
 #include "../src/data_handling.h"   // Data definitions and utilities
 #include "../src/decision_tree.cpp"   // DecisionTree definitions and gnuplot plotting
 
@@ -64,6 +66,161 @@ int main() {
             cout << pred << " ";
         }
         cout << endl;
+
+        // Histogram splits: with fewer distinct values than bins every value
+        // has its own bin, so the tree must match the exact one.
+        DecisionTree binned(5, 2);
+        binned.splitter = DecisionTree::Splitter::Histogram;
+        binned.train(data);
+        if (!compareVectors(binned.predict(data), cppPreds))
+            throw runtime_error("Histogram tree differs from the exact tree on few distinct values.");
+
+        // With coarse bins on continuous data, it must stay close to the exact tree.
+        mt19937 gen(5);
+        normal_distribution<double> noise(0.0, 1.0);
+        size_t m = 3000, n = 4;
+        vector<double> points(m * n), labels(m);
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < n; j++) points[i * n + j] = noise(gen);
+            double score = points[i * n] + 0.5 * points[i * n + 1] * points[i * n + 2] + 0.3 * noise(gen);
+            labels[i] = score < 0.2 ? 0 : 1;
+        }
+        auto accuracy = [&](DecisionTree &tree) {
+            size_t hits = 0;
+            vector<double> x(n);
+            for (size_t i = 0; i < m; i++) {
+                copy(&points[i * n], &points[(i + 1) * n], x.begin());
+                hits += tree.traverseTree(tree.root, x) == static_cast<int>(labels[i]);
+            }
+            return static_cast<double>(hits) / m;
+        };
+        DecisionTree exact(6, 2), coarse(6, 2);
+        exact.fit(points, m, n, labels);
+        coarse.splitter = DecisionTree::Splitter::Histogram;
+        coarse.maxBins = 32;
+        coarse.fit(points, m, n, labels);
+        cout << "Training accuracy " << accuracy(exact) << " (exact) vs " << accuracy(coarse) << " (32 bins)\n";
+        if (accuracy(coarse) < accuracy(exact) - 0.03)
+            throw runtime_error("Histogram tree is much less accurate than the exact tree.");
+
+        // Presorted sweep: the root split must be the first best midpoint of
+        // a direct search, on values with many ties.
+        vector<double> tied(points);
+        for (double &v : tied) v = round(v * 4.0) / 4.0;
+        DecisionTree swept(1, 2);
+        swept.fit(tied, m, n, labels);
+        double bestImpurity = 1e300, bestThreshold = 0.0;
+        int bestFeature = -1;
+        for (size_t f = 0; f < n; f++) {
+            vector<double> values;
+            for (size_t i = 0; i < m; i++) values.push_back(tied[i * n + f]);
+            sort(values.begin(), values.end());
+            values.erase(unique(values.begin(), values.end()), values.end());
+            for (size_t v = 1; v < values.size(); v++) {
+                double threshold = (values[v - 1] + values[v]) / 2.0;
+                double count[2][2] = {{0, 0}, {0, 0}};
+                for (size_t i = 0; i < m; i++)
+                    count[tied[i * n + f] < threshold ? 0 : 1][static_cast<int>(labels[i])] += 1.0;
+                double impurity = 0.0;
+                for (auto &side : count) {
+                    double total = side[0] + side[1];
+                    impurity += total / m * (1.0 - (side[0] / total) * (side[0] / total) - (side[1] / total) * (side[1] / total));
+                }
+                if (impurity < bestImpurity - 1e-12) {
+                    bestImpurity = impurity;
+                    bestFeature = static_cast<int>(f);
+                    bestThreshold = threshold;
+                }
+            }
+        }
+        if (swept.root->featureIndex != bestFeature || swept.root->threshold != bestThreshold)
+            throw runtime_error("Presorted sweep picked a different root split than the direct search.");
+        cout << "Root split X" << bestFeature << " < " << bestThreshold << " matches the direct search\n";
+
+        // Multi-class criteria: three classes, Gini and entropy; on tied values
+        // the histogram tree must again match the exact one.
+        vector<double> classes(m);
+        for (size_t i = 0; i < m; i++) {
+            double score = tied[i * n] + 0.5 * tied[i * n + 1] * tied[i * n + 2];
+            classes[i] = score < -0.5 ? 0 : score < 0.7 ? 1 : 2;
+        }
+        for (auto criterion : {DecisionTree::Criterion::Gini, DecisionTree::Criterion::Entropy}) {
+            DecisionTree exactTree(6, 2), histTree(6, 2);
+            exactTree.criterion = histTree.criterion = criterion;
+            histTree.splitter = DecisionTree::Splitter::Histogram;
+            exactTree.fit(tied, m, n, classes);
+            histTree.fit(tied, m, n, classes);
+            size_t hits = 0;
+            vector<double> x(n);
+            for (size_t i = 0; i < m; i++) {
+                copy(&tied[i * n], &tied[(i + 1) * n], x.begin());
+                double predicted = exactTree.traverseTree(exactTree.root, x);
+                if (predicted != histTree.traverseTree(histTree.root, x))
+                    throw runtime_error("Histogram tree differs from the exact tree with several classes.");
+                hits += predicted == classes[i];
+            }
+            double acc = static_cast<double>(hits) / m;
+            cout << (criterion == DecisionTree::Criterion::Gini ? "Gini" : "Entropy") << " three-class accuracy "
+                 << acc << "\n";
+            if (acc < 0.85)
+                throw runtime_error("Multi-class tree fits the three classes poorly.");
+        }
+
+        // Regression: a stump predicts the mean, and the root split must be
+        // the best variance reduction of a direct search.
+        vector<double> target(m);
+        for (size_t i = 0; i < m; i++)
+            target[i] = sin(2.0 * tied[i * n]) + 0.5 * tied[i * n + 1] + 0.1 * noise(gen);
+        DecisionTree regressor(1, 2), constant(0, 2);
+        regressor.criterion = constant.criterion = DecisionTree::Criterion::MSE;
+        constant.fit(tied, m, n, target);
+        if (fabs(constant.root->prediction - constant.computeMean(target)) > 1e-12)
+            throw runtime_error("Regression leaf does not predict the mean.");
+        regressor.fit(tied, m, n, target);
+        double bestSpread = 1e300;
+        bestFeature = -1;
+        for (size_t f = 0; f < n; f++) {
+            vector<double> values;
+            for (size_t i = 0; i < m; i++) values.push_back(tied[i * n + f]);
+            sort(values.begin(), values.end());
+            values.erase(unique(values.begin(), values.end()), values.end());
+            for (size_t v = 1; v < values.size(); v++) {
+                double threshold = (values[v - 1] + values[v]) / 2.0;
+                vector<double> below, above;
+                for (size_t i = 0; i < m; i++)
+                    (tied[i * n + f] < threshold ? below : above).push_back(target[i]);
+                double spread = (below.size() * regressor.computeMSE(below) +
+                                 above.size() * regressor.computeMSE(above)) / m;
+                if (spread < bestSpread - 1e-9) {
+                    bestSpread = spread;
+                    bestFeature = static_cast<int>(f);
+                    bestThreshold = threshold;
+                }
+            }
+        }
+        if (regressor.root->featureIndex != bestFeature || regressor.root->threshold != bestThreshold)
+            throw runtime_error("Regression root split differs from the direct variance-reduction search.");
+
+        // Deeper exact and histogram regression trees explain most of the variance.
+        for (auto kind : {DecisionTree::Splitter::Exact, DecisionTree::Splitter::Histogram}) {
+            DecisionTree deep(6, 2);
+            deep.criterion = DecisionTree::Criterion::MSE;
+            deep.splitter = kind;
+            deep.maxBins = 64;
+            deep.fit(points, m, n, target);
+            double residual = 0.0;
+            vector<double> x(n);
+            for (size_t i = 0; i < m; i++) {
+                copy(&points[i * n], &points[(i + 1) * n], x.begin());
+                double err = deep.traverseTree(deep.root, x) - target[i];
+                residual += err * err;
+            }
+            double r2 = 1.0 - residual / m / deep.computeMSE(target);
+            cout << "Regression tree R^2 " << r2 << (kind == DecisionTree::Splitter::Exact ? " (exact)\n" : " (64 bins)\n");
+            if (r2 < 0.8)
+                throw runtime_error("Regression tree explains too little of the variance.");
+        }
+
         dt.plot(data);
 
     } catch (const exception &e) {
@@ -0,0 +1,149 @@
+// KMeans benchmark: distance evaluations and time of each assignment strategy.
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <stdexcept>
+#include "../src/k_means_clustering.cpp"
+#include "../src/coreset.cpp"
+
+using namespace std;
+
+/**
+ * @brief Generates m rows of n features drawn around a number of Gaussian clusters.
+ */
+vector<double> makeClusters(size_t m, size_t n, size_t clusters, mt19937 &rng) {
+    normal_distribution<double> noise(0.0, 1.0);
+    vector<double> centres(clusters * n);
+    for (auto &v : centres) v = noise(rng) * 4.0;
+    vector<double> data(m * n);
+    for (size_t i = 0; i < m; i++) {
+        size_t c = rng() % clusters;
+        for (size_t j = 0; j < n; j++)
+            data[i * n + j] = centres[c * n + j] + noise(rng);
+    }
+    return data;
+}
+
+double elapsedMs(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char **argv) {
+    try {
+        // Usage: ./k_means_benchmark [rows] [dims] [k]
+        size_t m = argc > 1 ? stoul(argv[1]) : 20000;
+        size_t n = argc > 2 ? stoul(argv[2]) : 16;
+        int k = argc > 3 ? stoi(argv[3]) : 256;
+        mt19937 rng(42);
+        vector<double> data = makeClusters(m, n, static_cast<size_t>(k), rng);
+        cout << "Rows: " << m << ", dims: " << n << ", k: " << k << "\n";
+
+        vector<int> reference;
+        size_t lloydEvaluations = 0;
+        for (auto algo : {KMeans::Algorithm::Lloyd, KMeans::Algorithm::Hamerly, KMeans::Algorithm::Elkan}) {
+            KMeans kmeans(k, 50, 1e-6);
+            kmeans.algorithm = algo;
+            auto t0 = chrono::steady_clock::now();
+            kmeans.fit(data, m, n);
+            double ms = elapsedMs(t0);
+            if (algo == KMeans::Algorithm::Lloyd) {
+                reference = kmeans.getAssignments();
+                lloydEvaluations = kmeans.distanceEvaluations;
+            } else if (kmeans.getAssignments() != reference) {
+                throw runtime_error("Bounded KMeans assignments differ from Lloyd.");
+            }
+            const char *name = algo == KMeans::Algorithm::Lloyd ? "Lloyd" : algo == KMeans::Algorithm::Elkan ? "Elkan" : "Hamerly";
+            printf("%-10s %10.1f ms   %12zu distances (%.1f%% of Lloyd)\n", name, ms, kmeans.distanceEvaluations,
+                   100.0 * kmeans.distanceEvaluations / lloydEvaluations);
+        }
+
+        // Restarts run concurrently on the shared rows; the best one is kept.
+        for (int restarts : {1, 4}) {
+            KMeans kmeans(k, 50, 1e-6);
+            kmeans.nInit = restarts;
+            auto t0 = chrono::steady_clock::now();
+            kmeans.fit(data, m, n);
+            double ms = elapsedMs(t0);
+            printf("nInit=%-4d %10.1f ms   best inertia %.1f after %d iterations\n", restarts, ms, kmeans.inertia,
+                   kmeans.iterations);
+        }
+
+        // Coresets: one streaming pass, then a weighted fit on a few thousand rows.
+        for (auto method : {CoresetBuilder::Method::Lightweight, CoresetBuilder::Method::Sensitivity}) {
+            auto t0 = chrono::steady_clock::now();
+            CoresetBuilder builder(4000, method, k);
+            for (size_t start = 0; start < m; start += 1000)
+                builder.add(&data[start * n], min<size_t>(1000, m - start), n);
+            vector<double> corePoints, coreWeights;
+            builder.finish(corePoints, coreWeights);
+            KMeans kmeans(k, 50, 1e-6);
+            kmeans.nInit = 4;  // Restarts are cheap on a coreset.
+            kmeans.fit(corePoints, coreWeights.size(), n, coreWeights);
+            double ms = elapsedMs(t0);
+            vector<double> centers = kmeans.flatCentroids();
+            double inertia = 0.0;
+            for (size_t i = 0; i < m; i++) {
+                int c = KMeans::nearestCentroid<metric::Euclidean>(&data[i * n], centers.data(), k, n);
+                inertia += metric::Euclidean::reduced(&data[i * n], &centers[c * n], n);
+            }
+            printf("%-10s %10.1f ms   full-data inertia %.1f from %zu weighted rows\n",
+                   method == CoresetBuilder::Method::Lightweight ? "Coreset-LW" : "Coreset-S", ms, inertia,
+                   coreWeights.size());
+        }
+
+        // Prediction: a scan over every centroid vs the published centroid index.
+        {
+            KMeans kmeans(k, 20, 1e-4);
+            kmeans.fit(data, m, n);
+            vector<double> centers = kmeans.flatCentroids();
+            vector<int> scanned(m);
+            auto t0 = chrono::steady_clock::now();
+            for (size_t i = 0; i < m; i++)
+                scanned[i] = KMeans::nearestCentroid<metric::Euclidean>(&data[i * n], centers.data(), k, n);
+            double scanMs = elapsedMs(t0);
+            t0 = chrono::steady_clock::now();
+            vector<int> indexed = kmeans.predictRows(data, m, n);
+            double indexMs = elapsedMs(t0);
+            if (indexed != scanned) {
+                throw runtime_error("Indexed predictions differ from the centroid scan.");
+            }
+            printf("%-10s %10.1f ms   scan %.1f ms (%.1fx)\n", "Predict", indexMs, scanMs, scanMs / indexMs);
+        }
+
+        // Choosing k: warm-started sweep with sampled silhouettes.
+        {
+            KMeans kmeans(2, 50, 1e-6);
+            auto t0 = chrono::steady_clock::now();
+            KMeans::KSweep sweep = kmeans.sweepK(data, m, n, 2, min(k, 32), 1000);
+            printf("%-10s %10.1f ms   k = 2..%d, elbow %d, best silhouette %d\n", "Sweep", elapsedMs(t0), min(k, 32),
+                   sweep.elbowK, sweep.bestK);
+        }
+
+        // Mini-batch trades a little inertia for far fewer distances.
+        double exactInertia = 0.0;
+        for (auto algo : {KMeans::Algorithm::Lloyd, KMeans::Algorithm::MiniBatch}) {
+            KMeans kmeans(k, 50, 1e-6);
+            kmeans.algorithm = algo;
+            auto t0 = chrono::steady_clock::now();
+            kmeans.fit(data, m, n);
+            double ms = elapsedMs(t0);
+            vector<int> assigned = kmeans.getAssignments();
+            double inertia = 0.0;
+            for (size_t i = 0; i < m; i++) {
+                vector<double> row(&data[i * n], &data[(i + 1) * n]);
+                double d = kmeans.euclideanDistance(row, kmeans.centroids[assigned[i]]);
+                inertia += d * d;
+            }
+            if (algo == KMeans::Algorithm::Lloyd) exactInertia = inertia;
+            printf("%-10s %10.1f ms   inertia %.1f (%.2fx Lloyd)\n", algo == KMeans::Algorithm::Lloyd ? "Lloyd" : "MiniBatch",
+                   ms, inertia, inertia / exactInertia);
+        }
+    } catch (const exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -7,8 +7,15 @@
 #include <stdexcept>
 #include <array>
 #include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 #include "../src/data_handling.h"  // Contains the Data definition and readCSV(), toDouble(), etc.
 #include "../src/k_means_clustering.cpp"         // Contains the KMeans class
+#include "../src/coreset.cpp"                    // Contains the CoresetBuilder class
 
 using namespace std;
 
@@ -48,6 +55,32 @@ vector<int> parsePythonOutput(const string &output) {
     return assignments;
 }
 
+/**
+ * @brief Sum of squared distances from every (feature + target) row to its assigned centroid.
+ */
+double inertiaOf(handle::Data &data, KMeans &kmeans) {
+    double total = 0.0;
+    vector<int> assigned = kmeans.getAssignments();
+    for (size_t i = 0; i < data.features.size(); i++) {
+        vector<double> row;
+        for (auto &v : data.features[i]) row.push_back(handle::toDouble(v));
+        row.push_back(handle::toDouble(data.target[i]));
+        double d = kmeans.euclideanDistance(row, kmeans.centroids[assigned[i]]);
+        total += d * d;
+    }
+    return total;
+}
+
+/**
+ * @brief Inertia of every row against the nearest of kmeans' centroids (whatever it was trained on).
+ */
+double predictedInertia(handle::Data &data, const KMeans &kmeans) {
+    KMeans check = kmeans;
+    check.assignments.clear();
+    for (auto &c : check.predict(data)) check.assignments.push_back(static_cast<int>(c));
+    return inertiaOf(data, check);
+}
+
 int main() {
     try {
         std::string filename = "./datasets/iris2.csv";
@@ -59,6 +92,265 @@ int main() {
         for (double d : cppAssignmentsDouble) {
             cppAssignments.push_back(static_cast<int>(d));
         }
+
+        // Seeding: k-means++ and k-means|| must beat the first-k start on this
+        // sorted file, and a fixed seed must give the same centroids.
+        KMeans first(3, 100, 1e-7);
+        first.init = KMeans::Init::First;
+        first.train(data);
+        double firstInertia = inertiaOf(data, first);
+        for (auto init : {KMeans::Init::KMeansPlusPlus, KMeans::Init::KMeansParallel}) {
+            KMeans seeded(3, 100, 1e-7), again(3, 100, 1e-7);
+            seeded.init = again.init = init;
+            seeded.train(data);
+            again.train(data);
+            if (seeded.getCentroids() != again.getCentroids())
+                throw runtime_error("Seeded KMeans is not reproducible.");
+            double seededInertia = inertiaOf(data, seeded);
+            cout << "Inertia " << seededInertia << " (seeded) vs " << firstInertia << " (first k)\n";
+            if (seededInertia > firstInertia + 1e-9)
+                throw runtime_error("Seeded KMeans ends with a higher inertia than first-k seeding.");
+        }
+
+        // Elkan and Hamerly must reproduce Lloyd's clustering with fewer distances.
+        KMeans lloyd(3, 100, 1e-7);
+        lloyd.algorithm = KMeans::Algorithm::Lloyd;
+        lloyd.train(data);
+        for (auto algo : {KMeans::Algorithm::Elkan, KMeans::Algorithm::Hamerly}) {
+            KMeans bounded(3, 100, 1e-7);
+            bounded.algorithm = algo;
+            bounded.train(data);
+            if (bounded.getAssignments() != lloyd.getAssignments())
+                throw runtime_error("Bounded KMeans assignments differ from Lloyd.");
+            cout << "Distance evaluations " << bounded.distanceEvaluations << " vs " << lloyd.distanceEvaluations
+                 << " (Lloyd)\n";
+            if (bounded.distanceEvaluations >= lloyd.distanceEvaluations)
+                throw runtime_error("Bounded KMeans did not skip any distance.");
+        }
+
+        // Centroids kept up to date from moved rows only must still be the means of their rows.
+        vector<vector<double>> means(3);
+        vector<int> members(3, 0);
+        for (size_t i = 0; i < data.features.size(); i++) {
+            int c = lloyd.getAssignments()[i];
+            vector<double> row;
+            for (auto &v : data.features[i]) row.push_back(handle::toDouble(v));
+            row.push_back(handle::toDouble(data.target[i]));
+            means[c].resize(row.size(), 0.0);
+            for (size_t j = 0; j < row.size(); j++) means[c][j] += row[j];
+            members[c]++;
+        }
+        for (int c = 0; c < 3; c++)
+            for (size_t j = 0; j < means[c].size(); j++)
+                if (fabs(means[c][j] / members[c] - lloyd.centroids[c][j]) > 1e-9)
+                    throw runtime_error("Incrementally updated centroid differs from the mean of its rows.");
+
+        // Restarts must report every run and keep the lowest inertia; run 0 is the single-run fit.
+        KMeans restarted(3, 100, 1e-7);
+        restarted.init = KMeans::Init::KMeansPlusPlus;
+        restarted.nInit = 6;
+        restarted.train(data);
+        if (restarted.runInertia.size() != 6 || restarted.runIterations.size() != 6)
+            throw runtime_error("KMeans restarts are not all reported.");
+        if (fabs(restarted.runInertia[0] - inertiaOf(data, lloyd)) > 1e-9 ||
+            fabs(restarted.inertia - inertiaOf(data, restarted)) > 1e-9)
+            throw runtime_error("KMeans inertia differs from the assigned distances.");
+        for (double runInertia : restarted.runInertia)
+            if (runInertia < restarted.inertia)
+                throw runtime_error("KMeans restarts did not keep the lowest inertia.");
+        cout << "Best of " << restarted.nInit << " restarts: inertia " << restarted.inertia << " after "
+             << restarted.iterations << " iterations\n";
+
+        // Mini-batch updates must land close to Lloyd's inertia, in memory and streamed.
+        double lloydInertia = inertiaOf(data, lloyd);
+        KMeans miniBatch(3, 100, 1e-7);
+        miniBatch.algorithm = KMeans::Algorithm::MiniBatch;
+        miniBatch.batchSize = 32;
+        miniBatch.train(data);
+        double miniInertia = inertiaOf(data, miniBatch);
+        cout << "Mini-batch inertia " << miniInertia << " after " << miniBatch.batchesRun << " batches vs "
+             << lloydInertia << " (Lloyd)\n";
+        if (miniInertia > lloydInertia * 1.1)
+            throw runtime_error("Mini-batch KMeans inertia is far from Lloyd.");
+        vector<double> rows;
+        for (size_t i = 0; i < data.features.size(); i++) {
+            for (auto &v : data.features[i]) rows.push_back(handle::toDouble(v));
+            rows.push_back(handle::toDouble(data.target[i]));
+        }
+        size_t dim = data.features[0].size() + 1, m = data.features.size(), next = 0;
+        // The file is sorted by cluster; stream it in a fixed shuffled order.
+        vector<size_t> order(m);
+        for (size_t i = 0; i < m; i++) order[i] = i;
+        shuffle(order.begin(), order.end(), mt19937(7));
+        KMeans streamed(3, 100, 1e-7);
+        streamed.batchSize = 32;
+        streamed.fitStream([&](double *out, size_t maxRows) -> size_t {
+            // Five passes over the file.
+            size_t count = min(maxRows, 5 * m - next);
+            for (size_t r = 0; r < count; r++, next++)
+                copy(&rows[order[next % m] * dim], &rows[(order[next % m] + 1) * dim], out + r * dim);
+            return count;
+        }, dim);
+        KMeans streamedCheck = streamed;
+        streamedCheck.assignments.clear();
+        for (auto &c : streamedCheck.predict(data)) streamedCheck.assignments.push_back(static_cast<int>(c));
+        double streamedInertia = inertiaOf(data, streamedCheck);
+        cout << "Streamed mini-batch inertia " << streamedInertia << "\n";
+        if (streamedInertia > lloydInertia * 1.1 || !streamed.getAssignments().empty())
+            throw runtime_error("Streamed mini-batch KMeans inertia is far from Lloyd.");
+
+        // Online updates, with and without a coreset window, while another thread predicts.
+        for (size_t window : {0, 4}) {
+            KMeans online(3, 100, 1e-7);
+            online.batchSize = 32;
+            online.windowBatches = window;
+            online.partialFit(vector<double>(), 0, dim);
+            atomic<bool> feeding(true), outOfRange(false);
+            thread reader([&]() {
+                vector<string> query = data.features[0];
+                query.push_back(data.target[0]);
+                while (feeding) {
+                    try {
+                        int c = online.predictSingle(query);
+                        outOfRange = outOfRange || c < 0 || c >= 3;
+                    } catch (const runtime_error &) {
+                        // Not seeded yet.
+                    }
+                }
+            });
+            for (size_t pass = 0; pass < 5; pass++) {
+                for (size_t start = 0; start < m; start += 16) {
+                    size_t count = min<size_t>(16, m - start);
+                    vector<double> batch;
+                    for (size_t r = start; r < start + count; r++)
+                        batch.insert(batch.end(), &rows[order[r] * dim], &rows[(order[r] + 1) * dim]);
+                    online.partialFit(batch, count, dim);
+                }
+            }
+            feeding = false;
+            reader.join();
+            if (outOfRange)
+                throw runtime_error("Concurrent prediction out of range.");
+            KMeans onlineCheck = online;
+            for (auto &c : onlineCheck.predict(data)) onlineCheck.assignments.push_back(static_cast<int>(c));
+            double onlineInertia = inertiaOf(data, onlineCheck);
+            cout << "Online inertia " << onlineInertia << " (window " << window << ")\n";
+            if (onlineInertia > lloydInertia * 1.1)
+                throw runtime_error("Online KMeans inertia is far from Lloyd.");
+        }
+
+        // Sample weights: doubling every weight must double the inertia and keep the clustering.
+        KMeans weighted(3, 100, 1e-7);
+        weighted.fit(rows, m, dim, vector<double>(m, 2.0));
+        if (weighted.getAssignments() != lloyd.getAssignments())
+            throw runtime_error("Uniformly weighted KMeans changed the clustering.");
+        if (fabs(weighted.inertia - 2.0 * lloydInertia) > 1e-9)
+            throw runtime_error("Weighted KMeans inertia does not scale with the weights.");
+
+        // Weighted fits on coresets must cluster the full data nearly as well as Lloyd.
+        for (auto method : {CoresetBuilder::Method::Lightweight, CoresetBuilder::Method::Sensitivity}) {
+            CoresetBuilder builder(50, method, 3);
+            vector<double> corePoints, coreWeights;
+            builder.build(rows.data(), nullptr, m, dim, corePoints, coreWeights);
+            double total = 0.0;
+            for (double w : coreWeights) total += w;
+            KMeans summary(3, 100, 1e-7);
+            summary.fit(corePoints, coreWeights.size(), dim, coreWeights);
+            double summaryInertia = predictedInertia(data, summary);
+
+            // The same data streamed in chunks through merge and reduce.
+            builder.chunkRows = 40;
+            for (size_t start = 0; start < m; start += 16) {
+                vector<double> chunk;
+                for (size_t r = start; r < min(m, start + 16); r++)
+                    chunk.insert(chunk.end(), &rows[order[r] * dim], &rows[(order[r] + 1) * dim]);
+                builder.add(chunk.data(), chunk.size() / dim, dim);
+            }
+            builder.finish(corePoints, coreWeights);
+            KMeans streamedSummary(3, 100, 1e-7);
+            streamedSummary.fit(corePoints, coreWeights.size(), dim, coreWeights);
+            double streamedSummaryInertia = predictedInertia(data, streamedSummary);
+            cout << (method == CoresetBuilder::Method::Lightweight ? "Lightweight" : "Sensitivity")
+                 << " coreset: weight " << total << " for " << m << " rows, inertia " << summaryInertia
+                 << " (streamed " << streamedSummaryInertia << ")\n";
+            if (summaryInertia > lloydInertia * 1.2 || streamedSummaryInertia > lloydInertia * 1.2)
+                throw runtime_error("KMeans on a coreset is far from Lloyd on the full data.");
+        }
+
+        // Silhouette: the blocked kernel must match a direct computation, and a
+        // stratified sample must bracket it.
+        const vector<int> &labels = lloyd.getAssignments();
+        double direct = 0.0;
+        for (size_t i = 0; i < m; i++) {
+            vector<double> sums(3, 0.0);
+            vector<int> sizes(3, 0);
+            for (size_t j = 0; j < m; j++) {
+                double d = 0.0;
+                for (size_t t = 0; t < dim; t++) d += (rows[i * dim + t] - rows[j * dim + t]) * (rows[i * dim + t] - rows[j * dim + t]);
+                sums[labels[j]] += sqrt(d);
+                sizes[labels[j]]++;
+            }
+            double a = sums[labels[i]] / (sizes[labels[i]] - 1), b = DBL_MAX;
+            for (int c = 0; c < 3; c++)
+                if (c != labels[i]) b = min(b, sums[c] / sizes[c]);
+            direct += (b - a) / max(a, b);
+        }
+        direct /= m;
+        KMeans::Silhouette exactScore = lloyd.silhouetteScore(rows, m, dim, labels);
+        KMeans::Silhouette sampledScore = lloyd.silhouetteScore(rows, m, dim, labels, 40);
+        cout << "Silhouette " << exactScore.mean << ", sampled " << sampledScore.mean << " [" << sampledScore.low
+             << ", " << sampledScore.high << "] from " << sampledScore.rows << " rows\n";
+        if (fabs(exactScore.mean - direct) > 1e-9)
+            throw runtime_error("Blocked silhouette differs from the direct computation.");
+        if (exactScore.mean < sampledScore.low || exactScore.mean > sampledScore.high)
+            throw runtime_error("Sampled silhouette interval misses the exact score.");
+
+        // k sweep: warm-started inertia must not grow, and k = 3 must reach the fresh fit's optimum.
+        KMeans::KSweep sweep = lloyd.sweepK(rows, m, dim, 2, 6);
+        for (size_t i = 1; i < sweep.k.size(); i++)
+            if (sweep.inertia[i] > sweep.inertia[i - 1] + 1e-9)
+                throw runtime_error("Warm-started sweep inertia increased with k.");
+        if (fabs(sweep.inertia[1] - lloydInertia) > 1e-6)
+            throw runtime_error("Warm-started sweep missed the k = 3 optimum.");
+        cout << "k sweep: elbow at k = " << sweep.elbowK << ", best silhouette at k = " << sweep.bestK << "\n";
+
+        // Centroid index: with many centroids, KD-tree (low dims) and ball tree
+        // (higher dims) predictions must match a scan over every centroid.
+        for (size_t indexDim : {4, 40}) {
+            for (auto met : {metric::Metric::Euclidean, metric::Metric::Manhattan}) {
+                mt19937 gen(11);
+                normal_distribution<double> noise(0.0, 1.0);
+                size_t count = 3000;
+                vector<double> cloud(count * indexDim);
+                for (double &v : cloud) v = noise(gen);
+                KMeans many(150, 5, 1e-4);
+                many.distanceMetric = met;
+                many.fit(cloud, count, indexDim);
+                vector<double> queries(500 * indexDim);
+                for (double &v : queries) v = 1.5 * noise(gen);
+                vector<int> indexed = many.predictRows(queries, 500, indexDim);
+                vector<double> centers = many.flatCentroids();
+                auto scan = [&](const double *row) {
+                    return met == metric::Metric::Euclidean
+                        ? KMeans::nearestCentroid<metric::Euclidean>(row, centers.data(), 150, indexDim)
+                        : KMeans::nearestCentroid<metric::Manhattan>(row, centers.data(), 150, indexDim);
+                };
+                for (size_t q = 0; q < 500; q++) {
+                    if (indexed[q] != scan(&queries[q * indexDim]))
+                        throw runtime_error("Indexed prediction differs from the centroid scan.");
+                    vector<string> fields;
+                    vector<double> parsed;
+                    for (size_t j = 0; j < indexDim; j++) {
+                        fields.push_back(to_string(queries[q * indexDim + j]));
+                        parsed.push_back(stod(fields.back()));
+                    }
+                    if (many.predictSingle(fields) != scan(parsed.data()))
+                        throw runtime_error("Indexed predictSingle differs from the centroid scan.");
+                }
+            }
+        }
+        cout << "Indexed predictions match the centroid scan\n";
+
         kmeans.plot(data);
     } catch (const exception &e) {
         cerr << "Test failed: " << e.what() << endl;
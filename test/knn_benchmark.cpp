@@ -0,0 +1,195 @@
+// KNN approximate index benchmark: recall and latency against exact brute force.
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include "../src/knn.cpp"
+
+using namespace std;
+
+/**
+ * @brief Generates m rows of n features drawn around a number of Gaussian clusters.
+ */
+vector<double> makeClusters(size_t m, size_t n, size_t clusters, mt19937 &rng) {
+    normal_distribution<double> noise(0.0, 1.0);
+    vector<double> centres(clusters * n);
+    for (auto &v : centres) v = noise(rng) * 4.0;
+    vector<double> data(m * n);
+    for (size_t i = 0; i < m; i++) {
+        size_t c = rng() % clusters;
+        for (size_t j = 0; j < n; j++)
+            data[i * n + j] = centres[c * n + j] + noise(rng);
+    }
+    return data;
+}
+
+/**
+ * @brief Fraction of the exact neighbours (truth) that appear in the approximate ones.
+ */
+double recallAt(const vector<size_t> &truth, const vector<pair<double, size_t>> &found, size_t k) {
+    size_t hits = 0;
+    for (size_t i = 0; i < k && i < truth.size(); i++)
+        for (auto &f : found)
+            if (f.second == truth[i]) { hits++; break; }
+    return static_cast<double>(hits) / k;
+}
+
+double elapsedMs(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char **argv) {
+    try {
+        // Usage: ./knn_benchmark [rows] [dims] [queries]
+        size_t m = argc > 1 ? stoul(argv[1]) : 50000;
+        size_t n = argc > 2 ? stoul(argv[2]) : 32;
+        size_t q = argc > 3 ? stoul(argv[3]) : 500;
+        size_t k = 10;
+        mt19937 rng(42);
+
+        // Queries come from the same clusters as the training rows.
+        vector<double> train = makeClusters(m + q, n, 64, rng);
+        vector<double> queries(train.end() - q * n, train.end());
+        train.resize(m * n);
+        cout << "Rows: " << m << ", dims: " << n << ", queries: " << q << ", k: " << k << "\n";
+
+        // Exact neighbours from the batch brute-force path.
+        KNN exact(static_cast<int>(k));
+        exact.algorithm = KNN::Algorithm::BruteForce;
+        exact.searchAlgorithm = KNN::Algorithm::BruteForce;
+        exact.numRows = m;
+        exact.numFeatures = n;
+        exact.points.own() = train;
+        vector<double> &norms = exact.pointNorms.own();
+        norms.resize(m);
+        for (size_t i = 0; i < m; i++)
+            norms[i] = inner_product(&train[i * n], &train[(i + 1) * n], &train[i * n], 0.0);
+        vector<size_t> truth, truthCount;
+        vector<double> truthDist;
+        auto t0 = chrono::steady_clock::now();
+        exact.batchNeighbours(queries, q, k, truth, truthDist, truthCount);
+        double bruteMs = elapsedMs(t0);
+        printf("%-28s %10.1f us/query\n", "brute force (batch)", bruteMs * 1000.0 / q);
+
+        // HNSW: build once, then sweep efSearch.
+        HNSW hnsw(16, 200, 50);
+        t0 = chrono::steady_clock::now();
+        hnsw.build(train, m, n);
+        printf("%-28s %10.1f ms\n", "HNSW build (M=16, efC=200)", elapsedMs(t0));
+
+        vector<pair<double, size_t>> found;
+        for (size_t ef : {10, 20, 40, 80, 160, 320}) {
+            hnsw.efSearch = ef;
+            double recall = 0.0;
+            t0 = chrono::steady_clock::now();
+            for (size_t i = 0; i < q; i++) {
+                hnsw.query(&queries[i * n], k, found, train.data());
+                recall += recallAt(vector<size_t>(truth.begin() + i * k, truth.begin() + (i + 1) * k), found, k);
+            }
+            double ms = elapsedMs(t0);
+            printf("HNSW efSearch=%-14zu %10.1f us/query   recall@%zu %.4f\n", ef, ms * 1000.0 / q, k, recall / q);
+        }
+
+        // Serialization round trip must give identical answers.
+        string path = "hnsw_benchmark.bin";
+        hnsw.save(path);
+        HNSW loaded;
+        loaded.load(path);
+        remove(path.c_str());
+        vector<pair<double, size_t>> again;
+        for (size_t i = 0; i < q; i++) {
+            hnsw.query(&queries[i * n], k, found, train.data());
+            loaded.query(&queries[i * n], k, again, train.data());
+            if (found != again)
+                throw runtime_error("HNSW results changed after save/load.");
+        }
+        cout << "HNSW save/load round trip OK\n";
+
+        // IVF-PQ: bytes per vector, then sweep nprobe with and without exact re-ranking.
+        for (size_t subs : {16, 32, 64}) {
+            IVFPQ ivf(256, 8, subs);
+            t0 = chrono::steady_clock::now();
+            ivf.build(train, m, n);
+            printf("IVF-PQ build (%2zu bytes/code) %9.1f ms   %.1f bytes/vector (raw %zu)\n", subs, elapsedMs(t0),
+                   static_cast<double>(ivf.codeMemoryBytes()) / m, n * sizeof(double));
+            for (size_t rerank : {0, 100}) {
+                ivf.rerank = rerank;
+                for (size_t probes : {1, 4, 16, 64}) {
+                    ivf.nprobe = probes;
+                    double recall = 0.0;
+                    t0 = chrono::steady_clock::now();
+                    for (size_t i = 0; i < q; i++) {
+                        ivf.query(&queries[i * n], k, found, train.data());
+                        recall += recallAt(vector<size_t>(truth.begin() + i * k, truth.begin() + (i + 1) * k), found, k);
+                    }
+                    double ms = elapsedMs(t0);
+                    printf("  nprobe=%-3zu rerank=%-8zu %10.1f us/query   recall@%zu %.4f\n", probes, rerank,
+                           ms * 1000.0 / q, k, recall / q);
+                }
+            }
+        }
+
+        // LSH: half the rows at build time, the rest through incremental insertion.
+        LSH lsh(16, 10, 0);
+        size_t half = m / 2;
+        t0 = chrono::steady_clock::now();
+        lsh.build(vector<double>(train.begin(), train.begin() + half * n), half, n);
+        printf("%-28s %10.1f ms   (w=%.3f)\n", "LSH build (L=16, K=10)", elapsedMs(t0), lsh.activeWidth);
+        t0 = chrono::steady_clock::now();
+        for (size_t i = half; i < m; i += 1000)
+            lsh.insert(&train[i * n], min<size_t>(1000, m - i));
+        double insertMs = elapsedMs(t0);
+        printf("%-28s %10.0f rows/s\n", "LSH insert", (m - half) * 1000.0 / insertMs);
+        for (size_t probes : {0, 4, 16, 64}) {
+            lsh.probes = probes;
+            double recall = 0.0;
+            t0 = chrono::steady_clock::now();
+            for (size_t i = 0; i < q; i++) {
+                lsh.query(&queries[i * n], k, found, train.data());
+                recall += recallAt(vector<size_t>(truth.begin() + i * k, truth.begin() + (i + 1) * k), found, k);
+            }
+            double ms = elapsedMs(t0);
+            printf("LSH probes=%-17zu %10.1f us/query   recall@%zu %.4f\n", probes, ms * 1000.0 / q, k, recall / q);
+        }
+
+        // Dynamic updates: one writer streams rows in (and removes every tenth)
+        // while two readers keep querying; compactions run in the background.
+        KNN dynamic(static_cast<int>(k));
+        atomic<bool> writing(true);
+        atomic<size_t> queriesDone(0);
+        vector<thread> readers;
+        for (int r = 0; r < 2; r++) {
+            readers.emplace_back([&, r]() {
+                vector<pair<double, size_t>> out;
+                for (size_t i = r; writing; i = (i + 2) % q) {
+                    dynamic.findNeighbours(vector<double>(&queries[i * n], &queries[(i + 1) * n]), k, out);
+                    queriesDone++;
+                }
+            });
+        }
+        t0 = chrono::steady_clock::now();
+        size_t removedRows = 0;
+        for (size_t i = 0; i < m; i++) {
+            size_t id = dynamic.add(vector<double>(&train[i * n], &train[(i + 1) * n]), to_string(i % 7));
+            if (id % 10 == 9) removedRows += dynamic.remove(id - 5) ? 1 : 0;
+        }
+        double updateMs = elapsedMs(t0);
+        writing = false;
+        for (auto &t : readers) t.join();
+        dynamic.compact();
+        if (dynamic.liveRows() != m - removedRows)
+            throw runtime_error("Dynamic KNN lost or duplicated rows.");
+        printf("%-28s %10.0f updates/s   %zu concurrent queries\n", "KNN add/remove", (m + removedRows) * 1000.0 / updateMs,
+               queriesDone.load());
+    } catch (const exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
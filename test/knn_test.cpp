@@ -80,6 +80,293 @@ int main() {
             cout << predicted[i] << " vs " << actual[i] << "\n";
         cout << endl;
 
+        // Every index must return the same neighbours as a brute-force scan.
+        vector<KNN::Algorithm> indexes = {KNN::Algorithm::KDTree, KNN::Algorithm::BallTree};
+        vector<metric::Metric> metrics = {metric::Metric::Euclidean, metric::Metric::Manhattan, metric::Metric::Cosine,
+                                          metric::Metric::SquaredEuclidean, metric::Metric::Chebyshev,
+                                          metric::Metric::Minkowski};
+        for (auto dist : metrics) {
+            KNN brute(k);
+            brute.algorithm = KNN::Algorithm::BruteForce;
+            brute.distanceMetric = dist;
+            brute.minkowskiP = 3;
+            brute.train(trainSet);
+            vector<string> bruteLabels = brute.predictLabel(testSet);
+            for (auto algo : indexes) {
+                KNN indexed(k);
+                indexed.algorithm = algo;
+                indexed.distanceMetric = dist;
+                indexed.minkowskiP = 3;
+                indexed.train(trainSet);
+                if (indexed.predictLabel(testSet) != bruteLabels)
+                    throw runtime_error("Indexed KNN predictions differ from brute force.");
+            }
+        }
+        cout << "KD-tree and ball tree match brute force on " << testSet.features.size() << " queries\n";
+
+        // A median equal to the minimum (heavy duplicates) must still split the node.
+        vector<double> dupes;
+        for (size_t i = 0; i < 200; i++) {
+            dupes.push_back(i % 10 < 7 ? 0.0 : 10.0 + i % 7);
+            dupes.push_back((i * 37 % 101) / 101.0);
+        }
+        KDTree skewed;
+        skewed.build(dupes, 200, 2);
+        if (skewed.nodes.size() < 3)
+            throw runtime_error("KD-tree kept duplicate-heavy rows in a single leaf.");
+        for (double x : {0.0, 0.5, 12.0}) {
+            double q[2] = {x, 0.3};
+            vector<pair<double, size_t>> found, expected;
+            skewed.query(q, 5, found);
+            metric::withKernel(metric::Metric::Euclidean, 2, 2, [&](auto kernel) {
+                for (size_t i = 0; i < 200; i++)
+                    expected.emplace_back(decltype(kernel)::reduced(q, &dupes[2 * i], 2), i);
+            });
+            sort(expected.begin(), expected.end());
+            expected.resize(5);
+            if (found != expected)
+                throw runtime_error("KD-tree split above duplicates returns wrong neighbours.");
+        }
+        cout << "KD-tree splits duplicate-heavy nodes\n";
+
+        // Radius queries must return the same CSR arrays for every index.
+        for (auto dist : {metric::Metric::Euclidean, metric::Metric::Manhattan, metric::Metric::Chebyshev}) {
+            vector<size_t> baseOffsets, baseRows;
+            vector<double> baseDists;
+            for (auto algo : {KNN::Algorithm::BruteForce, KNN::Algorithm::KDTree, KNN::Algorithm::BallTree}) {
+                KNN radius(k);
+                radius.algorithm = algo;
+                radius.distanceMetric = dist;
+                radius.train(trainSet);
+                vector<double> queries = radius.prepareQueries(testSet);
+                vector<size_t> offsets, rows;
+                vector<double> dists;
+                size_t total = radius.radiusNeighbours(queries, testSet.features.size(), 1.5, offsets, rows, dists);
+                if (algo == KNN::Algorithm::BruteForce) {
+                    if (total == 0 || offsets.back() != total)
+                        throw runtime_error("Radius query found no neighbours.");
+                    baseOffsets = offsets;
+                    baseRows = rows;
+                    baseDists = dists;
+                } else if (offsets != baseOffsets || rows != baseRows || dists != baseDists) {
+                    throw runtime_error("Indexed radius query differs from brute force.");
+                }
+            }
+        }
+        cout << "Radius queries match brute force\n";
+
+        // Regression must average the (distance-weighted) targets of the k nearest rows.
+        KNN regressor(5);
+        regressor.weighting = KNN::Weighting::Distance;
+        regressor.train(trainSet);
+        vector<double> regressed = regressor.regress(testSet);
+        for (size_t i = 0; i < testSet.features.size(); i++) {
+            vector<double> query;
+            for (auto &v : testSet.features[i]) query.push_back(handle::toDouble(v));
+            vector<pair<double, size_t>> near;
+            regressor.findNeighbours(query, 5, near);
+            double sum = 0.0, total = 0.0;
+            bool exact = near[0].first == 0.0;
+            for (auto &c : near) {
+                double w = exact ? (c.first == 0.0 ? 1.0 : 0.0) : 1.0 / sqrt(c.first);
+                sum += w * handle::toDouble(trainSet.target[c.second]);
+                total += w;
+            }
+            if (fabs(regressed[i] - sum / total) > 1e-9)
+                throw runtime_error("Weighted KNN regression differs from the neighbour average.");
+        }
+        cout << "Distance-weighted regression matches neighbour averages\n";
+
+        // One k sweep must score every k exactly like predicting with that k.
+        KNN::KSelection sweep = knn.selectK(testSet, 15);
+        for (int kk : {1, 4, 9, 15}) {
+            KNN single(kk);
+            single.train(trainSet);
+            vector<double> singlePredicted = single.predict(testSet);
+            if (fabs(sweep.accuracy[kk - 1] - handle::computeAccuracy(actual, singlePredicted)) > 1e-12)
+                throw runtime_error("k selection accuracy differs from predict().");
+        }
+        KNN::KSelection loo = knn.selectKLeaveOneOut(15);
+        for (int kk : {1, 6}) {
+            size_t hits = 0;
+            for (size_t i = 0; i < trainSet.features.size(); i++) {
+                handle::Data rest = trainSet, one = trainSet;
+                rest.features.erase(rest.features.begin() + i);
+                rest.target.erase(rest.target.begin() + i);
+                one.features = {trainSet.features[i]};
+                one.target = {trainSet.target[i]};
+                KNN held(kk);
+                held.train(rest);
+                hits += held.predictLabel(one)[0] == trainSet.target[i] ? 1 : 0;
+            }
+            if (fabs(loo.accuracy[kk - 1] - static_cast<double>(hits) / trainSet.features.size()) > 1e-12)
+                throw runtime_error("Leave-one-out k selection differs from retraining.");
+        }
+        cout << "k selection: best k " << sweep.bestK << " (validation), " << loo.bestK << " (leave-one-out)\n";
+
+        // An approximate index may find fewer than k rows; only the rows found may vote.
+        KNN sparse(25);
+        sparse.algorithm = KNN::Algorithm::LSH;
+        sparse.lsh = LSH(1, 2, 0);
+        sparse.train(trainSet);
+        vector<double> sparseQueries = sparse.prepareQueries(testSet);
+        vector<size_t> sparseRows, sparseCounts;
+        vector<double> sparseDists;
+        size_t width = sparse.batchNeighbours(sparseQueries, testSet.features.size(), 25, sparseRows, sparseDists,
+                                              sparseCounts);
+        vector<double> sparseRegressed = sparse.regress(testSet);
+        size_t shortLists = 0, found = 0;
+        for (size_t i = 0; i < testSet.features.size(); i++) {
+            shortLists += sparseCounts[i] < width ? 1 : 0;
+            found += sparseCounts[i];
+            double sum = 0.0;
+            for (size_t j = 0; j < sparseCounts[i]; j++)
+                sum += handle::toDouble(trainSet.target[sparseRows[i * width + j]]);
+            if (fabs(sparseRegressed[i] - (sparseCounts[i] > 0 ? sum / sparseCounts[i] : 0.0)) > 1e-9)
+                throw runtime_error("KNN regression used neighbours the index did not find.");
+        }
+        if (shortLists == 0 || found == 0)
+            throw runtime_error("The short-list test needs LSH buckets that hold some, but fewer than k, rows.");
+        KNN::KSelection sparseSweep = sparse.selectK(testSet, 25);
+        vector<double> sparsePredicted = sparse.predict(testSet);
+        if (fabs(sparseSweep.accuracy[24] - handle::computeAccuracy(actual, sparsePredicted)) > 1e-12)
+            throw runtime_error("k selection over short neighbour lists differs from predict().");
+        cout << "Short LSH neighbour lists: " << shortLists << " of " << testSet.features.size() << " queries\n";
+
+        // An estimated bucket width belongs to the data it was measured on, not to the settings.
+        LSH rebuilt(4, 4, 0);
+        vector<double> scaled(sparseQueries.size());
+        for (size_t i = 0; i < scaled.size(); i++)
+            scaled[i] = 10.0 * sparseQueries[i];
+        size_t cols = scaled.size() / testSet.features.size();
+        rebuilt.build(sparseQueries, testSet.features.size(), cols);
+        double firstWidth = rebuilt.activeWidth;
+        rebuilt.build(scaled, testSet.features.size(), cols);
+        if (rebuilt.bucketWidth != 0.0 || fabs(rebuilt.activeWidth - 10.0 * firstWidth) > 1e-9 * rebuilt.activeWidth)
+            throw runtime_error("LSH rebuild reused the width estimated on earlier data.");
+
+        // Fixed-dimension kernels must agree with the runtime-dimension loops.
+        vector<double> a(16), b(16);
+        for (size_t j = 0; j < 16; j++) {
+            a[j] = 0.37 * j - 2.0;
+            b[j] = 1.5 - 0.21 * j * j / 16.0;
+        }
+        for (auto dist : metrics) {
+            for (size_t n : {2, 3, 4, 8, 16}) {
+                double generic = 0.0, fixed = 0.0;
+                metric::withMetric(dist, 3, [&](auto policy) { generic = decltype(policy)::reduced(a.data(), b.data(), n); });
+                metric::withKernel(dist, 3, n, [&](auto kernel) { fixed = decltype(kernel)::reduced(a.data(), b.data(), n); });
+                if (fabs(generic - fixed) > 1e-9 * max(1.0, generic))
+                    throw runtime_error("Fixed-dimension distance kernel differs from the generic one.");
+            }
+        }
+        cout << "Fixed-dimension distance kernels match\n";
+
+        // A saved model must predict the same labels once loaded.
+        for (auto algo : {KNN::Algorithm::BruteForce, KNN::Algorithm::KDTree, KNN::Algorithm::BallTree,
+                          KNN::Algorithm::HNSW, KNN::Algorithm::LSH}) {
+            KNN saved(k);
+            saved.algorithm = algo;
+            saved.featureMean.assign(trainSet.features[0].size(), 1.0);
+            saved.featureScale.assign(trainSet.features[0].size(), 2.0);
+            saved.train(trainSet);
+            saved.save("knn_model_test.bin");
+            KNN loaded;
+            loaded.load("knn_model_test.bin");
+            remove("knn_model_test.bin");
+            if (loaded.predictLabel(testSet) != saved.predictLabel(testSet))
+                throw runtime_error("Loaded KNN model predicts differently.");
+            // Rows and trees are served from the mapped file until the model changes.
+            if (!loaded.points.mapped() || !loaded.labels.mapped() ||
+                (algo == KNN::Algorithm::KDTree && !loaded.kdTree.nodes.mapped()) ||
+                (algo == KNN::Algorithm::BallTree && !loaded.ballTree.points.mapped()))
+                throw runtime_error("Loaded KNN model copied its arrays out of the mapping.");
+            vector<double> extra;
+            for (auto &v : testSet.features[0]) extra.push_back(handle::toDouble(v));
+            saved.add(extra, "extra");
+            loaded.add(extra, "extra");
+            saved.compact();
+            loaded.compact();
+            if (loaded.predictLabel(testSet) != saved.predictLabel(testSet))
+                throw runtime_error("Updated loaded KNN model predicts differently.");
+        }
+        cout << "Saved models reload with identical predictions\n";
+
+        // Incremental add/remove must find the same neighbours as retraining on the live rows.
+        size_t half = trainSet.features.size() / 2;
+        handle::Data firstHalf = trainSet, live = trainSet;
+        firstHalf.features.resize(half);
+        firstHalf.target.resize(half);
+        live.features.clear();
+        live.target.clear();
+        // LSH gets a fixed bucket width so that both models hash rows identically.
+        for (auto algo : {KNN::Algorithm::BruteForce, KNN::Algorithm::KDTree, KNN::Algorithm::BallTree,
+                          KNN::Algorithm::LSH}) {
+            KNN dynamic(k);
+            dynamic.algorithm = algo;
+            dynamic.lsh = LSH(8, 4, 4, 1.0);
+            dynamic.train(firstHalf);
+            for (size_t i = half; i < trainSet.features.size(); i++) {
+                vector<double> row;
+                for (auto &v : trainSet.features[i]) row.push_back(handle::toDouble(v));
+                dynamic.add(row, trainSet.target[i]);
+            }
+            if (algo == KNN::Algorithm::LSH && (dynamic.lsh.size() != trainSet.features.size() || dynamic.hasPendingUpdates()))
+                throw runtime_error("LSH adds were not inserted into the hash tables.");
+            live.features.clear();
+            live.target.clear();
+            for (size_t i = 0; i < trainSet.features.size(); i++) {
+                if (i % 5 == 0) {
+                    dynamic.remove(i);
+                } else {
+                    live.features.push_back(trainSet.features[i]);
+                    live.target.push_back(trainSet.target[i]);
+                }
+            }
+            KNN fresh(k);
+            fresh.algorithm = algo;
+            fresh.lsh = LSH(8, 4, 4, 1.0);
+            fresh.train(live);
+            for (int pass = 0; pass < 2; pass++) {
+                for (auto &f : testSet.features) {
+                    vector<double> query;
+                    for (auto &v : f) query.push_back(handle::toDouble(v));
+                    vector<pair<double, size_t>> a, b;
+                    dynamic.findNeighbours(query, k, a);
+                    fresh.findNeighbours(query, k, b);
+                    for (size_t j = 0; j < a.size() || j < b.size(); j++)
+                        if (a.size() != b.size() || a[j].first != b[j].first)
+                            throw runtime_error("Updated KNN neighbours differ from a retrained model.");
+                }
+                dynamic.compact();
+            }
+            if (dynamic.liveRows() != live.features.size() || dynamic.hasPendingUpdates())
+                throw runtime_error("Compaction left pending updates.");
+        }
+        cout << "Incremental add/remove matches retraining\n";
+
+        // Approximate indexes skip tombstones while they search, so k live rows still come back.
+        for (auto algo : {KNN::Algorithm::HNSW, KNN::Algorithm::IVFPQ, KNN::Algorithm::LSH}) {
+            KNN pruned(k);
+            pruned.algorithm = algo;
+            pruned.ivfpq = IVFPQ(4, 4, 2, 50);
+            pruned.train(trainSet);
+            for (size_t id = 0; id < trainSet.features.size(); id += 2)
+                pruned.remove(id);
+            for (auto &f : testSet.features) {
+                vector<double> query;
+                for (auto &v : f) query.push_back(handle::toDouble(v));
+                vector<pair<double, size_t>> near;
+                pruned.findNeighbours(query, k, near);
+                for (auto &c : near)
+                    if (pruned.rowId(c.second) % 2 == 0)
+                        throw runtime_error("A removed row was returned by an approximate index.");
+                if (algo != KNN::Algorithm::LSH && near.size() != static_cast<size_t>(k))
+                    throw runtime_error("Tombstones left an approximate search short of k rows.");
+            }
+        }
+        cout << "Approximate indexes skip removed rows\n";
+
         knn.plot(testSet);
     } catch (const exception &e) {
         cerr << "Error: " << e.what() << endl;